@@ -2,9 +2,24 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
-#include <errno.h>
+#include <limits.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "mex.h"
+#include "svm.h"
+#include "svm_dataset.h"
+#include "svm_parse.h"
 
 #ifdef MX_API_VER
 #if MX_API_VER < 0x07030000
@@ -18,10 +33,13 @@ typedef int mwIndex;
 #define min(x,y) (((x)<(y))?(x):(y))
 #endif
 
+#define PARSE_CHUNK (1<<20)	// bytes per thread at least
+
 void exit_with_help()
 {
 	mexPrintf(
 	"Usage: [label_vector, instance_matrix] = libsvmread('filename');\n"
+	"       (a text file, or a binary dataset file of libsvmwrite '-b 1')\n"
 	);
 }
 
@@ -32,163 +50,392 @@ static void fake_answer(int nlhs, mxArray *plhs[])
 		plhs[i] = mxCreateDoubleMatrix(0, 0, mxREAL);
 }
 
-static char *line;
-static int max_line_len;
-
-static char* readline(FILE *input)
+// map a file read-only; *size is 0 and NULL returned for an empty file
+static char *map_file(const char *filename, size_t *size, int *error)
 {
-	int len;
-	
-	if(fgets(line,max_line_len,input) == NULL)
-		return NULL;
-
-	while(strrchr(line,'\n') == NULL)
+	char *base;
+	*size = 0;
+	*error = 1;
+#ifdef _WIN32
+	{
+		HANDLE file, mapping;
+		LARGE_INTEGER file_size;
+		file = CreateFileA(filename,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+		if(file == INVALID_HANDLE_VALUE)
+			return NULL;
+		if(!GetFileSizeEx(file,&file_size) || file_size.QuadPart == 0)
+		{
+			*error = file_size.QuadPart != 0;
+			CloseHandle(file);
+			return NULL;
+		}
+		*size = (size_t)file_size.QuadPart;
+		mapping = CreateFileMappingA(file,NULL,PAGE_READONLY,0,0,NULL);
+		CloseHandle(file);
+		if(mapping == NULL)
+			return NULL;
+		base = (char *)MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+		CloseHandle(mapping);
+		if(base == NULL)
+			return NULL;
+	}
+#else
 	{
-		max_line_len *= 2;
-		line = (char *) realloc(line, max_line_len);
-		len = (int) strlen(line);
-		if(fgets(line+len,max_line_len-len,input) == NULL)
-			break;
+		struct stat st;
+		int fd = open(filename,O_RDONLY);
+		if(fd < 0)
+			return NULL;
+		if(fstat(fd,&st) != 0 || st.st_size == 0)
+		{
+			*error = st.st_size != 0;
+			close(fd);
+			return NULL;
+		}
+		*size = (size_t)st.st_size;
+		base = (char *)mmap(NULL,*size,PROT_READ,MAP_PRIVATE,fd,0);
+		close(fd);
+		if(base == MAP_FAILED)
+			return NULL;
 	}
-	return line;
+#endif
+	*error = 0;
+	return base;
 }
 
-// read in a problem (in libsvm format)
-void read_problem(const char *filename, int nlhs, mxArray *plhs[])
+static void unmap_file(char *base, size_t size)
 {
-	int max_index, min_index, inst_max_index;
-	size_t elements, k, i, l=0;
-	FILE *fp = fopen(filename,"r");
-	char *endptr;
-	mwIndex *ir, *jc;
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+#else
+	munmap(base,size);
+#endif
+}
+
+// lines parsed by one thread, appended to growing arrays
+struct chunk
+{
+	const char *begin, *end;
+	size_t l, max_l, elements, max_elements;
 	double *labels, *samples;
+	int *index;
+	size_t *start;		// first element of each line
+	int max_index, min_index;
+	size_t error_line;	// 1-based within the chunk, 0 if none
+	const char *error_msg;
+};
+
+static void parse_chunk(struct chunk *c)
+{
+	const char *p = c->begin, *end = c->end;
 
-	if(fp == NULL)
+	while(p < end)
 	{
-		mexPrintf("can't open input file %s\n",filename);
-		fake_answer(nlhs, plhs);
-		return;
-	}
+		int inst_max_index = -1; // precomputed kernel has <index> start from 0
+		if(c->l == c->max_l)
+		{
+			c->max_l = max(2*c->max_l,64);
+			c->labels = (double *)realloc(c->labels,c->max_l*sizeof(double));
+			c->start = (size_t *)realloc(c->start,c->max_l*sizeof(size_t));
+		}
+		c->start[c->l++] = c->elements;
 
-	max_line_len = 1024;
-	line = (char *) malloc(max_line_len*sizeof(char));
+		p = skip_blank(p,end);
+		if(p == end || *p == '\n')
+		{
+			c->error_line = c->l;
+			c->error_msg = "Empty line";
+			return;
+		}
+		if((p = parse_double(p,end,&c->labels[c->l-1])) == NULL || (p < end && *p == ':'))
+		{
+			c->error_line = c->l;
+			c->error_msg = "Wrong input format";
+			return;
+		}
 
-	max_index = 0;
-	min_index = 1; // our index starts from 1
-	elements = 0;
-	while(readline(fp) != NULL)
-	{
-		char *idx, *val;
 		// features
-		int index = 0;
-
-		inst_max_index = -1; // strtol gives 0 if wrong format, and precomputed kernel has <index> start from 0
-		strtok(line," \t"); // label
-		while (1)
+		while(1)
 		{
-			idx = strtok(NULL,":"); // index:value
-			val = strtok(NULL," \t");
-			if(val == NULL)
+			int index;
+			p = skip_blank(p,end);
+			if(p == end || *p == '\n')
 				break;
-
-			errno = 0;
-			index = (int) strtol(idx,&endptr,10);
-			if(endptr == idx || errno != 0 || *endptr != '\0' || index <= inst_max_index)
+			if(c->elements == c->max_elements)
+			{
+				c->max_elements = max(2*c->max_elements,1024);
+				c->index = (int *)realloc(c->index,c->max_elements*sizeof(int));
+				c->samples = (double *)realloc(c->samples,c->max_elements*sizeof(double));
+			}
+			if((p = parse_int(p,end,&index)) == NULL || p == end || *p++ != ':' || index <= inst_max_index ||
+			   (p = parse_double(p,end,&c->samples[c->elements])) == NULL || (p < end && *p == ':'))
 			{
-				mexPrintf("Wrong input format at line %d\n",l+1);
-				fake_answer(nlhs, plhs);
+				c->error_line = c->l;
+				c->error_msg = "Wrong input format";
 				return;
 			}
-			else
-				inst_max_index = index;
+			inst_max_index = index;
+			c->index[c->elements++] = index;
+			c->min_index = min(c->min_index, index);
+		}
+		c->max_index = max(c->max_index, inst_max_index);
+		if(p < end)
+			p++;
+	}
+}
 
-			min_index = min(min_index, index);
-			elements++;
+// the instance matrix is built as its transpose, one column per row
+static void transpose_instances(int nlhs, mxArray *plhs[])
+{
+	mxArray *rhs[1], *lhs[1];
+	rhs[0] = plhs[1];
+	if(mexCallMATLAB(1, lhs, 1, rhs, "transpose"))
+	{
+		mexPrintf("Error: cannot transpose problem\n");
+		fake_answer(nlhs, plhs);
+		return;
+	}
+	plhs[1] = lhs[0];
+}
+
+// a node of a SVM_DATASET_NODES file: int index first, double value last
+static int node_index(const char *node)
+{
+	int32_t index;
+	memcpy(&index, node, sizeof(index));
+	return index;
+}
+
+// a mapped file in the binary format of svm_dataset.h, 0 if valid
+static int read_problem_binary(const char *base, size_t size, mxArray *plhs[])
+{
+	const struct svm_dataset_header *header = (const struct svm_dataset_header *)base;
+	const uint64_t *start;
+	const uint32_t *index;
+	const float *value;
+	const char *node;
+	size_t i, l, nnz, node_size;
+	int min_index, nodes, nr_thread = 1;
+	mwIndex *ir, *jc;
+	double *samples;
+
+	if(!svm_dataset_check(header, size))
+		return 1;
+	// nodes must be laid out as our struct svm_node
+	if(header->layout == SVM_DATASET_NODES && header->node_size != sizeof(struct svm_node))
+		return 1;
+	l = (size_t)header->l;
+	nnz = (size_t)header->nnz;
+	min_index = header->min_index;
+	nodes = header->layout == SVM_DATASET_NODES;
+	node_size = header->node_size;
+	start = (const uint64_t *)(base+header->offset_start);
+	index = (const uint32_t *)(base+header->offset_index);
+	value = (const float *)(base+header->offset_value);
+	node = base+header->offset_index;
+	if(start[0] != 0 || start[l] != (nodes ? nnz+l : nnz))
+		return 1;
+	for(i=0;i<l;i++)
+		if(start[i] + (nodes ? 1 : 0) > start[i+1])
+			return 1;
+	if(nodes)
+	{
+		// one terminator at the end of each row
+		size_t k = 0;
+		for(i=0;i<l;i++)
+		{
+			for(;k+1<start[i+1];k++)
+			{
+				int t = node_index(node+k*node_size);
+				if(t < min_index || t > header->max_index)
+					return 1;
+			}
+			if(node_index(node+(k++)*node_size) != -1)
+				return 1;
 		}
-		max_index = max(max_index, inst_max_index);
-		l++;
 	}
-	rewind(fp);
+	else
+		for(i=0;i<nnz;i++)
+			if(index[i] < (uint32_t)min_index || index[i] > (uint32_t)header->max_index)
+				return 1;
 
 	// y
 	plhs[0] = mxCreateDoubleMatrix(l, 1, mxREAL);
+	if(l > 0)
+		memcpy(mxGetPr(plhs[0]), base+header->offset_y, l*sizeof(double));
 	// x^T
-	if (min_index <= 0)
-		plhs[1] = mxCreateSparse(max_index-min_index+1, l, elements, mxREAL);
-	else
-		plhs[1] = mxCreateSparse(max_index, l, elements, mxREAL);
-
-	labels = mxGetPr(plhs[0]);
+	plhs[1] = mxCreateSparse((size_t)(header->max_index-min_index+1), l, nnz, mxREAL);
 	samples = mxGetPr(plhs[1]);
 	ir = mxGetIr(plhs[1]);
 	jc = mxGetJc(plhs[1]);
-
-	k=0;
-	for(i=0;i<l;i++)
+	for(i=0;i<=l;i++)
+		jc[i] = (mwIndex)(nodes ? start[i]-i : start[i]);
+#ifdef _OPENMP
+	nr_thread = omp_get_max_threads();
+#endif
+	if(nodes)
 	{
-		char *idx, *val, *label;
-		jc[i] = k;
-
-		readline(fp);
-
-		label = strtok(line," \t\n");
-		if(label == NULL)
+#pragma omp parallel for schedule(static) num_threads(nr_thread) if(nr_thread > 1 && nnz > PARSE_CHUNK)
+		for(i=0;i<l;i++)
 		{
-			mexPrintf("Empty line at line %d\n",i+1);
-			fake_answer(nlhs, plhs);
-			return;
+			size_t j, k = start[i];
+			for(j=jc[i];j<jc[i+1];j++,k++)
+			{
+				ir[j] = (mwIndex)(node_index(node+k*node_size) - min_index);
+				memcpy(&samples[j], node+(k+1)*node_size-sizeof(double), sizeof(double));
+			}
 		}
-		labels[i] = strtod(label,&endptr);
-		if(endptr == label || *endptr != '\0')
+	}
+	else
+	{
+#pragma omp parallel for schedule(static) num_threads(nr_thread) if(nr_thread > 1 && nnz > PARSE_CHUNK)
+		for(i=0;i<nnz;i++)
 		{
-			mexPrintf("Wrong input format at line %d\n",i+1);
+			ir[i] = (mwIndex)(index[i] - (uint32_t)min_index); // precomputed kernel has <index> start from 0
+			samples[i] = value[i];
+		}
+	}
+	return 0;
+}
+
+// read in a problem (in libsvm format)
+void read_problem(const char *filename, int nlhs, mxArray *plhs[])
+{
+	int max_index, min_index, t, nr_chunk, nr_thread = 1;
+	size_t size, l, elements, line;
+	int error;
+	char *base = map_file(filename, &size, &error);
+	const char *end = base+size;
+	struct chunk *chunk;
+	size_t *line_offset, *element_offset;
+	mwIndex *ir, *jc;
+	double *labels, *samples;
+
+	if(error)
+	{
+		mexPrintf("can't open input file %s\n",filename);
+		fake_answer(nlhs, plhs);
+		return;
+	}
+
+	if(size >= sizeof(struct svm_dataset_header) &&
+	   memcmp(base, SVM_DATASET_MAGIC, sizeof(((struct svm_dataset_header *)0)->magic)) == 0)
+	{
+		error = read_problem_binary(base, size, plhs);
+		unmap_file(base, size);
+		if(error)
+		{
+			mexPrintf("Wrong binary dataset format\n");
 			fake_answer(nlhs, plhs);
-			return;
 		}
+		else
+			transpose_instances(nlhs, plhs);
+		return;
+	}
 
-		// features
-		while(1)
+	// split the file at line starts, each thread parsing one piece
+#ifdef _OPENMP
+	nr_thread = omp_get_max_threads();
+#endif
+	nr_chunk = (int)min((size_t)nr_thread, size/PARSE_CHUNK+1);
+	chunk = (struct chunk *) calloc(nr_chunk, sizeof(struct chunk));
+	for(t=0;t<nr_chunk;t++)
+	{
+		const char *p = base+size/nr_chunk*t;
+		if(t > 0)
 		{
-			idx = strtok(NULL,":");
-			val = strtok(NULL," \t");
-			if(val == NULL)
-				break;
+			p = (const char *)memchr(p-1,'\n',(size_t)(end-(p-1)));
+			p = p ? max(p+1, chunk[t-1].begin) : end;
+		}
+		chunk[t].begin = p;
+		if(t > 0)
+			chunk[t-1].end = p;
+		chunk[t].max_index = 0;
+		chunk[t].min_index = 1; // our index starts from 1
+	}
+	if(nr_chunk > 0)
+		chunk[nr_chunk-1].end = end;
 
-			ir[k] = (mwIndex) (strtol(idx,&endptr,10) - min_index); // precomputed kernel has <index> start from 0
+#pragma omp parallel for schedule(static,1) num_threads(nr_chunk) if(nr_chunk > 1)
+	for(t=0;t<nr_chunk;t++)
+		parse_chunk(&chunk[t]);
 
-			errno = 0;
-			samples[k] = strtod(val,&endptr);
-			if (endptr == val || errno != 0 || (*endptr != '\0' && !isspace(*endptr)))
-			{
-				mexPrintf("Wrong input format at line %d\n",i+1);
-				fake_answer(nlhs, plhs);
-				return;
-			}
-			++k;
+	line_offset = (size_t *) malloc((nr_chunk+1)*sizeof(size_t));
+	element_offset = (size_t *) malloc((nr_chunk+1)*sizeof(size_t));
+	line_offset[0] = element_offset[0] = 0;
+	max_index = 0;
+	min_index = 1;
+	error = 0;
+	for(t=0;t<nr_chunk;t++)
+	{
+		if(chunk[t].error_line && !error)
+		{
+			mexPrintf("%s at line %d\n", chunk[t].error_msg, (int)(line_offset[t]+chunk[t].error_line));
+			error = 1;
 		}
+		line_offset[t+1] = line_offset[t]+chunk[t].l;
+		element_offset[t+1] = element_offset[t]+chunk[t].elements;
+		max_index = max(max_index, chunk[t].max_index);
+		min_index = min(min_index, chunk[t].min_index);
 	}
-	jc[l] = k;
-
-	fclose(fp);
-	free(line);
+	l = line_offset[nr_chunk];
+	elements = element_offset[nr_chunk];
 
+	if(!error)
 	{
-		mxArray *rhs[1], *lhs[1];
-		rhs[0] = plhs[1];
-		if(mexCallMATLAB(1, lhs, 1, rhs, "transpose"))
+		// y
+		plhs[0] = mxCreateDoubleMatrix(l, 1, mxREAL);
+		// x^T
+		if (min_index <= 0)
+			plhs[1] = mxCreateSparse(max_index-min_index+1, l, elements, mxREAL);
+		else
+			plhs[1] = mxCreateSparse(max_index, l, elements, mxREAL);
+
+		labels = mxGetPr(plhs[0]);
+		samples = mxGetPr(plhs[1]);
+		ir = mxGetIr(plhs[1]);
+		jc = mxGetJc(plhs[1]);
+
+#pragma omp parallel for private(line) schedule(static,1) num_threads(nr_chunk) if(nr_chunk > 1)
+		for(t=0;t<nr_chunk;t++)
 		{
-			mexPrintf("Error: cannot transpose problem\n");
-			fake_answer(nlhs, plhs);
-			return;
+			const struct chunk *c = &chunk[t];
+			size_t k, k0 = element_offset[t];
+			if(c->l > 0)
+				memcpy(labels+line_offset[t], c->labels, c->l*sizeof(double));
+			if(c->elements > 0)
+				memcpy(samples+k0, c->samples, c->elements*sizeof(double));
+			for(line=0;line<c->l;line++)
+				jc[line_offset[t]+line] = k0+c->start[line];
+			for(k=0;k<c->elements;k++)
+				ir[k0+k] = (mwIndex)(c->index[k] - min_index); // precomputed kernel has <index> start from 0
 		}
-		plhs[1] = lhs[0];
+		jc[l] = elements;
 	}
+	else
+		fake_answer(nlhs, plhs);
+
+	for(t=0;t<nr_chunk;t++)
+	{
+		free(chunk[t].labels);
+		free(chunk[t].samples);
+		free(chunk[t].index);
+		free(chunk[t].start);
+	}
+	free(chunk);
+	free(line_offset);
+	free(element_offset);
+	if(base != NULL)
+		unmap_file(base, size);
+	if(error)
+		return;
+
+	transpose_instances(nlhs, plhs);
 }
 
 void mexFunction( int nlhs, mxArray *plhs[],
 		int nrhs, const mxArray *prhs[] )
 {
-	char filename[256];
+	char *filename;
 
 	if(nrhs != 1 || nlhs != 2)
 	{
@@ -197,15 +444,17 @@ void mexFunction( int nlhs, mxArray *plhs[],
 		return;
 	}
 
-	mxGetString(prhs[0], filename, mxGetN(prhs[0]) + 1);
+	filename = mxArrayToString(prhs[0]);
 
 	if(filename == NULL)
 	{
 		mexPrintf("Error: filename is NULL\n");
+		fake_answer(nlhs, plhs);
 		return;
 	}
 
 	read_problem(filename, nlhs, plhs);
+	mxFree(filename);
 
 	return;
 }
@@ -1,7 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "mex.h"
+#include "svm.h"
+#include "svm_dataset.h"
+#include "svm_parse.h"
 
 #ifdef MX_API_VER
 #if MX_API_VER < 0x07030000
@@ -9,10 +16,20 @@ typedef int mwIndex;
 #endif
 #endif
 
+#ifndef min
+#define min(x,y) (((x)<(y))?(x):(y))
+#endif
+
+#define WRITE_CHUNK (1<<18)	// nonzeros plus rows formatted by a thread at a time
+
 void exit_with_help()
 {
 	mexPrintf(
 	"Usage: libsvmwrite('filename', label_vector, instance_matrix);\n"
+	"       libsvmwrite('filename', label_vector, instance_matrix, '-b 1');\n"
+	"       (binary dataset file, with float values, read back by libsvmread)\n"
+	"       libsvmwrite('filename', label_vector, instance_matrix, '-b 2');\n"
+	"       (binary dataset file of svm_node rows, which svmtrain maps in place)\n"
 	);
 }
 
@@ -23,14 +40,292 @@ static void fake_answer(int nlhs, mxArray *plhs[])
 		plhs[i] = mxCreateDoubleMatrix(0, 0, mxREAL);
 }
 
-void libsvmwrite(const char *filename, const mxArray *label_vec, const mxArray *instance_mat)
+static char *format_index(char *p, size_t v)
+{
+	char digit[24];
+	int n = 0;
+	do
+	{
+		digit[n++] = (char)('0' + v%10);
+		v /= 10;
+	} while(v > 0);
+	while(n > 0)
+		*p++ = digit[--n];
+	return p;
+}
+
+// write v as printf("%g") does (at most 13 characters). The 6 digits
+// come from one exact power of ten, so they are correctly rounded
+// unless the scaled value is near a tie; those and nan, inf and
+// extreme exponents go to snprintf.
+static char *format_double(char *p, double v)
+{
+	double a = fabs(v), scaled = 0, frac;
+	long m;
+	int e = 0, n, i;
+	char digit[6];
+
+	if(v == 0)
+	{
+		if(signbit(v))
+			*p++ = '-';
+		*p++ = '0';
+		return p;
+	}
+	if(a >= 1e-16 && a <= 1e26)
+	{
+		e = (int)floor(log10(a));
+		scaled = e <= 5 ? a*exact_pow10[5-e] : a/exact_pow10[e-5];
+		if(scaled < 1e5)
+		{
+			e--;
+			scaled = e <= 5 ? a*exact_pow10[5-e] : a/exact_pow10[e-5];
+		}
+		else if(scaled >= 1e6)
+		{
+			e++;
+			scaled = e <= 5 ? a*exact_pow10[5-e] : a/exact_pow10[e-5];
+		}
+	}
+	m = (long)scaled;
+	frac = scaled - (double)m;
+	if(!(a >= 1e-16 && a <= 1e26) || fabs(frac - 0.5) < 1e-6)
+		return p + snprintf(p, 16, "%g", v);
+	if(frac > 0.5)
+		m++;
+	if(m == 1000000)
+	{
+		m = 100000;
+		e++;
+	}
+	for(i=5;i>=0;i--,m/=10)
+		digit[i] = (char)('0' + m%10);
+	for(n=6;n>1 && digit[n-1]=='0';n--)
+		;
+
+	if(v < 0)
+		*p++ = '-';
+	if(e >= -4 && e < 6)
+	{
+		if(e >= 0)
+		{
+			for(i=0;i<=e;i++)
+				*p++ = digit[i];
+			if(n > e+1)
+				*p++ = '.';
+			for(;i<n;i++)
+				*p++ = digit[i];
+		}
+		else
+		{
+			*p++ = '0';
+			*p++ = '.';
+			for(i=-1;i>e;i--)
+				*p++ = '0';
+			for(i=0;i<n;i++)
+				*p++ = digit[i];
+		}
+	}
+	else
+	{
+		*p++ = digit[0];
+		if(n > 1)
+			*p++ = '.';
+		for(i=1;i<n;i++)
+			*p++ = digit[i];
+		*p++ = 'e';
+		*p++ = e < 0 ? '-' : '+';
+		if(e < 0)
+			e = -e;
+		if(e < 10)
+			*p++ = '0';
+		p = format_index(p, (size_t)e);
+	}
+	return p;
+}
+
+// a growing buffer holding the text of some rows
+struct text_buffer
+{
+	char *p;
+	size_t size, cap;
+};
+
+// format rows [begin,end) of the transposed (row-major) matrix
+static void format_rows(struct text_buffer *b, const double *labels, const double *samples,
+	const mwIndex *ir, const mwIndex *jc, size_t begin, size_t end)
+{
+	size_t i, need;
+	mwIndex k;
+	char *p;
+
+	// a row takes at most 14 characters for the label and newline and
+	// 35 for each " index:value"
+	need = (end-begin)*14 + (size_t)(jc[end]-jc[begin])*35;
+	if(need > b->cap)
+	{
+		free(b->p);
+		b->cap = need;
+		b->p = (char *) malloc(b->cap);
+	}
+	p = b->p;
+	for(i=begin;i<end;i++)
+	{
+		p = format_double(p, labels[i]);
+		for(k=jc[i];k<jc[i+1];k++)
+		{
+			*p++ = ' ';
+			p = format_index(p, (size_t)ir[k]+1);
+			*p++ = ':';
+			p = format_double(p, samples[k]);
+		}
+		*p++ = '\n';
+	}
+	b->size = (size_t)(p - b->p);
+}
+
+// the rows as struct svm_node, each ended by index -1
+static int write_nodes(FILE *fp, uint64_t *pos, const double *samples,
+	const mwIndex *ir, const mwIndex *jc, size_t l)
+{
+	const size_t block = 1<<16;
+	struct svm_node *node = (struct svm_node *) calloc(block, sizeof(struct svm_node));
+	size_t i, k, n = 0;
+	int ok = 1;
+
+	for(i=0;i<l && ok;i++)
+		for(k=jc[i];k<=jc[i+1] && ok;k++)
+		{
+			if(n == block)
+			{
+				ok = svm_dataset_write(fp, pos, node, sizeof(struct svm_node)*n);
+				n = 0;
+			}
+			node[n].index = k < jc[i+1] ? (int)ir[k]+1 : -1;
+			node[n].value = k < jc[i+1] ? samples[k] : 0;
+			n++;
+		}
+	ok = ok && svm_dataset_write(fp, pos, node, sizeof(struct svm_node)*n);
+	free(node);
+	return ok;
+}
+
+// the binary format of svm_dataset.h, converted in blocks of rows
+static int write_binary(FILE *fp, const double *labels, const double *samples,
+	const mwIndex *ir, const mwIndex *jc, size_t l, size_t nr_feature, int layout)
+{
+	struct svm_dataset_header header;
+	const size_t block = 1<<16;
+	uint64_t pos = 0, *start = (uint64_t *) malloc(block*sizeof(uint64_t));
+	uint32_t *index = (uint32_t *) malloc(block*sizeof(uint32_t));
+	float *value = (float *) malloc(block*sizeof(float));
+	size_t i, k, n, nnz = (size_t)jc[l];
+	int ok, nodes = layout == SVM_DATASET_NODES;
+
+	svm_dataset_init(&header, (uint32_t)layout, nodes ? (uint32_t)sizeof(struct svm_node) : 0);
+	header.l = l;
+	header.nnz = nnz;
+	header.max_index = (int32_t)nr_feature;
+	header.file_size = svm_dataset_layout(&header);
+
+	ok = svm_dataset_write_header(fp, &pos, &header) &&
+		svm_dataset_write(fp, &pos, labels, sizeof(double)*l) &&
+		svm_dataset_pad(fp, &pos, header.offset_start);
+	for(i=0;i<=l && ok;i+=n)
+	{
+		n = min(block, l+1-i);
+		for(k=0;k<n;k++)	// the nodes have a terminator per row
+			start[k] = (uint64_t)jc[i+k] + (nodes ? i+k : 0);
+		ok = svm_dataset_write(fp, &pos, start, sizeof(uint64_t)*n);
+	}
+	ok = ok && svm_dataset_pad(fp, &pos, header.offset_index);
+	if(nodes)
+		ok = ok && write_nodes(fp, &pos, samples, ir, jc, l);
+	else
+	{
+		for(i=0;i<nnz && ok;i+=n)
+		{
+			n = min(block, nnz-i);
+			for(k=0;k<n;k++)
+				index[k] = (uint32_t)ir[i+k]+1;
+			ok = svm_dataset_write(fp, &pos, index, sizeof(uint32_t)*n);
+		}
+		ok = ok && svm_dataset_pad(fp, &pos, header.offset_value);
+		for(i=0;i<nnz && ok;i+=n)
+		{
+			n = min(block, nnz-i);
+			for(k=0;k<n;k++)
+				value[k] = (float)samples[i+k];
+			ok = svm_dataset_write(fp, &pos, value, sizeof(float)*n);
+		}
+	}
+	ok = ok && svm_dataset_pad(fp, &pos, header.file_size);
+
+	free(start);
+	free(index);
+	free(value);
+	return !ok;
+}
+
+// in rounds, each thread formats a range of rows into its own buffer,
+// and the buffers are written in order
+static int write_text(FILE *fp, const double *labels, const double *samples,
+	const mwIndex *ir, const mwIndex *jc, size_t l)
+{
+	size_t i, *start;
+	struct text_buffer *buffer;
+	int t, nr_thread = 1, error = 0;
+
+#ifdef _OPENMP
+	nr_thread = omp_get_max_threads();
+#endif
+	start = (size_t *) malloc((size_t)(nr_thread+1)*sizeof(size_t));
+	buffer = (struct text_buffer *) calloc((size_t)nr_thread, sizeof(struct text_buffer));
+	for(i=0;i<l && !error;i=start[nr_thread])
+	{
+		start[0] = i;
+		for(t=0;t<nr_thread;t++)
+		{
+			size_t r = start[t];
+			if(r < l)
+				do
+					r++;
+				while(r < l && jc[r+1]+r+1 <= jc[start[t]]+start[t]+WRITE_CHUNK);
+			start[t+1] = r;
+		}
+
+#pragma omp parallel for schedule(static,1) num_threads(nr_thread) if(nr_thread > 1)
+		for(t=0;t<nr_thread;t++)
+			format_rows(&buffer[t], labels, samples, ir, jc, start[t], start[t+1]);
+
+		for(t=0;t<nr_thread && !error;t++)
+			if(buffer[t].size > 0 && fwrite(buffer[t].p, 1, buffer[t].size, fp) != buffer[t].size)
+				error = 1;
+	}
+
+	for(t=0;t<nr_thread;t++)
+		free(buffer[t].p);
+	free(buffer);
+	free(start);
+	return error;
+}
+
+void libsvmwrite(const char *filename, const mxArray *label_vec, const mxArray *instance_mat, int binary)
 {
-	FILE *fp = fopen(filename,"w");
-	mwIndex *ir, *jc, k, low, high;
-	size_t i, l, label_vector_row_num;
+	FILE *fp;
+	mwIndex *ir, *jc;
+	size_t l, label_vector_row_num;
 	double *samples, *labels;
 	mxArray *instance_mat_col; // instance sparse matrix in column format
+	int error;
 
+	if(binary && mxGetN(instance_mat) > INT32_MAX)
+	{
+		mexPrintf("Error: too many features for the binary format\n");
+		return;
+	}
+
+	fp = fopen(filename, binary ? "wb" : "w");
 	if(fp ==NULL)
 	{
 		mexPrintf("can't open output file %s\n",filename);			
@@ -66,18 +361,15 @@ void libsvmwrite(const char *filename, const mxArray *label_vec, const mxArray *
 	ir = mxGetIr(instance_mat_col);
 	jc = mxGetJc(instance_mat_col);
 
-	for(i=0;i<l;i++)
-	{
-		fprintf(fp,"%g", labels[i]);
-
-		low = jc[i], high = jc[i+1];
-		for(k=low;k<high;k++)
-			fprintf(fp," %lu:%g", (size_t)ir[k]+1, samples[k]);		
-
-		fprintf(fp,"\n");
-	}
+	if(binary)
+		error = write_binary(fp, labels, samples, ir, jc, l, mxGetM(instance_mat_col),
+			binary == 2 ? SVM_DATASET_NODES : SVM_DATASET_CSR);
+	else
+		error = write_text(fp, labels, samples, ir, jc, l);
+	if(fclose(fp) != 0 || error)
+		mexPrintf("Error: cannot write to output file %s\n",filename);
 
-	fclose(fp);
+	mxDestroyArray(instance_mat_col);
 	return;
 }
 
@@ -92,24 +384,41 @@ void mexFunction( int nlhs, mxArray *plhs[],
 	}
 	
 	// Transform the input Matrix to libsvm format
-	if(nrhs == 3)
+	if(nrhs == 3 || nrhs == 4)
 	{
-		char filename[256];
+		char *filename;
+		int binary = 0;
 		if(!mxIsDouble(prhs[1]) || !mxIsDouble(prhs[2]))
 		{
 			mexPrintf("Error: label vector and instance matrix must be double\n");			
 			return;
 		}
 		
-		mxGetString(prhs[0], filename, mxGetN(prhs[0])+1);		
+		if(nrhs == 4)
+		{
+			char cmd[64];
+			if(mxGetString(prhs[3], cmd, sizeof(cmd)) || strncmp(cmd, "-b ", 3) != 0)
+			{
+				exit_with_help();
+				return;
+			}
+			binary = atoi(cmd+3);
+		}
 
+		if((filename = mxArrayToString(prhs[0])) == NULL)
+		{
+			mexPrintf("Error: filename is not a string\n");
+			return;
+		}
 		if(mxIsSparse(prhs[2]))
-			libsvmwrite(filename, prhs[1], prhs[2]);
+			libsvmwrite(filename, prhs[1], prhs[2], binary);
 		else
 		{
-			mexPrintf("Instance_matrix must be sparse\n");			
+			mxFree(filename);
+			mexPrintf("Instance_matrix must be sparse\n");
 			return;
 		}
+		mxFree(filename);
 	}
 	else
 	{
@@ -7,7 +7,31 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <locale.h>
+#include <stdint.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__APPLE__) || defined(__FreeBSD__)
+#include <xlocale.h>
+#endif
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "svm.h"
+#include "svm_dataset.h"
+static double strtod_c(const char *s, char **endptr);
+#define SVM_PARSE_STRTOD strtod_c
+#include "svm_parse.h"
 int libsvm_version = LIBSVM_VERSION;
 typedef float Qfloat;
 typedef signed char schar;
@@ -35,7 +59,11 @@ static inline double powi(double base, int times)
 	return ret;
 }
 #define INF HUGE_VAL
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
 #define TAU 1e-12
+#define PAR_MIN_LEN 8192	// shortest range handed to one thread in parallel loops
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 
 static void print_string_stdout(const char *s)
@@ -44,15 +72,75 @@ static void print_string_stdout(const char *s)
 	fflush(stdout);
 }
 static void (*svm_print_string) (const char *) = &print_string_stdout;
+
+// xorshift64* generator, so that the random choices depend on the seed only
+static unsigned long long rng_init(int seed)
+{
+	return (unsigned long long)(unsigned int)seed*0x9E3779B97F4A7C15ULL + 1;
+}
+
+static unsigned long long rng_next(unsigned long long &state)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return state*0x2545F4914F6CDD1DULL;
+}
+
+// uniform in [0,n)
+static int rng_int(unsigned long long &state, int n)
+{
+	return (int)(rng_next(state)%(unsigned long long)n);
+}
+
+// uniform in [0,1)
+static double rng_uniform(unsigned long long &state)
+{
+	return (double)(rng_next(state)>>11)*(1.0/9007199254740992.0);
+}
+
+// standard normal, by the Box-Muller transform
+static double rng_normal(unsigned long long &state)
+{
+	double u = 1-rng_uniform(state), v = rng_uniform(state);
+	return sqrt(-2*log(u))*cos(2*M_PI*v);
+}
+
+// what a thread bound to it by svm_set_thread_context logs to and draws
+// its shuffles from, instead of svm_print_string and rand()
+struct svm_context
+{
+	void (*print_func)(const char *);
+	unsigned long long rng;
+};
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+static THREAD_LOCAL svm_context *thread_context = NULL;
+
+// uniform in [0,n) for the random shuffles of training
+static int random_int(int n)
+{
+	if(thread_context)
+		return rng_int(thread_context->rng,n);
+	return rand()%n;
+}
+
 #if 1
 static void info(const char *fmt,...)
 {
 	char buf[BUFSIZ];
 	va_list ap;
 	va_start(ap,fmt);
-	vsprintf(buf,fmt,ap);
+	vsnprintf(buf,sizeof(buf),fmt,ap);
 	va_end(ap);
-	(*svm_print_string)(buf);
+	if(thread_context)
+		(*thread_context->print_func)(buf);
+	else
+		(*svm_print_string)(buf);
 }
 #else
 static void info(const char *fmt,...) {}
@@ -204,6 +292,7 @@ public:
 	Kernel(int l, svm_node * const * x, const svm_parameter& param);
 	virtual ~Kernel();
 
+	static double dot(const svm_node *px, const svm_node *py);
 	static double k_function(const svm_node *x, const svm_node *y,
 				 const svm_parameter& param);
 	virtual Qfloat *get_Q(int column, int len) const = 0;
@@ -216,6 +305,7 @@ public:
 protected:
 
 	double (Kernel::*kernel_function)(int i, int j) const;
+	const int nr_thread;
 
 private:
 	const svm_node **x;
@@ -227,7 +317,7 @@ private:
 	const double gamma;
 	const double coef0;
 
-	static double dot(const svm_node *px, const svm_node *py);
+	static double intersection(const svm_node *px, const svm_node *py);
 	double kernel_linear(int i, int j) const
 	{
 		return dot(x[i],x[j]);
@@ -248,10 +338,14 @@ private:
 	{
 		return x[i][(int)(x[j][0].value)].value;
 	}
+	double kernel_intersection(int i, int j) const
+	{
+		return intersection(x[i],x[j]);
+	}
 };
 
 Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
-:kernel_type(param.kernel_type), degree(param.degree),
+:nr_thread(param.nr_thread), kernel_type(param.kernel_type), degree(param.degree),
  gamma(param.gamma), coef0(param.coef0)
 {
 	switch(kernel_type)
@@ -271,6 +365,9 @@ Kernel::Kernel(int l, svm_node * const * x_, const svm_parameter& param)
 		case PRECOMPUTED:
 			kernel_function = &Kernel::kernel_precomputed;
 			break;
+		case INTERSECTION:
+			kernel_function = &Kernel::kernel_intersection;
+			break;
 	}
 
 	clone(x,x_,l);
@@ -313,6 +410,40 @@ double Kernel::dot(const svm_node *px, const svm_node *py)
 	return sum;
 }
 
+// sum_k min(x_k,y_k); a missing feature is 0, so it only counts when
+// the other value is negative
+double Kernel::intersection(const svm_node *px, const svm_node *py)
+{
+	double sum = 0;
+	while(px->index != -1 && py->index != -1)
+	{
+		if(px->index == py->index)
+		{
+			sum += min(px->value,py->value);
+			++px;
+			++py;
+		}
+		else
+		{
+			if(px->index > py->index)
+			{
+				sum += min(py->value,0.0);
+				++py;
+			}
+			else
+			{
+				sum += min(px->value,0.0);
+				++px;
+			}
+		}
+	}
+	for(;px->index != -1;++px)
+		sum += min(px->value,0.0);
+	for(;py->index != -1;++py)
+		sum += min(py->value,0.0);
+	return sum;
+}
+
 double Kernel::k_function(const svm_node *x, const svm_node *y,
 			  const svm_parameter& param)
 {
@@ -367,11 +498,316 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 			return tanh(param.gamma*dot(x,y)+param.coef0);
 		case PRECOMPUTED:  //x: test (validation), y: SV
 			return x[(int)(y->value)].value;
+		case INTERSECTION:
+			return intersection(x,y);
 		default:
 			return 0;  // Unreachable 
 	}
 }
 
+//
+// Vector loops of the solver
+//
+// G, G_bar, y and the I_up/I_low membership of each variable are kept
+// as separate arrays so that the O(l) loops below have no branches on
+// the data.  With __AVX__ (e.g. -mavx) four doubles are processed at a
+// time; otherwise the scalar loops are left to the compiler.
+//
+
+// y[k] += a*x[k]
+static void axpy_Q(double *y, double a, const Qfloat *x, int n)
+{
+	int k = 0;
+#if defined(__AVX__)
+	__m256d va = _mm256_set1_pd(a);
+	for(;k+4<=n;k+=4)
+	{
+		__m256d vx = _mm256_cvtps_pd(_mm_loadu_ps(x+k));
+		_mm256_storeu_pd(y+k,_mm256_add_pd(_mm256_loadu_pd(y+k),_mm256_mul_pd(va,vx)));
+	}
+#endif
+	for(;k<n;k++)
+		y[k] += a*x[k];
+}
+
+// y[k] += x1[k]*a1 + x2[k]*a2
+static void axpy2_Q(double *y, const Qfloat *x1, double a1, const Qfloat *x2, double a2, int n)
+{
+	int k = 0;
+#if defined(__AVX__)
+	__m256d va1 = _mm256_set1_pd(a1);
+	__m256d va2 = _mm256_set1_pd(a2);
+	for(;k+4<=n;k+=4)
+	{
+		__m256d v1 = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(x1+k)),va1);
+		__m256d v2 = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(x2+k)),va2);
+		_mm256_storeu_pd(y+k,_mm256_add_pd(_mm256_loadu_pd(y+k),_mm256_add_pd(v1,v2)));
+	}
+#endif
+	for(;k<n;k++)
+		y[k] += x1[k]*a1 + x2[k]*a2;
+}
+
+// return sum_k x[k]*y[k]
+static double dot_Q(const Qfloat *x, const double *y, int n)
+{
+	int k = 0;
+	double sum = 0;
+#if defined(__AVX__)
+	__m256d vsum = _mm256_setzero_pd();
+	for(;k+4<=n;k+=4)
+		vsum = _mm256_add_pd(vsum,_mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(x+k)),_mm256_loadu_pd(y+k)));
+	double s[4];
+	_mm256_storeu_pd(s,vsum);
+	sum = (s[0]+s[1])+(s[2]+s[3]);
+#endif
+	for(;k<n;k++)
+		sum += x[k]*y[k];
+	return sum;
+}
+
+// return sum_k x[k]*y[k]
+static double dot_dense(const double *x, const double *y, int n)
+{
+	int k = 0;
+	double sum = 0;
+#if defined(__AVX__)
+	__m256d vsum = _mm256_setzero_pd();
+	for(;k+4<=n;k+=4)
+		vsum = _mm256_add_pd(vsum,_mm256_mul_pd(_mm256_loadu_pd(x+k),_mm256_loadu_pd(y+k)));
+	double s[4];
+	_mm256_storeu_pd(s,vsum);
+	sum = (s[0]+s[1])+(s[2]+s[3]);
+#endif
+	for(;k<n;k++)
+		sum += x[k]*y[k];
+	return sum;
+}
+
+// return t maximizing -y_t*G_t over t in I_up (mask[t] == 0), the last
+// such t on ties; -1 if I_up is empty
+static int max_violating_up(const double *G, const double *y, const double *mask, int n, double *Gmax_ret)
+{
+	double Gmax = -INF;
+	int Gmax_idx = -1;
+	int t = 0;
+#if defined(__AVX__)
+	if(n >= 4)
+	{
+		const __m256d sign = _mm256_set1_pd(-0.0);
+		const __m256d four = _mm256_set1_pd(4);
+		__m256d vmax = _mm256_set1_pd(-INF);
+		__m256d vidx = _mm256_set1_pd(-1);
+		__m256d vt = _mm256_set_pd(3,2,1,0);
+		for(;t+4<=n;t+=4)
+		{
+			__m256d yG = _mm256_mul_pd(_mm256_loadu_pd(y+t),_mm256_loadu_pd(G+t));
+			__m256d v = _mm256_add_pd(_mm256_xor_pd(yG,sign),_mm256_loadu_pd(mask+t));
+			__m256d ge = _mm256_cmp_pd(v,vmax,_CMP_GE_OQ);
+			vmax = _mm256_blendv_pd(vmax,v,ge);
+			vidx = _mm256_blendv_pd(vidx,vt,ge);
+			vt = _mm256_add_pd(vt,four);
+		}
+		double m[4], idx[4];
+		_mm256_storeu_pd(m,vmax);
+		_mm256_storeu_pd(idx,vidx);
+		for(int k=0;k<4;k++)
+			if(m[k] > Gmax || (m[k] == Gmax && (int)idx[k] > Gmax_idx))
+			{
+				Gmax = m[k];
+				Gmax_idx = (int)idx[k];
+			}
+	}
+#endif
+	for(;t<n;t++)
+	{
+		double v = -y[t]*G[t] + mask[t];
+		bool ge = (v >= Gmax);
+		Gmax = ge ? v : Gmax;
+		Gmax_idx = ge ? t : Gmax_idx;
+	}
+	if(Gmax == -INF)
+		Gmax_idx = -1;
+	*Gmax_ret = Gmax;
+	return Gmax_idx;
+}
+
+// return t in I_low (mask[t] == 0) with -y_t*G_t < Gmax minimizing the
+// second order decrease of the objective for the pair (i,t), the last
+// such t on ties; -1 if there is none.  Also returns that decrease and
+// Gmax2 = max { y_t*G_t | t in I_low }.
+static int min_obj_diff_low(const double *G, const double *y, const double *mask,
+	const double *QD, const Qfloat *Q_i, double QD_i, double y_i, double Gmax,
+	int n, double *Gmax2_ret, double *obj_diff_min_ret)
+{
+	double Gmax2 = -INF;
+	double obj_diff_min = INF;
+	int Gmin_idx = -1;
+	double c = 2.0*y_i;
+	int t = 0;
+#if defined(__AVX__)
+	if(n >= 4)
+	{
+		const __m256d sign = _mm256_set1_pd(-0.0);
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d four = _mm256_set1_pd(4);
+		const __m256d inf = _mm256_set1_pd(INF);
+		const __m256d tau = _mm256_set1_pd(TAU);
+		const __m256d vGmax = _mm256_set1_pd(Gmax);
+		const __m256d vQD_i = _mm256_set1_pd(QD_i);
+		const __m256d vc = _mm256_set1_pd(c);
+		__m256d vmax2 = _mm256_set1_pd(-INF);
+		__m256d vmin = _mm256_set1_pd(INF);
+		__m256d vidx = _mm256_set1_pd(-1);
+		__m256d vt = _mm256_set_pd(3,2,1,0);
+		for(;t+4<=n;t+=4)
+		{
+			__m256d vy = _mm256_loadu_pd(y+t);
+			__m256d m = _mm256_loadu_pd(mask+t);
+			__m256d yG = _mm256_mul_pd(vy,_mm256_loadu_pd(G+t));
+			vmax2 = _mm256_max_pd(vmax2,_mm256_add_pd(yG,m));
+
+			__m256d grad_diff = _mm256_add_pd(vGmax,yG);
+			__m256d quad_coef = _mm256_sub_pd(_mm256_add_pd(vQD_i,_mm256_loadu_pd(QD+t)),
+				_mm256_mul_pd(_mm256_mul_pd(vc,vy),_mm256_cvtps_pd(_mm_loadu_ps(Q_i+t))));
+			quad_coef = _mm256_blendv_pd(tau,quad_coef,_mm256_cmp_pd(quad_coef,zero,_CMP_GT_OQ));
+			__m256d obj_diff = _mm256_div_pd(_mm256_xor_pd(_mm256_mul_pd(grad_diff,grad_diff),sign),quad_coef);
+			__m256d ok = _mm256_and_pd(_mm256_cmp_pd(grad_diff,zero,_CMP_GT_OQ),_mm256_cmp_pd(m,zero,_CMP_EQ_OQ));
+			obj_diff = _mm256_blendv_pd(inf,obj_diff,ok);
+
+			__m256d le = _mm256_cmp_pd(obj_diff,vmin,_CMP_LE_OQ);
+			vmin = _mm256_blendv_pd(vmin,obj_diff,le);
+			vidx = _mm256_blendv_pd(vidx,vt,le);
+			vt = _mm256_add_pd(vt,four);
+		}
+		double m2[4], m[4], idx[4];
+		_mm256_storeu_pd(m2,vmax2);
+		_mm256_storeu_pd(m,vmin);
+		_mm256_storeu_pd(idx,vidx);
+		for(int k=0;k<4;k++)
+		{
+			Gmax2 = max(Gmax2,m2[k]);
+			if(m[k] < obj_diff_min || (m[k] == obj_diff_min && (int)idx[k] > Gmin_idx))
+			{
+				obj_diff_min = m[k];
+				Gmin_idx = (int)idx[k];
+			}
+		}
+	}
+#endif
+	for(;t<n;t++)
+	{
+		double yG = y[t]*G[t];
+		Gmax2 = max(Gmax2,yG+mask[t]);
+
+		double grad_diff = Gmax+yG;
+		double quad_coef = QD_i+QD[t]-c*y[t]*Q_i[t];
+		quad_coef = (quad_coef > 0) ? quad_coef : TAU;
+		double obj_diff = (grad_diff > 0 && mask[t] == 0) ? -(grad_diff*grad_diff)/quad_coef : INF;
+		bool le = (obj_diff <= obj_diff_min);
+		obj_diff_min = le ? obj_diff : obj_diff_min;
+		Gmin_idx = le ? t : Gmin_idx;
+	}
+	if(obj_diff_min == INF)
+		Gmin_idx = -1;
+	*Gmax2_ret = Gmax2;
+	*obj_diff_min_ret = obj_diff_min;
+	return Gmin_idx;
+}
+
+// analytic solution of the sub-problem of two variables i and j,
+// handling the bounds [0,C_i] and [0,C_j] carefully
+static void solve_two_variables(double &alpha_i, double &alpha_j, schar y_i, schar y_j,
+	double G_i, double G_j, double Q_ii, double Q_jj, double Q_ij, double C_i, double C_j)
+{
+	if(y_i!=y_j)
+	{
+		double quad_coef = Q_ii+Q_jj+2*Q_ij;
+		if (quad_coef <= 0)
+			quad_coef = TAU;
+		double delta = (-G_i-G_j)/quad_coef;
+		double diff = alpha_i - alpha_j;
+		alpha_i += delta;
+		alpha_j += delta;
+		
+		if(diff > 0)
+		{
+			if(alpha_j < 0)
+			{
+				alpha_j = 0;
+				alpha_i = diff;
+			}
+		}
+		else
+		{
+			if(alpha_i < 0)
+			{
+				alpha_i = 0;
+				alpha_j = -diff;
+			}
+		}
+		if(diff > C_i - C_j)
+		{
+			if(alpha_i > C_i)
+			{
+				alpha_i = C_i;
+				alpha_j = C_i - diff;
+			}
+		}
+		else
+		{
+			if(alpha_j > C_j)
+			{
+				alpha_j = C_j;
+				alpha_i = C_j + diff;
+			}
+		}
+	}
+	else
+	{
+		double quad_coef = Q_ii+Q_jj-2*Q_ij;
+		if (quad_coef <= 0)
+			quad_coef = TAU;
+		double delta = (G_i-G_j)/quad_coef;
+		double sum = alpha_i + alpha_j;
+		alpha_i -= delta;
+		alpha_j += delta;
+
+		if(sum > C_i)
+		{
+			if(alpha_i > C_i)
+			{
+				alpha_i = C_i;
+				alpha_j = sum - C_i;
+			}
+		}
+		else
+		{
+			if(alpha_j < 0)
+			{
+				alpha_j = 0;
+				alpha_i = sum;
+			}
+		}
+		if(sum > C_j)
+		{
+			if(alpha_j > C_j)
+			{
+				alpha_j = C_j;
+				alpha_i = sum - C_j;
+			}
+		}
+		else
+		{
+			if(alpha_i < 0)
+			{
+				alpha_i = 0;
+				alpha_j = sum;
+			}
+		}
+	}
+}
+
 // An SMO algorithm in Fan et al., JMLR 6(2005), p. 1889--1918
 // Solves:
 //
@@ -392,7 +828,7 @@ double Kernel::k_function(const svm_node *x, const svm_node *y,
 //
 class Solver {
 public:
-	Solver() {};
+	Solver(int nr_thread_ = 1):nr_thread(nr_thread_) {};
 	virtual ~Solver() {};
 
 	struct SolutionInfo {
@@ -420,9 +856,25 @@ protected:
 	double *p;
 	int *active_set;
 	double *G_bar;		// gradient, if we treat free variables as 0
+	double *yv;		// y as double, for the vector loops
+	double *up_mask;	// 0 if i in I_up(\alpha), -INF otherwise
+	double *low_mask;	// 0 if i in I_low(\alpha), -INF otherwise
 	int l;
 	bool unshrink;	// XXX
 
+	// the parallel loops split [0,n) into nr_chunk(n) ranges; the
+	// partial results of the selection are reduced in range order,
+	// so the solution does not depend on the number of threads
+	const int nr_thread;
+	double *part_val, *part_val2;
+	int *part_idx;
+	int nr_chunk(int n) const
+	{
+		return max(1,min(nr_thread,n/PAR_MIN_LEN));
+	}
+	void update_G(double *y, double a, const Qfloat *x, int n);
+	void update_G(double *y, const Qfloat *x1, double a1, const Qfloat *x2, double a2, int n);
+
 	double get_C(int i)
 	{
 		return (y[i] > 0)? Cp : Cn;
@@ -434,6 +886,13 @@ protected:
 		else if(alpha[i] <= 0)
 			alpha_status[i] = LOWER_BOUND;
 		else alpha_status[i] = FREE;
+
+		// I_up: y_i = +1 and alpha_i < C, or y_i = -1 and alpha_i > 0
+		// I_low: y_i = +1 and alpha_i > 0, or y_i = -1 and alpha_i < C
+		bool up = (y[i] == +1) ? !is_upper_bound(i) : !is_lower_bound(i);
+		bool low = (y[i] == +1) ? !is_lower_bound(i) : !is_upper_bound(i);
+		up_mask[i] = up ? 0 : -INF;
+		low_mask[i] = low ? 0 : -INF;
 	}
 	bool is_upper_bound(int i) { return alpha_status[i] == UPPER_BOUND; }
 	bool is_lower_bound(int i) { return alpha_status[i] == LOWER_BOUND; }
@@ -441,8 +900,10 @@ protected:
 	void swap_index(int i, int j);
 	void reconstruct_gradient();
 	virtual int select_working_set(int &i, int &j);
+	virtual void solve_sub_problem(int i, int j);
 	virtual double calculate_rho();
 	virtual void do_shrinking();
+	virtual const Qfloat *get_active_column(int i) { return Q->get_Q(i,active_size); }
 private:
 	bool be_shrunk(int i, double Gmax1, double Gmax2);
 };
@@ -457,6 +918,38 @@ void Solver::swap_index(int i, int j)
 	swap(p[i],p[j]);
 	swap(active_set[i],active_set[j]);
 	swap(G_bar[i],G_bar[j]);
+	swap(yv[i],yv[j]);
+	swap(up_mask[i],up_mask[j]);
+	swap(low_mask[i],low_mask[j]);
+}
+
+static inline int chunk_start(int n, int nr_chunk, int c)
+{
+	return (int)((long long)n*c/nr_chunk);
+}
+
+// y += a*x
+void Solver::update_G(double *y, double a, const Qfloat *x, int n)
+{
+	int nc = nr_chunk(n);
+#pragma omp parallel for schedule(static) num_threads(nc) if(nc > 1)
+	for(int c=0;c<nc;c++)
+	{
+		int begin = chunk_start(n,nc,c), end = chunk_start(n,nc,c+1);
+		axpy_Q(y+begin,a,x+begin,end-begin);
+	}
+}
+
+// y += x1*a1 + x2*a2
+void Solver::update_G(double *y, const Qfloat *x1, double a1, const Qfloat *x2, double a2, int n)
+{
+	int nc = nr_chunk(n);
+#pragma omp parallel for schedule(static) num_threads(nc) if(nc > 1)
+	for(int c=0;c<nc;c++)
+	{
+		int begin = chunk_start(n,nc,c), end = chunk_start(n,nc,c+1);
+		axpy2_Q(y+begin,x1+begin,a1,x2+begin,a2,end-begin);
+	}
 }
 
 void Solver::reconstruct_gradient()
@@ -480,13 +973,16 @@ void Solver::reconstruct_gradient()
 
 	if (nr_free*l > 2*active_size*(l-active_size))
 	{
+		// alpha of the free variables, 0 for the others
+		double *alpha_free = new double[active_size];
+		for(j=0;j<active_size;j++)
+			alpha_free[j] = is_free(j) ? alpha[j] : 0;
 		for(i=active_size;i<l;i++)
 		{
 			const Qfloat *Q_i = Q->get_Q(i,active_size);
-			for(j=0;j<active_size;j++)
-				if(is_free(j))
-					G[i] += alpha[j] * Q_i[j];
+			G[i] += dot_Q(Q_i,alpha_free,active_size);
 		}
+		delete[] alpha_free;
 	}
 	else
 	{
@@ -494,9 +990,7 @@ void Solver::reconstruct_gradient()
 			if(is_free(i))
 			{
 				const Qfloat *Q_i = Q->get_Q(i,l);
-				double alpha_i = alpha[i];
-				for(j=active_size;j<l;j++)
-					G[j] += alpha_i * Q_i[j];
+				update_G(G+active_size,alpha[i],Q_i+active_size,l-active_size);
 			}
 	}
 }
@@ -516,11 +1010,21 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	this->eps = eps;
 	unshrink = false;
 
+	part_val = new double[nr_thread];
+	part_val2 = new double[nr_thread];
+	part_idx = new int[nr_thread];
+
 	// initialize alpha_status
 	{
 		alpha_status = new char[l];
+		yv = new double[l];
+		up_mask = new double[l];
+		low_mask = new double[l];
 		for(int i=0;i<l;i++)
+		{
+			yv[i] = y[i];
 			update_alpha_status(i);
+		}
 	}
 
 	// initialize active set (for shrinking)
@@ -545,13 +1049,9 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 			if(!is_lower_bound(i))
 			{
 				const Qfloat *Q_i = Q.get_Q(i,l);
-				double alpha_i = alpha[i];
-				int j;
-				for(j=0;j<l;j++)
-					G[j] += alpha_i*Q_i[j];
+				update_G(G,alpha[i],Q_i,l);
 				if(is_upper_bound(i))
-					for(j=0;j<l;j++)
-						G_bar[j] += get_C(i) * Q_i[j];
+					update_G(G_bar,get_C(i),Q_i,l);
 			}
 	}
 
@@ -588,144 +1088,7 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 		
 		++iter;
 
-		// update alpha[i] and alpha[j], handle bounds carefully
-		
-		const Qfloat *Q_i = Q.get_Q(i,active_size);
-		const Qfloat *Q_j = Q.get_Q(j,active_size);
-
-		double C_i = get_C(i);
-		double C_j = get_C(j);
-
-		double old_alpha_i = alpha[i];
-		double old_alpha_j = alpha[j];
-
-		if(y[i]!=y[j])
-		{
-			double quad_coef = QD[i]+QD[j]+2*Q_i[j];
-			if (quad_coef <= 0)
-				quad_coef = TAU;
-			double delta = (-G[i]-G[j])/quad_coef;
-			double diff = alpha[i] - alpha[j];
-			alpha[i] += delta;
-			alpha[j] += delta;
-			
-			if(diff > 0)
-			{
-				if(alpha[j] < 0)
-				{
-					alpha[j] = 0;
-					alpha[i] = diff;
-				}
-			}
-			else
-			{
-				if(alpha[i] < 0)
-				{
-					alpha[i] = 0;
-					alpha[j] = -diff;
-				}
-			}
-			if(diff > C_i - C_j)
-			{
-				if(alpha[i] > C_i)
-				{
-					alpha[i] = C_i;
-					alpha[j] = C_i - diff;
-				}
-			}
-			else
-			{
-				if(alpha[j] > C_j)
-				{
-					alpha[j] = C_j;
-					alpha[i] = C_j + diff;
-				}
-			}
-		}
-		else
-		{
-			double quad_coef = QD[i]+QD[j]-2*Q_i[j];
-			if (quad_coef <= 0)
-				quad_coef = TAU;
-			double delta = (G[i]-G[j])/quad_coef;
-			double sum = alpha[i] + alpha[j];
-			alpha[i] -= delta;
-			alpha[j] += delta;
-
-			if(sum > C_i)
-			{
-				if(alpha[i] > C_i)
-				{
-					alpha[i] = C_i;
-					alpha[j] = sum - C_i;
-				}
-			}
-			else
-			{
-				if(alpha[j] < 0)
-				{
-					alpha[j] = 0;
-					alpha[i] = sum;
-				}
-			}
-			if(sum > C_j)
-			{
-				if(alpha[j] > C_j)
-				{
-					alpha[j] = C_j;
-					alpha[i] = sum - C_j;
-				}
-			}
-			else
-			{
-				if(alpha[i] < 0)
-				{
-					alpha[i] = 0;
-					alpha[j] = sum;
-				}
-			}
-		}
-
-		// update G
-
-		double delta_alpha_i = alpha[i] - old_alpha_i;
-		double delta_alpha_j = alpha[j] - old_alpha_j;
-		
-		for(int k=0;k<active_size;k++)
-		{
-			G[k] += Q_i[k]*delta_alpha_i + Q_j[k]*delta_alpha_j;
-		}
-
-		// update alpha_status and G_bar
-
-		{
-			bool ui = is_upper_bound(i);
-			bool uj = is_upper_bound(j);
-			update_alpha_status(i);
-			update_alpha_status(j);
-			int k;
-			if(ui != is_upper_bound(i))
-			{
-				Q_i = Q.get_Q(i,l);
-				if(ui)
-					for(k=0;k<l;k++)
-						G_bar[k] -= C_i * Q_i[k];
-				else
-					for(k=0;k<l;k++)
-						G_bar[k] += C_i * Q_i[k];
-			}
-
-			if(uj != is_upper_bound(j))
-			{
-				Q_j = Q.get_Q(j,l);
-				if(uj)
-					for(k=0;k<l;k++)
-						G_bar[k] -= C_j * Q_j[k];
-				else
-					for(k=0;k<l;k++)
-						G_bar[k] += C_j * Q_j[k];
-			}
-		}
+		solve_sub_problem(i,j);
 	}
 
 	if(iter >= max_iter)
@@ -780,12 +1143,61 @@ void Solver::Solve(int l, const QMatrix& Q, const double *p_, const schar *y_,
 	delete[] active_set;
 	delete[] G;
 	delete[] G_bar;
+	delete[] yv;
+	delete[] up_mask;
+	delete[] low_mask;
+	delete[] part_val;
+	delete[] part_val2;
+	delete[] part_idx;
 }
 
-// return 1 if already optimal, return 0 otherwise
-int Solver::select_working_set(int &out_i, int &out_j)
+void Solver::solve_sub_problem(int i, int j)
 {
-	// return i,j such that
+	// update alpha[i] and alpha[j], handle bounds carefully
+
+	const Qfloat *Q_i = Q->get_Q(i,active_size);
+	const Qfloat *Q_j = Q->get_Q(j,active_size);
+
+	double C_i = get_C(i);
+	double C_j = get_C(j);
+
+	double old_alpha_i = alpha[i];
+	double old_alpha_j = alpha[j];
+
+	solve_two_variables(alpha[i],alpha[j],y[i],y[j],G[i],G[j],QD[i],QD[j],Q_i[j],C_i,C_j);
+
+	// update G
+
+	double delta_alpha_i = alpha[i] - old_alpha_i;
+	double delta_alpha_j = alpha[j] - old_alpha_j;
+
+	update_G(G,Q_i,delta_alpha_i,Q_j,delta_alpha_j,active_size);
+
+	// update alpha_status and G_bar
+
+	{
+		bool ui = is_upper_bound(i);
+		bool uj = is_upper_bound(j);
+		update_alpha_status(i);
+		update_alpha_status(j);
+		if(ui != is_upper_bound(i))
+		{
+			Q_i = Q->get_Q(i,l);
+			update_G(G_bar,ui ? -C_i : C_i,Q_i,l);
+		}
+
+		if(uj != is_upper_bound(j))
+		{
+			Q_j = Q->get_Q(j,l);
+			update_G(G_bar,uj ? -C_j : C_j,Q_j,l);
+		}
+	}
+}
+
+// return 1 if already optimal, return 0 otherwise
+int Solver::select_working_set(int &out_i, int &out_j)
+{
+	// return i,j such that
 	// i: maximizes -y_i * grad(f)_i, i in I_up(\alpha)
 	// j: minimizes the decrease of obj value
 	//    (if quadratic coefficeint <= 0, replace it with tau)
@@ -793,92 +1205,51 @@ int Solver::select_working_set(int &out_i, int &out_j)
 	
 	double Gmax = -INF;
 	double Gmax2 = -INF;
-	int Gmax_idx = -1;
-	int Gmin_idx = -1;
 	double obj_diff_min = INF;
+	int i = -1, j = -1;
+	int nc = nr_chunk(active_size);
+	int c;
 
-	for(int t=0;t<active_size;t++)
-		if(y[t]==+1)	
-		{
-			if(!is_upper_bound(t))
-				if(-G[t] >= Gmax)
-				{
-					Gmax = -G[t];
-					Gmax_idx = t;
-				}
-		}
-		else
+#pragma omp parallel for schedule(static) num_threads(nc) if(nc > 1)
+	for(c=0;c<nc;c++)
+	{
+		int begin = chunk_start(active_size,nc,c), end = chunk_start(active_size,nc,c+1);
+		int t = max_violating_up(G+begin,yv+begin,up_mask+begin,end-begin,&part_val[c]);
+		part_idx[c] = (t == -1) ? -1 : begin+t;
+	}
+	for(c=0;c<nc;c++)
+		if(part_idx[c] != -1 && part_val[c] >= Gmax)
 		{
-			if(!is_lower_bound(t))
-				if(G[t] >= Gmax)
-				{
-					Gmax = G[t];
-					Gmax_idx = t;
-				}
+			Gmax = part_val[c];
+			i = part_idx[c];
 		}
+	if(i == -1) // I_up is empty: Gmax = -INF
+		return 1;
 
-	int i = Gmax_idx;
-	const Qfloat *Q_i = NULL;
-	if(i != -1) // NULL Q_i not accessed: Gmax=-INF if i=-1
-		Q_i = Q->get_Q(i,active_size);
-
-	for(int j=0;j<active_size;j++)
+	const Qfloat *Q_i = get_active_column(i);
+#pragma omp parallel for schedule(static) num_threads(nc) if(nc > 1)
+	for(c=0;c<nc;c++)
 	{
-		if(y[j]==+1)
-		{
-			if (!is_lower_bound(j))
-			{
-				double grad_diff=Gmax+G[j];
-				if (G[j] >= Gmax2)
-					Gmax2 = G[j];
-				if (grad_diff > 0)
-				{
-					double obj_diff;
-					double quad_coef = QD[i]+QD[j]-2.0*y[i]*Q_i[j];
-					if (quad_coef > 0)
-						obj_diff = -(grad_diff*grad_diff)/quad_coef;
-					else
-						obj_diff = -(grad_diff*grad_diff)/TAU;
-
-					if (obj_diff <= obj_diff_min)
-					{
-						Gmin_idx=j;
-						obj_diff_min = obj_diff;
-					}
-				}
-			}
-		}
-		else
+		int begin = chunk_start(active_size,nc,c), end = chunk_start(active_size,nc,c+1);
+		int t = min_obj_diff_low(G+begin,yv+begin,low_mask+begin,QD+begin,Q_i+begin,
+					 QD[i],yv[i],Gmax,end-begin,&part_val2[c],&part_val[c]);
+		part_idx[c] = (t == -1) ? -1 : begin+t;
+	}
+	for(c=0;c<nc;c++)
+	{
+		Gmax2 = max(Gmax2,part_val2[c]);
+		if(part_idx[c] != -1 && part_val[c] <= obj_diff_min)
 		{
-			if (!is_upper_bound(j))
-			{
-				double grad_diff= Gmax-G[j];
-				if (-G[j] >= Gmax2)
-					Gmax2 = -G[j];
-				if (grad_diff > 0)
-				{
-					double obj_diff;
-					double quad_coef = QD[i]+QD[j]+2.0*y[i]*Q_i[j];
-					if (quad_coef > 0)
-						obj_diff = -(grad_diff*grad_diff)/quad_coef;
-					else
-						obj_diff = -(grad_diff*grad_diff)/TAU;
-
-					if (obj_diff <= obj_diff_min)
-					{
-						Gmin_idx=j;
-						obj_diff_min = obj_diff;
-					}
-				}
-			}
+			obj_diff_min = part_val[c];
+			j = part_idx[c];
 		}
 	}
 
 	if(Gmax+Gmax2 < eps)
 		return 1;
 
-	out_i = Gmax_idx;
-	out_j = Gmin_idx;
+	out_i = i;
+	out_j = j;
 	return 0;
 }
 
@@ -1001,6 +1372,323 @@ double Solver::calculate_rho()
 	return r;
 }
 
+//
+// Solver with a working set of q > 2 variables
+//
+// {i,j} from the usual selection is extended to a set B of up to q
+// indices by most of the previous B and then by the most violating
+// variables of I_up and I_low.  The columns of B are kept in a local
+// buffer, so a column is fetched from get_Q once while its variable
+// stays in B, and the sub-problem over B is solved by an inner SMO on
+// Q_BB before G is updated.
+//
+class Solver_Block: public Solver
+{
+public:
+	Solver_Block(int q_, int nr_thread_ = 1):Solver(nr_thread_),q(q_)
+	{
+		n_B = 0;
+		B = new int[q];
+		B_new = new int[q];
+		slot = new int[q];
+		slot_var = new int[q];
+		slot_used = new bool[q];
+		col_buf = NULL;
+		col_len = 0;
+		cand_up = new int[q];
+		cand_low = new int[q];
+		cand_up_val = new double[q];
+		cand_low_val = new double[q];
+		a_B = new double[q];
+		G_B = new double[q];
+		C_B = new double[q];
+		y_B = new schar[q];
+		Q_BB = new double[q*q];
+	}
+	~Solver_Block()
+	{
+		delete[] B;
+		delete[] B_new;
+		delete[] slot;
+		delete[] slot_var;
+		delete[] slot_used;
+		delete[] col_buf;
+		delete[] cand_up;
+		delete[] cand_low;
+		delete[] cand_up_val;
+		delete[] cand_low_val;
+		delete[] a_B;
+		delete[] G_B;
+		delete[] C_B;
+		delete[] y_B;
+		delete[] Q_BB;
+	}
+private:
+	const int q;
+	int n_B;
+	int *B, *B_new;
+	int *slot;		// buffer slot of the column of B[k]
+	int *slot_var;		// variable whose column is in a slot, -1 if none
+	bool *slot_used;
+	Qfloat *col_buf;	// q columns of length col_len
+	int col_len;		// 0 if the buffered columns are not valid
+	int *cand_up, *cand_low;
+	double *cand_up_val, *cand_low_val;
+	double *a_B, *G_B, *C_B;
+	schar *y_B;
+	double *Q_BB;
+	void select_block(int i, int j);
+	void fetch_columns();
+	void do_shrinking()
+	{
+		col_len = 0;	// swap_index invalidates the buffered columns
+		Solver::do_shrinking();
+	}
+	const Qfloat *get_active_column(int i)
+	{
+		// i is often still in B, whose columns need no get_Q
+		if(col_len == active_size)
+			for(int s=0;s<q;s++)
+				if(slot_var[s] == i)
+					return col_buf+(size_t)s*l;
+		return Solver::get_active_column(i);
+	}
+	void solve_sub_problem(int i, int j);
+};
+
+// insert (t,v) into the list idx/val of length n (at most m), sorted by
+// decreasing v
+static void insert_candidate(int *idx, double *val, int &n, int m, int t, double v)
+{
+	if(n == m)
+	{
+		if(v <= val[n-1]) return;
+		n--;
+	}
+	int k = n++;
+	while(k > 0 && val[k-1] < v)
+	{
+		idx[k] = idx[k-1];
+		val[k] = val[k-1];
+		k--;
+	}
+	idx[k] = t;
+	val[k] = v;
+}
+
+static bool in_list(const int *list, int n, int t)
+{
+	for(int k=0;k<n;k++)
+		if(list[k] == t)
+			return true;
+	return false;
+}
+
+void Solver_Block::select_block(int i, int j)
+{
+	int n = 0;
+	int k, t;
+
+	B_new[n++] = i;
+	B_new[n++] = j;
+
+	// keep the previous working set, the free variables first, so that
+	// at most q/8 columns (but at least i and j) have to be fetched
+	if(col_len == active_size)
+	{
+		int n_keep = q-q/8;
+		for(k=0;k<n_B && n<n_keep;k++)
+		{
+			t = B[k];
+			if(t != i && t != j && is_free(t))
+				B_new[n++] = t;
+		}
+		for(k=0;k<n_B && n<n_keep;k++)
+		{
+			t = B[k];
+			if(t != i && t != j && !is_free(t))
+				B_new[n++] = t;
+		}
+	}
+
+	// add the most violating variables of I_up (largest -y_t*G_t) and
+	// of I_low (largest y_t*G_t) alternately
+	int m = q-n;
+	int n_up = 0, n_low = 0;
+	if(m > 0)
+		for(t=0;t<active_size;t++)
+		{
+			if(up_mask[t] == 0)
+				insert_candidate(cand_up,cand_up_val,n_up,m,t,-yv[t]*G[t]);
+			if(low_mask[t] == 0)
+				insert_candidate(cand_low,cand_low_val,n_low,m,t,yv[t]*G[t]);
+		}
+
+	int p_up = 0, p_low = 0;
+	while(n < q && (p_up < n_up || p_low < n_low))
+	{
+		if(p_up < n_up && (p_low == n_low || p_up <= p_low))
+			t = cand_up[p_up++];
+		else
+			t = cand_low[p_low++];
+		if(!in_list(B_new,n,t))
+			B_new[n++] = t;
+	}
+
+	swap(B,B_new);
+	n_B = n;
+}
+
+// make slot[k] point to the buffered column of B[k], fetching the
+// columns that are not in the buffer
+void Solver_Block::fetch_columns()
+{
+	int k, s;
+
+	if(col_buf == NULL)
+		col_buf = new Qfloat[(size_t)q*l];
+	if(col_len != active_size)
+	{
+		for(s=0;s<q;s++)
+			slot_var[s] = -1;
+		col_len = active_size;
+	}
+
+	for(s=0;s<q;s++)
+		slot_used[s] = false;
+	for(k=0;k<n_B;k++)
+	{
+		slot[k] = -1;
+		for(s=0;s<q;s++)
+			if(slot_var[s] == B[k])
+			{
+				slot[k] = s;
+				slot_used[s] = true;
+				break;
+			}
+	}
+
+	s = 0;
+	for(k=0;k<n_B;k++)
+		if(slot[k] == -1)
+		{
+			while(slot_used[s]) s++;
+			memcpy(col_buf+(size_t)s*l,Q->get_Q(B[k],active_size),sizeof(Qfloat)*active_size);
+			slot_var[s] = B[k];
+			slot_used[s] = true;
+			slot[k] = s;
+		}
+}
+
+void Solver_Block::solve_sub_problem(int i, int j)
+{
+	select_block(i,j);
+	fetch_columns();
+
+	int n = n_B;
+	int k, m;
+
+	for(k=0;k<n;k++)
+	{
+		const Qfloat *Q_k = col_buf+(size_t)slot[k]*l;
+		for(m=0;m<n;m++)
+			Q_BB[k*n+m] = Q_k[B[m]];
+		Q_BB[k*n+k] = QD[B[k]];
+		a_B[k] = alpha[B[k]];
+		G_B[k] = G[B[k]];
+		C_B[k] = get_C(B[k]);
+		y_B[k] = y[B[k]];
+	}
+
+	// inner SMO on B; the first step is on the pair {i,j} chosen by the
+	// outer selection, which guarantees progress
+
+	int ki = 0, kj = 1;
+	int max_inner_iter = 100*n;
+	for(int iter=0;iter<max_inner_iter;iter++)
+	{
+		if(iter > 0)
+		{
+			double Gmax = -INF, Gmax2 = -INF;
+			double obj_diff_min = INF;
+			ki = -1;
+			kj = -1;
+			for(k=0;k<n;k++)
+				if(y_B[k] == +1 ? a_B[k] < C_B[k] : a_B[k] > 0)
+					if(-y_B[k]*G_B[k] >= Gmax)
+					{
+						Gmax = -y_B[k]*G_B[k];
+						ki = k;
+					}
+			if(ki == -1)
+				break;
+			const double *Q_i = &Q_BB[ki*n];
+			for(k=0;k<n;k++)
+				if(y_B[k] == +1 ? a_B[k] > 0 : a_B[k] < C_B[k])
+				{
+					double v = y_B[k]*G_B[k];
+					if(v >= Gmax2)
+						Gmax2 = v;
+					double grad_diff = Gmax+v;
+					if(grad_diff > 0)
+					{
+						double quad_coef = Q_i[ki]+Q_BB[k*n+k]-2.0*y_B[ki]*y_B[k]*Q_i[k];
+						if(quad_coef <= 0)
+							quad_coef = TAU;
+						double obj_diff = -(grad_diff*grad_diff)/quad_coef;
+						if(obj_diff <= obj_diff_min)
+						{
+							kj = k;
+							obj_diff_min = obj_diff;
+						}
+					}
+				}
+			if(Gmax+Gmax2 < eps || kj == -1)
+				break;
+		}
+
+		double old_a_i = a_B[ki];
+		double old_a_j = a_B[kj];
+		solve_two_variables(a_B[ki],a_B[kj],y_B[ki],y_B[kj],G_B[ki],G_B[kj],
+			Q_BB[ki*n+ki],Q_BB[kj*n+kj],Q_BB[ki*n+kj],C_B[ki],C_B[kj]);
+		double delta_a_i = a_B[ki] - old_a_i;
+		double delta_a_j = a_B[kj] - old_a_j;
+		for(k=0;k<n;k++)
+			G_B[k] += Q_BB[ki*n+k]*delta_a_i + Q_BB[kj*n+k]*delta_a_j;
+	}
+
+	// update G with the change of alpha_B, two columns at a time
+
+	int k1 = -1;
+	for(k=0;k<n;k++)
+	{
+		if(a_B[k] == alpha[B[k]]) continue;
+		if(k1 == -1)
+		{
+			k1 = k;
+			continue;
+		}
+		update_G(G,col_buf+(size_t)slot[k1]*l,a_B[k1]-alpha[B[k1]],
+			col_buf+(size_t)slot[k]*l,a_B[k]-alpha[B[k]],active_size);
+		k1 = -1;
+	}
+	if(k1 != -1)
+		update_G(G,a_B[k1]-alpha[B[k1]],col_buf+(size_t)slot[k1]*l,active_size);
+
+	// update alpha, alpha_status and G_bar
+
+	for(k=0;k<n;k++)
+	{
+		int t = B[k];
+		if(a_B[k] == alpha[t]) continue;
+		bool u = is_upper_bound(t);
+		alpha[t] = a_B[k];
+		update_alpha_status(t);
+		if(u != is_upper_bound(t))
+			update_G(G_bar,u ? -C_B[k] : C_B[k],Q->get_Q(t,l),l);
+	}
+}
+
 //
 // Solver for nu-svm classification and regression
 //
@@ -1009,7 +1697,7 @@ double Solver::calculate_rho()
 class Solver_NU: public Solver
 {
 public:
-	Solver_NU() {}
+	Solver_NU(int nr_thread_ = 1):Solver(nr_thread_) {}
 	void Solve(int l, const QMatrix& Q, const double *p, const schar *y,
 		   double *alpha, double Cp, double Cn, double eps,
 		   SolutionInfo* si, int shrinking)
@@ -1282,6 +1970,7 @@ public:
 		int start, j;
 		if((start = cache->get_data(i,&data,len)) < len)
 		{
+#pragma omp parallel for private(j) schedule(guided) num_threads(nr_thread) if(nr_thread > 1)
 			for(j=start;j<len;j++)
 				data[j] = (Qfloat)(y[i]*y[j]*(this->*kernel_function)(i,j));
 		}
@@ -1331,6 +2020,7 @@ public:
 		int start, j;
 		if((start = cache->get_data(i,&data,len)) < len)
 		{
+#pragma omp parallel for private(j) schedule(guided) num_threads(nr_thread) if(nr_thread > 1)
 			for(j=start;j<len;j++)
 				data[j] = (Qfloat)(this->*kernel_function)(i,j);
 		}
@@ -1397,6 +2087,7 @@ public:
 		int j, real_i = index[i];
 		if(cache->get_data(real_i,&data,l) < l)
 		{
+#pragma omp parallel for private(j) schedule(guided) num_threads(nr_thread) if(nr_thread > 1)
 			for(j=0;j<l;j++)
 				data[j] = (Qfloat)(this->*kernel_function)(real_i,j);
 		}
@@ -1435,63 +2126,196 @@ private:
 };
 
 //
-// construct and solve various formulations
+// One-vs-rest: the k binary problems share the data, so the kernel
+// columns are cached once in the order of the data, and each problem
+// applies its own labels and order (the solver's swap_index) to them
 //
-static void solve_c_svc(
-	const svm_problem *prob, const svm_parameter* param,
-	double *alpha, Solver::SolutionInfo* si, double Cp, double Cn)
+class Kernel_Columns: public Kernel
 {
-	int l = prob->l;
-	double *minus_ones = new double[l];
-	schar *y = new schar[l];
-
-	int i;
-
-	for(i=0;i<l;i++)
+public:
+	Kernel_Columns(const svm_problem& prob, const svm_parameter& param)
+	:Kernel(prob.l, prob.x, param)
 	{
-		alpha[i] = 0;
-		minus_ones[i] = -1;
-		if(prob->y[i] > 0) y[i] = +1; else y[i] = -1;
+		cache = new Cache(prob.l,(long int)(param.cache_size*(1<<20)));
+		QD = new double[prob.l];
+		for(int i=0;i<prob.l;i++)
+			QD[i] = (this->*kernel_function)(i,i);
 	}
 
-	Solver s;
-	s.Solve(l, SVC_Q(*prob,*param,y), minus_ones, y,
-		alpha, Cp, Cn, param->eps, si, param->shrinking);
-
-	double sum_alpha=0;
-	for(i=0;i<l;i++)
-		sum_alpha += alpha[i];
+	Qfloat *get_Q(int i, int len) const
+	{
+		Qfloat *data;
+		int start, j;
+		if((start = cache->get_data(i,&data,len)) < len)
+		{
+#pragma omp parallel for private(j) schedule(guided) num_threads(nr_thread) if(nr_thread > 1)
+			for(j=start;j<len;j++)
+				data[j] = (Qfloat)(this->*kernel_function)(i,j);
+		}
+		return data;
+	}
 
-	if (Cp==Cn)
-		info("nu = %f\n", sum_alpha/(Cp*prob->l));
+	double *get_QD() const
+	{
+		return QD;
+	}
 
-	for(i=0;i<l;i++)
-		alpha[i] *= y[i];
+	// the order is that of the data
+	void swap_index(int, int) const {}
 
-	delete[] minus_ones;
-	delete[] y;
-}
+	~Kernel_Columns()
+	{
+		delete cache;
+		delete[] QD;
+	}
+private:
+	Cache *cache;
+	double *QD;
+};
 
-static void solve_nu_svc(
-	const svm_problem *prob, const svm_parameter *param,
-	double *alpha, Solver::SolutionInfo* si)
+class OVR_Q: public QMatrix
 {
-	int i;
-	int l = prob->l;
-	double nu = param->nu;
-
-	schar *y = new schar[l];
+public:
+	OVR_Q(const Kernel_Columns& K_, int l_, const schar *y_)
+	:K(K_), l(l_)
+	{
+		clone(y,y_,l);
+		clone(QD,K.get_QD(),l);
+		index = new int[l];
+		for(int k=0;k<l;k++)
+			index[k] = k;
+		buffer[0] = new Qfloat[l];
+		buffer[1] = new Qfloat[l];
+		next_buffer = 0;
+	}
 
-	for(i=0;i<l;i++)
-		if(prob->y[i]>0)
-			y[i] = +1;
-		else
-			y[i] = -1;
+	Qfloat *get_Q(int i, int len) const
+	{
+		const Qfloat *data = K.get_Q(index[i],l);
+		Qfloat *buf = buffer[next_buffer];
+		next_buffer = 1 - next_buffer;
+		schar yi = y[i];
+		for(int j=0;j<len;j++)
+			buf[j] = (Qfloat) yi * y[j] * data[index[j]];
+		return buf;
+	}
 
-	double sum_pos = nu*l/2;
-	double sum_neg = nu*l/2;
+	double *get_QD() const
+	{
+		return QD;
+	}
 
-	for(i=0;i<l;i++)
+	void swap_index(int i, int j) const
+	{
+		swap(y[i],y[j]);
+		swap(QD[i],QD[j]);
+		swap(index[i],index[j]);
+	}
+
+	~OVR_Q()
+	{
+		delete[] y;
+		delete[] QD;
+		delete[] index;
+		delete[] buffer[0];
+		delete[] buffer[1];
+	}
+private:
+	const Kernel_Columns& K;
+	int l;
+	schar *y;
+	double *QD;
+	int *index;
+	mutable int next_buffer;
+	Qfloat *buffer[2];
+};
+
+// the solver for C-SVC, one-class SVM and epsilon-SVR on l variables;
+// the working set of Solver_Block is cut so that its column buffer fits
+// in cache_size
+static Solver *create_solver(const svm_parameter *param, int l)
+{
+	int q = param->ws_size;
+	if(q > 2)
+	{
+		double max_q = param->cache_size*(1<<20)/((double)sizeof(Qfloat)*max(l,1));
+		if(q > l)
+			q = l;
+		if(q > max_q)
+		{
+			q = (int)max_q;
+			info("ws_size reduced to %d to fit the cache\n",q);
+		}
+	}
+	if(q > 2)
+		return new Solver_Block(q,param->nr_thread);
+	return new Solver(param->nr_thread);
+}
+
+//
+// construct and solve various formulations
+//
+// K, if not NULL, holds the kernel columns of prob shared by several problems
+static void solve_c_svc(
+	const svm_problem *prob, const svm_parameter* param,
+	double *alpha, Solver::SolutionInfo* si, double Cp, double Cn,
+	const Kernel_Columns *K)
+{
+	int l = prob->l;
+	double *minus_ones = new double[l];
+	schar *y = new schar[l];
+
+	int i;
+
+	for(i=0;i<l;i++)
+	{
+		minus_ones[i] = -1;
+		if(prob->y[i] > 0) y[i] = +1; else y[i] = -1;
+	}
+
+	Solver *s = create_solver(param,l);
+	if(K)
+		s->Solve(l, OVR_Q(*K,l,y), minus_ones, y,
+			alpha, Cp, Cn, param->eps, si, param->shrinking);
+	else
+		s->Solve(l, SVC_Q(*prob,*param,y), minus_ones, y,
+			alpha, Cp, Cn, param->eps, si, param->shrinking);
+	delete s;
+
+	double sum_alpha=0;
+	for(i=0;i<l;i++)
+		sum_alpha += alpha[i];
+
+	if (Cp==Cn)
+		info("nu = %f\n", sum_alpha/(Cp*prob->l));
+
+	for(i=0;i<l;i++)
+		alpha[i] *= y[i];
+
+	delete[] minus_ones;
+	delete[] y;
+}
+
+static void solve_nu_svc(
+	const svm_problem *prob, const svm_parameter *param,
+	double *alpha, Solver::SolutionInfo* si)
+{
+	int i;
+	int l = prob->l;
+	double nu = param->nu;
+
+	schar *y = new schar[l];
+
+	for(i=0;i<l;i++)
+		if(prob->y[i]>0)
+			y[i] = +1;
+		else
+			y[i] = -1;
+
+	double sum_pos = nu*l/2;
+	double sum_neg = nu*l/2;
+
+	for(i=0;i<l;i++)
 		if(y[i] == +1)
 		{
 			alpha[i] = min(1.0,sum_pos);
@@ -1508,7 +2332,7 @@ static void solve_nu_svc(
 	for(i=0;i<l;i++)
 		zeros[i] = 0;
 
-	Solver_NU s;
+	Solver_NU s(param->nr_thread);
 	s.Solve(l, SVC_Q(*prob,*param,y), zeros, y,
 		alpha, 1.0, 1.0, param->eps, si,  param->shrinking);
 	double r = si->r;
@@ -1551,9 +2375,10 @@ static void solve_one_class(
 		ones[i] = 1;
 	}
 
-	Solver s;
-	s.Solve(l, ONE_CLASS_Q(*prob,*param), zeros, ones,
+	Solver *s = create_solver(param,l);
+	s->Solve(l, ONE_CLASS_Q(*prob,*param), zeros, ones,
 		alpha, 1.0, 1.0, param->eps, si, param->shrinking);
+	delete s;
 
 	delete[] zeros;
 	delete[] ones;
@@ -1580,9 +2405,10 @@ static void solve_epsilon_svr(
 		y[i+l] = -1;
 	}
 
-	Solver s;
-	s.Solve(2*l, SVR_Q(*prob,*param), linear_term, y,
+	Solver *s = create_solver(param,2*l);
+	s->Solve(2*l, SVR_Q(*prob,*param), linear_term, y,
 		alpha2, param->C, param->C, param->eps, si, param->shrinking);
+	delete s;
 
 	double sum_alpha = 0;
 	for(i=0;i<l;i++)
@@ -1621,7 +2447,7 @@ static void solve_nu_svr(
 		y[i+l] = -1;
 	}
 
-	Solver_NU s;
+	Solver_NU s(param->nr_thread);
 	s.Solve(2*l, SVR_Q(*prob,*param), linear_term, y,
 		alpha2, C, C, param->eps, si, param->shrinking);
 
@@ -1635,6 +2461,246 @@ static void solve_nu_svr(
 	delete[] y;
 }
 
+// sparse operations on the primal weights of linear models; features
+// outside [1,nr_feature] have zero weight.  axpy_w takes rows checked to
+// have indices >= 1.
+static double dot_w(const double *w, int nr_feature, const svm_node *x)
+{
+	double sum = 0;
+	while(x->index != -1)
+	{
+		if(x->index >= 1 && x->index <= nr_feature)
+			sum += w[x->index-1]*x->value;
+		x++;
+	}
+	return sum;
+}
+
+static double nrm2_sq(const svm_node *x)
+{
+	double sum = 0;
+	while(x->index != -1)
+	{
+		sum += x->value*x->value;
+		x++;
+	}
+	return sum;
+}
+
+static void axpy_w(double a, const svm_node *x, double *w)
+{
+	while(x->index != -1)
+	{
+		w[x->index-1] += a*x->value;
+		x++;
+	}
+}
+
+// the rows of the linear solver: svm_node rows, or dim dense features
+// with example i in row[i] of F (the approximate features of
+// svm_train_approx, 4 bytes a value instead of 16)
+struct sparse_rows
+{
+	svm_node * const *x;
+	double dot(const double *w, int nr_feature, int i) const { return dot_w(w,nr_feature,x[i]); }
+	double nrm2_sq(int i) const { return ::nrm2_sq(x[i]); }
+	void axpy(double a, int i, double *w) const { axpy_w(a,x[i],w); }
+};
+
+struct dense_rows
+{
+	const float *F;
+	const int *row;
+	int dim;
+	double dot(const double *w, int, int i) const
+	{
+		const float *f = F+(size_t)row[i]*dim;
+		double sum = 0;
+		for(int k=0;k<dim;k++)
+			sum += w[k]*f[k];
+		return sum;
+	}
+	double nrm2_sq(int i) const
+	{
+		const float *f = F+(size_t)row[i]*dim;
+		double sum = 0;
+		for(int k=0;k<dim;k++)
+			sum += (double)f[k]*f[k];
+		return sum;
+	}
+	void axpy(double a, int i, double *w) const
+	{
+		const float *f = F+(size_t)row[i]*dim;
+		for(int k=0;k<dim;k++)
+			w[k] += a*f[k];
+	}
+};
+
+//
+// Dual coordinate descent for linear C-SVC (Hsieh et al., ICML 2008)
+// Solves:
+//
+//	min 0.5(\alpha^T (Q + D) \alpha) - e^T \alpha
+//
+//		0 <= alpha_i <= U_i
+//
+//	L1 loss: U_i = C_i, D_ii = 0
+//	L2 loss: U_i = INF, D_ii = 1/(2 C_i)
+//
+// with Q_ij = y_i y_j (x_i^T x_j + 1), i.e. the bias is treated as one
+// more feature of value 1.  The primal w = \sum y_i alpha_i x_i is kept
+// up to date, so each step costs O(#nonzeros of x_i).  x_i are rows[i],
+// y_i the sign of y_in[i]; w[nr_feature] receives the weights and the
+// return value is rho = -b.
+//
+template <class Rows> static double solve_linear_c_svc(
+	int l, const double *y_in, const Rows &rows, const svm_parameter *param,
+	double *w, int nr_feature, double Cp, double Cn)
+{
+	int i, s, iter = 0;
+	int max_iter = 1000;
+	int active_size = l;
+	double b = 0;
+	double PGmax_old = INF;
+	double PGmin_old = -INF;
+	double *QD = new double[l];
+	double *alpha = new double[l];
+	int *index = new int[l];
+	schar *y = new schar[l];
+
+	// indexed by y_i+1
+	double diag[3] = {0.5/Cn, 0, 0.5/Cp};
+	double upper_bound[3] = {INF, 0, INF};
+	if(param->linear_solver != SOLVER_DCD_L2)
+	{
+		diag[0] = 0;
+		diag[2] = 0;
+		upper_bound[0] = Cn;
+		upper_bound[2] = Cp;
+	}
+
+	for(i=0;i<nr_feature;i++)
+		w[i] = 0;
+	for(i=0;i<l;i++)
+	{
+		y[i] = y_in[i] > 0 ? +1 : -1;
+		alpha[i] = 0;
+		QD[i] = diag[y[i]+1] + 1 + rows.nrm2_sq(i);
+		index[i] = i;
+	}
+
+	while(iter < max_iter)
+	{
+		double PGmax_new = -INF;
+		double PGmin_new = INF;
+
+		for(i=0;i<active_size;i++)
+		{
+			int j = i+random_int(active_size-i);
+			swap(index[i],index[j]);
+		}
+
+		for(s=0;s<active_size;s++)
+		{
+			i = index[s];
+			double C = upper_bound[y[i]+1];
+			double G = y[i]*(rows.dot(w,nr_feature,i)+b) - 1 + alpha[i]*diag[y[i]+1];
+
+			// projected gradient; variables at a bound whose gradient
+			// points outside the last violation range are shrunk
+			double PG = 0;
+			if(alpha[i] == 0)
+			{
+				if(G > PGmax_old)
+				{
+					active_size--;
+					swap(index[s],index[active_size]);
+					s--;
+					continue;
+				}
+				else if(G < 0)
+					PG = G;
+			}
+			else if(alpha[i] == C)
+			{
+				if(G < PGmin_old)
+				{
+					active_size--;
+					swap(index[s],index[active_size]);
+					s--;
+					continue;
+				}
+				else if(G > 0)
+					PG = G;
+			}
+			else
+				PG = G;
+
+			PGmax_new = max(PGmax_new,PG);
+			PGmin_new = min(PGmin_new,PG);
+
+			if(fabs(PG) > 1.0e-12)
+			{
+				double alpha_old = alpha[i];
+				alpha[i] = min(max(alpha[i] - G/QD[i],0.0),C);
+				double d = (alpha[i] - alpha_old)*y[i];
+				rows.axpy(d,i,w);
+				b += d;
+			}
+		}
+
+		iter++;
+		if(iter % 10 == 0)
+			info(".");
+
+		if(PGmax_new - PGmin_new <= param->eps)
+		{
+			if(active_size == l)
+				break;
+			else
+			{
+				// check the shrunk variables as well
+				active_size = l;
+				info("*");
+				PGmax_old = INF;
+				PGmin_old = -INF;
+				continue;
+			}
+		}
+		PGmax_old = PGmax_new;
+		PGmin_old = PGmin_new;
+		if(PGmax_old <= 0)
+			PGmax_old = INF;
+		if(PGmin_old >= 0)
+			PGmin_old = -INF;
+	}
+
+	info("\noptimization finished, #iter = %d\n",iter);
+	if(iter >= max_iter)
+		info("\nWARNING: reaching max number of iterations\n");
+
+	// calculate objective value
+
+	double v = b*b;
+	int nSV = 0;
+	for(i=0;i<nr_feature;i++)
+		v += w[i]*w[i];
+	for(i=0;i<l;i++)
+	{
+		v += alpha[i]*(alpha[i]*diag[y[i]+1] - 2);
+		if(alpha[i] > 0)
+			++nSV;
+	}
+	info("obj = %f, rho = %f\n",v/2,-b);
+	info("nSV = %d\n",nSV);
+
+	delete[] QD;
+	delete[] alpha;
+	delete[] index;
+	delete[] y;
+	return -b;
+}
+
 //
 // decision_function
 //
@@ -1644,16 +2710,23 @@ struct decision_function
 	double rho;
 };
 
+// alpha0, if not NULL, is a feasible starting point of C_SVC;
+// K, if not NULL, the shared kernel columns of prob (see OVR_Q)
 static decision_function svm_train_one(
 	const svm_problem *prob, const svm_parameter *param,
-	double Cp, double Cn)
+	double Cp, double Cn, const double *alpha0, const Kernel_Columns *K)
 {
 	double *alpha = Malloc(double,prob->l);
+	if(alpha0)
+		memcpy(alpha,alpha0,sizeof(double)*prob->l);
+	else
+		for(int i=0;i<prob->l;i++)
+			alpha[i] = 0;
 	Solver::SolutionInfo si;
 	switch(param->svm_type)
 	{
 		case C_SVC:
-			solve_c_svc(prob,param,alpha,&si,Cp,Cn);
+			solve_c_svc(prob,param,alpha,&si,Cp,Cn,K);
 			break;
 		case NU_SVC:
 			solve_nu_svc(prob,param,alpha,&si);
@@ -1815,78 +2888,116 @@ static void sigmoid_train(
 	free(t);
 }
 
-static double sigmoid_predict(double decision_value, double A, double B)
-{
-	double fApB = decision_value*A+B;
-	// 1-p used later; avoid catastrophic cancellation
-	if (fApB >= 0)
-		return exp(-fApB)/(1.0+exp(-fApB));
-	else
-		return 1.0/(1+exp(fApB)) ;
-}
-
-// Method 2 from the multiclass_prob paper by Wu, Lin, and Weng
-static void multiclass_probability(int k, double **r, double *p)
+// Method 2 from the multiclass_prob paper by Wu, Lin, and Weng, for bx
+// instances at once: r[(i*k+j)*bx+b] are the pairwise probabilities of
+// instance b, and p[t*bx+b] its class probabilities.  All instances
+// iterate in lockstep; one that has converged takes steps of zero, so
+// the inner loops run over the instances without branches.  work holds
+// (k*k+k+3)*bx doubles.
+static void multiclass_probability(int k, int bx, const double *r, double *p, double *work)
 {
-	int t,j;
+	int t,j,b;
 	int iter = 0, max_iter=max(100,k);
-	double **Q=Malloc(double *,k);
-	double *Qp=Malloc(double,k);
-	double pQp, eps=0.005/k;
-	
+	double *Q=work;			// Q[(t*k+j)*bx+b]
+	double *Qp=Q+(size_t)k*k*bx;	// Qp[t*bx+b]
+	double *pQp=Qp+(size_t)k*bx;
+	double *active=pQp+bx;
+	double *diff=active+bx;
+	double eps=0.005/k;
+
 	for (t=0;t<k;t++)
 	{
-		p[t]=1.0/k;  // Valid if k = 1
-		Q[t]=Malloc(double,k);
-		Q[t][t]=0;
+		double *Qtt=Q+((size_t)t*k+t)*bx;
+		for (b=0;b<bx;b++)
+		{
+			p[t*bx+b]=1.0/k;  // Valid if k = 1
+			Qtt[b]=0;
+		}
 		for (j=0;j<t;j++)
 		{
-			Q[t][t]+=r[j][t]*r[j][t];
-			Q[t][j]=Q[j][t];
+			const double *rjt=r+((size_t)j*k+t)*bx;
+			double *Qtj=Q+((size_t)t*k+j)*bx, *Qjt=Q+((size_t)j*k+t)*bx;
+			for (b=0;b<bx;b++)
+			{
+				Qtt[b]+=rjt[b]*rjt[b];
+				Qtj[b]=Qjt[b];
+			}
 		}
 		for (j=t+1;j<k;j++)
 		{
-			Q[t][t]+=r[j][t]*r[j][t];
-			Q[t][j]=-r[j][t]*r[t][j];
+			const double *rjt=r+((size_t)j*k+t)*bx, *rtj=r+((size_t)t*k+j)*bx;
+			double *Qtj=Q+((size_t)t*k+j)*bx;
+			for (b=0;b<bx;b++)
+			{
+				Qtt[b]+=rjt[b]*rjt[b];
+				Qtj[b]=-rjt[b]*rtj[b];
+			}
 		}
 	}
+	for (b=0;b<bx;b++)
+		active[b]=1;
 	for (iter=0;iter<max_iter;iter++)
 	{
 		// stopping condition, recalculate QP,pQP for numerical accuracy
-		pQp=0;
+		for (b=0;b<bx;b++)
+			pQp[b]=0;
 		for (t=0;t<k;t++)
 		{
-			Qp[t]=0;
+			double *Qpt=Qp+(size_t)t*bx;
+			for (b=0;b<bx;b++)
+				Qpt[b]=0;
 			for (j=0;j<k;j++)
-				Qp[t]+=Q[t][j]*p[j];
-			pQp+=p[t]*Qp[t];
+			{
+				const double *Qtj=Q+((size_t)t*k+j)*bx, *pj=p+(size_t)j*bx;
+				for (b=0;b<bx;b++)
+					Qpt[b]+=Qtj[b]*pj[b];
+			}
+			for (b=0;b<bx;b++)
+				pQp[b]+=p[t*bx+b]*Qpt[b];
 		}
-		double max_error=0;
-		for (t=0;t<k;t++)
+		int nr_active=0;
+		for (b=0;b<bx;b++)
 		{
-			double error=fabs(Qp[t]-pQp);
-			if (error>max_error)
-				max_error=error;
+			if (active[b] == 0)
+				continue;
+			double max_error=0;
+			for (t=0;t<k;t++)
+			{
+				double error=fabs(Qp[t*bx+b]-pQp[b]);
+				if (error>max_error)
+					max_error=error;
+			}
+			if (max_error<eps)
+				active[b]=0;
+			else
+				nr_active++;
 		}
-		if (max_error<eps) break;
-		
+		if (nr_active==0) break;
+
 		for (t=0;t<k;t++)
 		{
-			double diff=(-Qp[t]+pQp)/Q[t][t];
-			p[t]+=diff;
-			pQp=(pQp+diff*(diff*Q[t][t]+2*Qp[t]))/(1+diff)/(1+diff);
+			const double *Qtt=Q+((size_t)t*k+t)*bx;
+			const double *Qpt=Qp+(size_t)t*bx;
+			for (b=0;b<bx;b++)
+			{
+				diff[b]=active[b]*(-Qpt[b]+pQp[b])/Qtt[b];
+				p[t*bx+b]+=diff[b];
+				pQp[b]=(pQp[b]+diff[b]*(diff[b]*Qtt[b]+2*Qpt[b]))/(1+diff[b])/(1+diff[b]);
+			}
 			for (j=0;j<k;j++)
 			{
-				Qp[j]=(Qp[j]+diff*Q[t][j])/(1+diff);
-				p[j]/=(1+diff);
+				const double *Qtj=Q+((size_t)t*k+j)*bx;
+				double *Qpj=Qp+(size_t)j*bx, *pj=p+(size_t)j*bx;
+				for (b=0;b<bx;b++)
+				{
+					Qpj[b]=(Qpj[b]+diff[b]*Qtj[b])/(1+diff[b]);
+					pj[b]/=(1+diff[b]);
+				}
 			}
 		}
 	}
 	if (iter>=max_iter)
 		info("Exceeds max_iter in multiclass_prob\n");
-	for(t=0;t<k;t++) free(Q[t]);
-	free(Q);
-	free(Qp);
 }
 
 // Cross-validation decision values for probability estimates
@@ -1903,7 +3014,7 @@ static void svm_binary_svc_probability(
 	for(i=0;i<prob->l;i++) perm[i]=i;
 	for(i=0;i<prob->l;i++)
 	{
-		int j = i+rand()%(prob->l-i);
+		int j = i+random_int(prob->l-i);
 		swap(perm[i],perm[j]);
 	}
 	for(i=0;i<nr_fold;i++)
@@ -2086,37 +3197,740 @@ static void svm_group_classes(const svm_problem *prob, int *nr_class_ret, int **
 	free(data_label);
 }
 
+// one-vs-rest has one decision function per class; with two classes
+// it is the same as one-vs-one
+static bool one_vs_rest(const svm_parameter& param, int nr_class)
+{
+	return param.svm_type == C_SVC && param.multiclass == OVR && nr_class > 2;
+}
+
+// the number of decision functions and of rows of sv_coef of a model
+// with nr_class classes
+static int nr_decision(const svm_parameter& param, int nr_class)
+{
+	return one_vs_rest(param,nr_class) ? nr_class : nr_class*(nr_class-1)/2;
+}
+
+static int nr_sv_coef(const svm_parameter& param, int nr_class)
+{
+	return one_vs_rest(param,nr_class) ? nr_class : nr_class-1;
+}
+
 //
-// Interface functions
+// Kernel approximation
+//
+// With param->approx, C-SVC is trained by the linear solver on features
+// phi(x) whose inner products approximate the kernel, so training is
+// linear in l.  For Nyström, phi(x) = L^{-1} k(x) with k(x) the kernel
+// values with m landmarks and L L^T their kernel matrix; the weights of
+// each decision function are then mapped back to k(x), so the model
+// keeps the landmarks and one w over k(x) per pair of classes.  For
+// random Fourier features of the RBF kernel, phi_k(x) = sqrt(2/m)
+// cos(omega_k^T x + b_k) with omega_k ~ N(0,2*gamma*I) and b_k uniform
+// in [0,2*pi); the model keeps omega_k as a dense row of omega, b_k as
+// phase[k] and w scaled by sqrt(2/m).
 //
-svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
-{
-	svm_model *model = Malloc(svm_model,1);
-	model->param = *param;
-	model->free_sv = 0;	// XXX
 
-	if(param->svm_type == ONE_CLASS ||
-	   param->svm_type == EPSILON_SVR ||
-	   param->svm_type == NU_SVR)
+// copy x[0..n-1] into one block; free with free(ret[0]) if n > 0
+static svm_node **copy_nodes(svm_node * const *x, int n)
+{
+	int i;
+	size_t elements = 0;
+	for(i=0;i<n;i++)
 	{
-		// regression or one-class-svm
-		model->nr_class = 2;
-		model->label = NULL;
-		model->nSV = NULL;
-		model->probA = NULL; model->probB = NULL;
-		model->sv_coef = Malloc(double *,1);
-
-		if(param->probability && 
-		   (param->svm_type == EPSILON_SVR ||
-		    param->svm_type == NU_SVR))
-		{
-			model->probA = Malloc(double,1);
-			model->probA[0] = svm_svr_probability(prob,param);
-		}
+		for(const svm_node *p=x[i];p->index!=-1;p++)
+			++elements;
+		++elements;
+	}
+	svm_node **ret = Malloc(svm_node *,n);
+	svm_node *x_space = n > 0 ? Malloc(svm_node,elements) : NULL;
+	for(i=0;i<n;i++)
+	{
+		const svm_node *p = x[i];
+		ret[i] = x_space;
+		while(p->index != -1)
+			*x_space++ = *p++;
+		*x_space++ = *p;
+	}
+	return ret;
+}
 
-		decision_function f = svm_train_one(prob,param,0,0);
-		model->rho = Malloc(double,1);
-		model->rho[0] = f.rho;
+// m landmarks: a uniform sample of the data, or the centers found by
+// k-means (Lloyd's iterations from such a sample) on at most 10*m points
+static svm_node **nystrom_landmarks(const svm_problem *prob, const svm_parameter *param, int m)
+{
+	int l = prob->l;
+	int n = param->approx == NYSTROM_KMEANS ? min(l,10*m) : m;
+	int i, j, k;
+	unsigned long long state = rng_init(param->seed);
+
+	int *perm = Malloc(int,l);
+	for(i=0;i<l;i++)
+		perm[i] = i;
+	for(i=0;i<n;i++)
+		swap(perm[i],perm[i+rng_int(state,l-i)]);
+	svm_node **x = Malloc(svm_node *,n);
+	for(i=0;i<n;i++)
+		x[i] = prob->x[perm[i]];
+	free(perm);
+
+	if(param->approx != NYSTROM_KMEANS)
+	{
+		svm_node **z = copy_nodes(x,m);
+		free(x);
+		return z;
+	}
+
+	// column j of a center holds feature j+base; base drops below 1 only
+	// when the sample has such indices
+	int base = 1, max_index = 0;
+	for(i=0;i<n;i++)
+		for(const svm_node *p=x[i];p->index!=-1;p++)
+		{
+			base = min(base,p->index);
+			max_index = max(max_index,p->index);
+		}
+	int dim = max_index-base+1;
+	size_t size = (size_t)m*dim;
+
+	double *c = Malloc(double,size);
+	double *c_sum = Malloc(double,size);
+	double *c_sq = Malloc(double,m);
+	int *c_count = Malloc(int,m);
+	int *assign = Malloc(int,n);
+
+	for(k=0;k<m;k++)
+	{
+		double *c_k = c+(size_t)k*dim;
+		for(j=0;j<dim;j++)
+			c_k[j] = 0;
+		for(const svm_node *p=x[k];p->index!=-1;p++)
+			c_k[p->index-base] = p->value;
+	}
+
+	int max_iter = 10;
+	for(int iter=0;iter<max_iter;iter++)
+	{
+		for(k=0;k<m;k++)
+		{
+			const double *c_k = c+(size_t)k*dim;
+			c_sq[k] = 0;
+			for(j=0;j<dim;j++)
+				c_sq[k] += c_k[j]*c_k[j];
+		}
+
+		// nearest center: minimize |c_k|^2 - 2 x^T c_k
+#pragma omp parallel for private(k) schedule(guided) num_threads(param->nr_thread) if(param->nr_thread > 1)
+		for(i=0;i<n;i++)
+		{
+			double d_min = INF;
+			for(k=0;k<m;k++)
+			{
+				const double *c_k = c+(size_t)k*dim;
+				double d = c_sq[k];
+				for(const svm_node *p=x[i];p->index!=-1;p++)
+					d -= 2*p->value*c_k[p->index-base];
+				if(d < d_min)
+				{
+					d_min = d;
+					assign[i] = k;
+				}
+			}
+		}
+
+		for(k=0;k<m;k++)
+			c_count[k] = 0;
+		for(size_t t=0;t<size;t++)
+			c_sum[t] = 0;
+		for(i=0;i<n;i++)
+		{
+			double *s = c_sum+(size_t)assign[i]*dim;
+			for(const svm_node *p=x[i];p->index!=-1;p++)
+				s[p->index-base] += p->value;
+			c_count[assign[i]]++;
+		}
+		// an empty cluster keeps its center
+		for(k=0;k<m;k++)
+			if(c_count[k] > 0)
+				for(j=0;j<dim;j++)
+					c[(size_t)k*dim+j] = c_sum[(size_t)k*dim+j]/c_count[k];
+	}
+
+	// the centers as sparse rows
+	size_t elements = m;
+	for(size_t t=0;t<size;t++)
+		if(c[t] != 0)
+			++elements;
+	svm_node **z = Malloc(svm_node *,m);
+	svm_node *x_space = Malloc(svm_node,elements);
+	for(k=0;k<m;k++)
+	{
+		z[k] = x_space;
+		for(j=0;j<dim;j++)
+			if(c[(size_t)k*dim+j] != 0)
+			{
+				x_space->index = j+base;
+				x_space->value = c[(size_t)k*dim+j];
+				++x_space;
+			}
+		(x_space++)->index = -1;
+	}
+
+	free(x);
+	free(c);
+	free(c_sum);
+	free(c_sq);
+	free(c_count);
+	free(assign);
+	return z;
+}
+
+// v[k] = cos(v[k]), reduced to [0,pi/2] by periodicity and symmetry
+// and then a Taylor polynomial of degree 16 (error below 1e-12)
+static const double cos_coef[] = {
+	1.0/20922789888000, -1.0/87178291200, 1.0/479001600, -1.0/3628800,
+	1.0/40320, -1.0/720, 1.0/24, -1.0/2, 1
+};
+
+static void cos_array(double *v, int n)
+{
+	int k = 0, c;
+#if defined(__AVX__)
+	const __m256d sign = _mm256_set1_pd(-0.0);
+	const __m256d two_pi = _mm256_set1_pd(2*M_PI);
+	const __m256d inv_two_pi = _mm256_set1_pd(1/(2*M_PI));
+	const __m256d pi = _mm256_set1_pd(M_PI);
+	const __m256d half_pi = _mm256_set1_pd(M_PI/2);
+	for(;k+4<=n;k+=4)
+	{
+		__m256d x = _mm256_loadu_pd(v+k);
+		__m256d q = _mm256_round_pd(_mm256_mul_pd(x,inv_two_pi),_MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+		x = _mm256_andnot_pd(sign,_mm256_sub_pd(x,_mm256_mul_pd(q,two_pi)));
+		__m256d flip = _mm256_cmp_pd(x,half_pi,_CMP_GT_OQ);
+		x = _mm256_blendv_pd(x,_mm256_sub_pd(pi,x),flip);
+		__m256d z = _mm256_mul_pd(x,x);
+		__m256d p = _mm256_set1_pd(cos_coef[0]);
+		for(c=1;c<9;c++)
+			p = _mm256_add_pd(_mm256_mul_pd(p,z),_mm256_set1_pd(cos_coef[c]));
+		_mm256_storeu_pd(v+k,_mm256_xor_pd(p,_mm256_and_pd(flip,sign)));
+	}
+#endif
+	for(;k<n;k++)
+	{
+		double x = fabs(v[k]-2*M_PI*nearbyint(v[k]*(1/(2*M_PI))));
+		bool flip = x > M_PI/2;
+		if(flip)
+			x = M_PI-x;
+		double z = x*x, p = cos_coef[0];
+		for(c=1;c<9;c++)
+			p = p*z+cos_coef[c];
+		v[k] = flip ? -p : p;
+	}
+}
+
+// C of each class of label, with the weights of param
+static double *class_weighted_C(const svm_parameter *param, int nr_class, const int *label)
+{
+	double *weighted_C = Malloc(double, nr_class);
+	int i;
+	for(i=0;i<nr_class;i++)
+		weighted_C[i] = param->C;
+	for(i=0;i<param->nr_weight;i++)
+	{	
+		int j;
+		for(j=0;j<nr_class;j++)
+			if(param->weight_label[i] == label[j])
+				break;
+		if(j == nr_class)
+			fprintf(stderr,"WARNING: class label %d specified in weight is not found\n", param->weight_label[i]);
+		else
+			weighted_C[j] *= param->weight[i];
+	}
+	return weighted_C;
+}
+
+// svm_binary_svc_probability on the dense features of n examples
+static void dense_svc_probability(int n, const double *y, const dense_rows &rows,
+	const svm_parameter *param, double Cp, double Cn, double& probA, double& probB)
+{
+	int i, j;
+	int nr_fold = 5;
+	int *perm = Malloc(int,n);
+	int *sub_row = Malloc(int,n);
+	double *sub_y = Malloc(double,n);
+	double *dec_values = Malloc(double,n);
+	double *w = Malloc(double,rows.dim);
+
+	for(i=0;i<n;i++) perm[i]=i;
+	for(i=0;i<n;i++)
+	{
+		j = i+random_int(n-i);
+		swap(perm[i],perm[j]);
+	}
+	for(i=0;i<nr_fold;i++)
+	{
+		int begin = i*n/nr_fold;
+		int end = (i+1)*n/nr_fold;
+		int k = 0, p_count = 0, n_count = 0;
+		for(j=0;j<n;j++)
+			if(j < begin || j >= end)
+			{
+				sub_row[k] = rows.row[perm[j]];
+				sub_y[k] = y[perm[j]];
+				if(sub_y[k++] > 0)
+					p_count++;
+				else
+					n_count++;
+			}
+
+		if(p_count == 0 || n_count == 0)
+			for(j=begin;j<end;j++)
+				dec_values[perm[j]] = p_count > 0 ? 1 : (n_count > 0 ? -1 : 0);
+		else
+		{
+			dense_rows sub_rows = {rows.F,sub_row,rows.dim};
+			double rho = solve_linear_c_svc(k,sub_y,sub_rows,param,w,rows.dim,Cp,Cn);
+			for(j=begin;j<end;j++)
+				dec_values[perm[j]] = rows.dot(w,rows.dim,perm[j])-rho;
+		}
+	}
+	sigmoid_train(n,dec_values,y,probA,probB);
+	free(perm);
+	free(sub_row);
+	free(sub_y);
+	free(dec_values);
+	free(w);
+}
+
+// C-SVC by the linear solver on the dense features F, dim per example
+// of prob; the returned model, like one of svm_train with a primal w,
+// carries param
+static svm_model *train_on_dense_features(const svm_problem *prob, const float *F, int dim, const svm_parameter *param)
+{
+	svm_parameter linear_param = *param;
+	linear_param.kernel_type = LINEAR;
+	linear_param.approx = NO_APPROX;
+	if(linear_param.linear_solver != SOLVER_DCD_L2)
+		linear_param.linear_solver = SOLVER_DCD_L1;
+
+	int l = prob->l;
+	int nr_class;
+	int *label = NULL;
+	int *start = NULL;
+	int *count = NULL;
+	int *perm = Malloc(int,l);
+	int i, j, k, p;
+	svm_group_classes(prob,&nr_class,&label,&start,&count,perm);
+	if(nr_class == 1) 
+		info("WARNING: training data in only one class. See README for details.\n");
+
+	bool ovr = one_vs_rest(*param,nr_class);
+	int nr_dec = nr_decision(*param,nr_class);
+	double *weighted_C = class_weighted_C(param,nr_class,label);
+	double *w = Malloc(double,(size_t)dim*nr_dec);
+	double *rho = Malloc(double,nr_dec);
+	double *probA = NULL, *probB = NULL;
+	if(param->probability)
+	{
+		probA = Malloc(double,nr_dec);
+		probB = Malloc(double,nr_dec);
+	}
+
+	// the examples of each decision function as rows of F, the first
+	// class (or class i of one-vs-rest) +1
+	int *row = Malloc(int,l);
+	double *y = Malloc(double,l);
+	dense_rows rows = {F,row,dim};
+	for(p=0,i=0;i<nr_class;i++)
+		for(j=ovr ? i : i+1;j<(ovr ? i+1 : nr_class);j++,p++)
+		{
+			int n = 0;
+			double Cn = param->C;
+			if(ovr)
+				for(k=0;k<l;k++,n++)
+				{
+					row[n] = perm[k];
+					y[n] = (k >= start[i] && k < start[i]+count[i]) ? +1 : -1;
+				}
+			else
+			{
+				for(k=0;k<count[i];k++,n++)
+				{
+					row[n] = perm[start[i]+k];
+					y[n] = +1;
+				}
+				for(k=0;k<count[j];k++,n++)
+				{
+					row[n] = perm[start[j]+k];
+					y[n] = -1;
+				}
+				Cn = weighted_C[j];
+			}
+			if(param->probability)
+				dense_svc_probability(n,y,rows,&linear_param,weighted_C[i],Cn,probA[p],probB[p]);
+			rho[p] = solve_linear_c_svc(n,y,rows,&linear_param,w+(size_t)p*dim,dim,weighted_C[i],Cn);
+		}
+	info("Total nSV = 0\n");
+
+	int nr_coef = nr_sv_coef(*param,nr_class);
+	svm_model *model = Malloc(svm_model,1);
+	model->param = *param;
+	model->free_sv = 0;
+	model->mapping = NULL;
+	model->nr_class = nr_class;
+	model->l = 0;
+	model->SV = Malloc(svm_node *,0);
+	model->sv_indices = Malloc(int,0);
+	model->sv_coef = Malloc(double *,nr_coef);
+	for(i=0;i<nr_coef;i++)
+		model->sv_coef[i] = Malloc(double,0);
+	model->rho = rho;
+	model->probA = probA;
+	model->probB = probB;
+	model->label = label;
+	model->nSV = Malloc(int,nr_class);
+	for(i=0;i<nr_class;i++)
+		model->nSV[i] = 0;
+	model->nr_feature = dim;
+	model->w = w;
+	model->landmark = NULL;
+	model->phase = NULL;
+	model->omega = NULL;
+	model->omega_dim = 0;
+
+	free(start);
+	free(count);
+	free(perm);
+	free(weighted_C);
+	free(row);
+	free(y);
+	return model;
+}
+
+// x as a dense vector of its first dim inputs
+static void densify(const svm_node *x, double *xd, int dim)
+{
+	memset(xd,0,sizeof(double)*dim);
+	for(;x->index!=-1;x++)
+		if(x->index >= 1 && x->index <= dim)
+			xd[x->index-1] = x->value;
+}
+
+static svm_model *svm_train_fourier(const svm_problem *prob, const svm_parameter *param)
+{
+	int l = prob->l;
+	int m = param->approx_dim;
+	int i, j, k;
+	unsigned long long state = rng_init(param->seed);
+
+	int dim = 0;
+	for(i=0;i<l;i++)
+		for(const svm_node *p=prob->x[i];p->index!=-1;p++)
+			dim = max(dim,p->index);
+
+	// omega_k as dense rows of dim values
+	double *omega = Malloc(double,(size_t)m*max(dim,1));
+	double *phase = Malloc(double,m);
+	double sigma = sqrt(2*param->gamma);
+	for(k=0;k<m;k++)
+	{
+		for(j=0;j<dim;j++)
+			omega[(size_t)k*dim+j] = sigma*rng_normal(state);
+		phase[k] = 2*M_PI*rng_uniform(state);
+	}
+
+	// the features as m floats a row, as in svm_train_nystrom
+	float *F = Malloc(float,(size_t)l*m);
+	double scale = sqrt(2.0/m);
+#pragma omp parallel private(i,k) num_threads(param->nr_thread) if(param->nr_thread > 1)
+	{
+		double *v = Malloc(double,m+dim);
+		double *xd = v+m;
+#pragma omp for schedule(guided)
+		for(i=0;i<l;i++)
+		{
+			densify(prob->x[i],xd,dim);
+			for(k=0;k<m;k++)
+				v[k] = dot_dense(omega+(size_t)k*dim,xd,dim)+phase[k];
+			cos_array(v,m);
+			for(k=0;k<m;k++)
+				F[(size_t)i*m+k] = (float)(scale*v[k]);
+		}
+		free(v);
+	}
+	info("Fourier: %d features of %d inputs\n",m,dim);
+
+	svm_model *model = train_on_dense_features(prob,F,m,param);
+	int n = nr_decision(*param,model->nr_class);
+	for(j=0;j<n*m;j++)
+		model->w[j] *= scale;
+	model->omega = omega;
+	model->omega_dim = dim;
+	model->phase = phase;
+
+	free(F);
+	return model;
+}
+
+static svm_model *svm_train_nystrom(const svm_problem *prob, const svm_parameter *param)
+{
+	int l = prob->l;
+	int m = min(param->approx_dim,l);
+	int i, j, k;
+	svm_node **z = nystrom_landmarks(prob,param,m);
+
+	// pivoted Cholesky factorization of the kernel matrix W of the
+	// landmarks, stopped at its numerical rank r; landmarks that are
+	// (nearly) linear combinations of the pivots are dropped, and the
+	// kernel matrix of the r pivots is L L^T, L lower triangular
+
+	double *W = Malloc(double,(size_t)m*m);
+#pragma omp parallel for private(j) schedule(guided) num_threads(param->nr_thread) if(param->nr_thread > 1)
+	for(i=0;i<m;i++)
+		for(j=0;j<=i;j++)
+			W[(size_t)i*m+j] = W[(size_t)j*m+i] = Kernel::k_function(z[i],z[j],*param);
+
+	int *piv = Malloc(int,m);
+	double *d = Malloc(double,m);
+	double *L_piv = Malloc(double,(size_t)m*m);	// row of each landmark
+	double d_max = 0;
+	for(i=0;i<m;i++)
+	{
+		piv[i] = i;
+		d[i] = W[(size_t)i*m+i];
+		d_max = max(d_max,d[i]);
+	}
+
+	int r = 0;
+	for(k=0;k<m;k++)
+	{
+		int p = k;
+		for(i=k+1;i<m;i++)
+			if(d[piv[i]] > d[piv[p]])
+				p = i;
+		if(d[piv[p]] <= 1e-10*d_max)
+			break;
+		swap(piv[k],piv[p]);
+
+		int pk = piv[k];
+		const double *L_k = L_piv+(size_t)pk*m;
+		double L_kk = sqrt(d[pk]);
+		L_piv[(size_t)pk*m+k] = L_kk;
+		for(i=k+1;i<m;i++)
+		{
+			int o = piv[i];
+			double *L_o = L_piv+(size_t)o*m;
+			double v = W[(size_t)o*m+pk];
+			for(j=0;j<k;j++)
+				v -= L_o[j]*L_k[j];
+			L_o[k] = v/L_kk;
+			d[o] -= L_o[k]*L_o[k];
+		}
+		r++;
+	}
+	info("Nystrom: %d landmarks, rank %d\n",m,r);
+
+	double *L = Malloc(double,(size_t)r*r);
+	for(i=0;i<r;i++)
+		for(j=0;j<r;j++)
+			L[(size_t)i*r+j] = j <= i ? L_piv[(size_t)piv[i]*m+j] : 0;
+
+	// phi(x_i) by forward substitution, kept as r floats a row
+
+	float *F = Malloc(float,(size_t)l*r);
+#pragma omp parallel private(i,j,k) num_threads(param->nr_thread) if(param->nr_thread > 1)
+	{
+		double *phi = Malloc(double,max(r,1));
+#pragma omp for schedule(guided)
+		for(i=0;i<l;i++)
+		{
+			for(j=0;j<r;j++)
+			{
+				double v = Kernel::k_function(prob->x[i],z[piv[j]],*param);
+				for(k=0;k<j;k++)
+					v -= L[(size_t)j*r+k]*phi[k];
+				phi[j] = v/L[(size_t)j*r+j];
+				F[(size_t)i*r+j] = (float)phi[j];
+			}
+		}
+		free(phi);
+	}
+
+	svm_model *model = train_on_dense_features(prob,F,r,param);
+
+	// w^T phi(x) = (L^{-T} w)^T k(x): back substitution for each w
+	int n = nr_decision(*param,model->nr_class);
+	for(int p=0;p<n;p++)
+	{
+		double *w = model->w+(size_t)p*r;
+		for(j=r-1;j>=0;j--)
+		{
+			double v = w[j];
+			for(k=j+1;k<r;k++)
+				v -= L[(size_t)k*r+j]*w[k];
+			w[j] = v/L[(size_t)j*r+j];
+		}
+	}
+
+	svm_node **z_piv = Malloc(svm_node *,r);
+	for(i=0;i<r;i++)
+		z_piv[i] = z[piv[i]];
+	model->landmark = copy_nodes(z_piv,r);
+	model->nr_feature = r;
+
+	free(z_piv);
+	if(m > 0)
+		free(z[0]);
+	free(z);
+	free(W);
+	free(piv);
+	free(d);
+	free(L_piv);
+	free(L);
+	free(F);
+	return model;
+}
+
+static svm_model *svm_train_approx(const svm_problem *prob, const svm_parameter *param)
+{
+	if(param->approx == FOURIER)
+		return svm_train_fourier(prob,param);
+	return svm_train_nystrom(prob,param);
+}
+
+// the length of phi for approx_features: the features, then room for
+// the dense x of FOURIER
+static int approx_size(const svm_model *model)
+{
+	if(model->param.approx == NO_APPROX)
+		return 0;
+	return model->nr_feature+(model->param.approx == FOURIER ? model->omega_dim : 0);
+}
+
+// the features of x that w of an approximate model applies to
+static void approx_features(const svm_model *model, const svm_node *x, double *phi)
+{
+	int i;
+	if(model->param.approx == FOURIER)
+	{
+		int dim = model->omega_dim;
+		double *xd = phi+model->nr_feature;
+		densify(x,xd,dim);
+		for(i=0;i<model->nr_feature;i++)
+			phi[i] = dot_dense(model->omega+(size_t)i*dim,xd,dim)+model->phase[i];
+		cos_array(phi,model->nr_feature);
+	}
+	else
+		for(i=0;i<model->nr_feature;i++)
+			phi[i] = Kernel::k_function(x,model->landmark[i],model->param);
+}
+
+static bool has_index_below_one(const svm_problem *prob)
+{
+	for(int i=0;i<prob->l;i++)
+		for(const svm_node *p=prob->x[i];p->index!=-1;p++)
+			if(p->index < 1)
+				return true;
+	return false;
+}
+
+// C-SVC with the linear kernel is trained by dual coordinate descent
+// into a primal w when it is requested.  SOLVER_AUTO picks it (L1 loss)
+// when the kernel matrix of prob does not fit the cache, unless the SVs
+// are wanted for probability estimates or a warm start, or an index
+// below 1 has no place in w; SMO otherwise.
+static bool use_linear_solver(const svm_problem *prob, const svm_parameter *param, const svm_model *warm)
+{
+	if(param->svm_type != C_SVC || param->kernel_type != LINEAR)
+		return false;
+	if(param->linear_solver == SOLVER_DCD_L1 || param->linear_solver == SOLVER_DCD_L2)
+		return true;
+	return param->linear_solver == SOLVER_AUTO && !param->probability && warm == NULL &&
+		(double)prob->l*prob->l*sizeof(Qfloat) > param->cache_size*(1<<20) &&
+		!has_index_below_one(prob);
+}
+
+// the starting point of the pair of classes (label_i,label_j) taken
+// from warm, whose SVs are the first warm->l examples of the training
+// set: |sv_coef| for its SVs, 0 for the rest; NULL if warm does not
+// have both classes or its alpha exceed the bounds Cp, Cn
+static double *warm_alpha(const svm_model *warm, int label_i, int label_j,
+	const int *index, int ci, int cj, double Cp, double Cn)
+{
+	int oi, oj, k;
+	for(oi=0;oi<warm->nr_class;oi++)
+		if(warm->label[oi] == label_i)
+			break;
+	for(oj=0;oj<warm->nr_class;oj++)
+		if(warm->label[oj] == label_j)
+			break;
+	if(oi == warm->nr_class || oj == warm->nr_class)
+		return NULL;
+
+	// SVs of class oi are in [start_i,start_i+nSV[oi]), with their
+	// coefficients for (oi,oj) in sv_coef[oj > oi ? oj-1 : oj]
+	int start_i = 0, start_j = 0;
+	for(k=0;k<oi;k++)
+		start_i += warm->nSV[k];
+	for(k=0;k<oj;k++)
+		start_j += warm->nSV[k];
+	const double *coef_i = warm->sv_coef[oj > oi ? oj-1 : oj];
+	const double *coef_j = warm->sv_coef[oi > oj ? oi-1 : oi];
+
+	double *alpha = Malloc(double,ci+cj);
+	for(k=0;k<ci+cj;k++)
+	{
+		int o = index[k];
+		alpha[k] = 0;
+		if(k < ci && o >= start_i && o < start_i+warm->nSV[oi])
+			alpha[k] = fabs(coef_i[o]);
+		else if(k >= ci && o >= start_j && o < start_j+warm->nSV[oj])
+			alpha[k] = fabs(coef_j[o]);
+		if(alpha[k] > (k < ci ? Cp : Cn))
+		{
+			free(alpha);
+			return NULL;
+		}
+	}
+	return alpha;
+}
+
+// svm_train, with C_SVC warm started from warm if not NULL
+static svm_model *svm_train_warm(const svm_problem *prob, const svm_parameter *param, const svm_model *warm)
+{
+	svm_model *model = Malloc(svm_model,1);
+	model->param = *param;
+	model->free_sv = 0;	// XXX
+	model->mapping = NULL;
+	model->nr_feature = 0;
+	model->w = NULL;
+	model->landmark = NULL;
+	model->phase = NULL;
+	model->omega = NULL;
+	model->omega_dim = 0;
+
+	if(param->svm_type == ONE_CLASS ||
+	   param->svm_type == EPSILON_SVR ||
+	   param->svm_type == NU_SVR)
+	{
+		// regression or one-class-svm
+		model->nr_class = 2;
+		model->label = NULL;
+		model->nSV = NULL;
+		model->probA = NULL; model->probB = NULL;
+		model->sv_coef = Malloc(double *,1);
+
+		if(param->probability && 
+		   (param->svm_type == EPSILON_SVR ||
+		    param->svm_type == NU_SVR))
+		{
+			model->probA = Malloc(double,1);
+			model->probA[0] = svm_svr_probability(prob,param);
+		}
+
+		decision_function f = svm_train_one(prob,param,0,0,NULL,NULL);
+		model->rho = Malloc(double,1);
+		model->rho[0] = f.rho;
 
 		int nSV = 0;
 		int i;
@@ -2152,97 +3966,161 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 		svm_group_classes(prob,&nr_class,&label,&start,&count,perm);
 		if(nr_class == 1) 
 			info("WARNING: training data in only one class. See README for details.\n");
+
+		bool ovr = one_vs_rest(*param,nr_class);
+		int nr_dec = nr_decision(*param,nr_class);
 		
 		svm_node **x = Malloc(svm_node *,l);
 		int i;
 		for(i=0;i<l;i++)
 			x[i] = prob->x[perm[i]];
 
-		// calculate weighted C
+		// linear models keep w instead of SVs
 
-		double *weighted_C = Malloc(double, nr_class);
-		for(i=0;i<nr_class;i++)
-			weighted_C[i] = param->C;
-		for(i=0;i<param->nr_weight;i++)
-		{	
-			int j;
-			for(j=0;j<nr_class;j++)
-				if(param->weight_label[i] == label[j])
-					break;
-			if(j == nr_class)
-				fprintf(stderr,"WARNING: class label %d specified in weight is not found\n", param->weight_label[i]);
-			else
-				weighted_C[j] *= param->weight[i];
+		int nr_feature = 0;
+		double *w = NULL;
+		if(use_linear_solver(prob,param,warm))
+		{
+			for(i=0;i<l;i++)
+				for(const svm_node *px=x[i];px->index!=-1;px++)
+					nr_feature = max(nr_feature,px->index);
+			w = Malloc(double,(size_t)nr_feature*nr_dec);
 		}
 
-		// train k*(k-1)/2 models
+		double *weighted_C = class_weighted_C(param,nr_class,label);
+
+		// train k*(k-1)/2 models, or k for one-vs-rest
 		
 		bool *nonzero = Malloc(bool,l);
 		for(i=0;i<l;i++)
 			nonzero[i] = false;
-		decision_function *f = Malloc(decision_function,nr_class*(nr_class-1)/2);
+		decision_function *f = Malloc(decision_function,nr_dec);
 
 		double *probA=NULL,*probB=NULL;
 		if (param->probability)
 		{
-			probA=Malloc(double,nr_class*(nr_class-1)/2);
-			probB=Malloc(double,nr_class*(nr_class-1)/2);
+			probA=Malloc(double,nr_dec);
+			probB=Malloc(double,nr_dec);
 		}
 
-		int p = 0;
-		for(i=0;i<nr_class;i++)
-			for(int j=i+1;j<nr_class;j++)
+		int p;
+		if(ovr)
+		{
+			// class i against the rest, all on one cache of the kernel
+			// columns of x; the weight of class i applies to C+ only
+			svm_problem sub_prob;
+			sub_prob.l = l;
+			sub_prob.x = x;
+			sub_prob.y = Malloc(double,l);
+			Kernel_Columns *K = w ? NULL : new Kernel_Columns(sub_prob,*param);
+			for(i=0;i<nr_class;i++)
 			{
-				svm_problem sub_prob;
-				int si = start[i], sj = start[j];
-				int ci = count[i], cj = count[j];
-				sub_prob.l = ci+cj;
-				sub_prob.x = Malloc(svm_node *,sub_prob.l);
-				sub_prob.y = Malloc(double,sub_prob.l);
 				int k;
-				for(k=0;k<ci;k++)
+				for(k=0;k<l;k++)
+					sub_prob.y[k] = (k >= start[i] && k < start[i]+count[i]) ? +1 : -1;
+
+				if(param->probability)
+					svm_binary_svc_probability(&sub_prob,param,weighted_C[i],param->C,probA[i],probB[i]);
+
+				if(w)
 				{
-					sub_prob.x[k] = x[si+k];
-					sub_prob.y[k] = +1;
+					sparse_rows rows = {sub_prob.x};
+					f[i].alpha = NULL;
+					f[i].rho = solve_linear_c_svc(l,sub_prob.y,rows,param,
+						w+(size_t)i*nr_feature,nr_feature,weighted_C[i],param->C);
 				}
-				for(k=0;k<cj;k++)
+				else
 				{
-					sub_prob.x[ci+k] = x[sj+k];
-					sub_prob.y[ci+k] = -1;
+					f[i] = svm_train_one(&sub_prob,param,weighted_C[i],param->C,NULL,K);
+					for(k=0;k<l;k++)
+						if(fabs(f[i].alpha[k]) > 0)
+							nonzero[k] = true;
 				}
-
-				if(param->probability)
-					svm_binary_svc_probability(&sub_prob,param,weighted_C[i],weighted_C[j],probA[p],probB[p]);
-
-				f[p] = svm_train_one(&sub_prob,param,weighted_C[i],weighted_C[j]);
-				for(k=0;k<ci;k++)
-					if(!nonzero[si+k] && fabs(f[p].alpha[k]) > 0)
-						nonzero[si+k] = true;
-				for(k=0;k<cj;k++)
-					if(!nonzero[sj+k] && fabs(f[p].alpha[ci+k]) > 0)
-						nonzero[sj+k] = true;
-				free(sub_prob.x);
-				free(sub_prob.y);
-				++p;
 			}
+			delete K;
+			free(sub_prob.y);
+		}
+		else
+		{
+			p = 0;
+			for(i=0;i<nr_class;i++)
+				for(int j=i+1;j<nr_class;j++)
+				{
+					svm_problem sub_prob;
+					int si = start[i], sj = start[j];
+					int ci = count[i], cj = count[j];
+					sub_prob.l = ci+cj;
+					sub_prob.x = Malloc(svm_node *,sub_prob.l);
+					sub_prob.y = Malloc(double,sub_prob.l);
+					int k;
+					for(k=0;k<ci;k++)
+					{
+						sub_prob.x[k] = x[si+k];
+						sub_prob.y[k] = +1;
+					}
+					for(k=0;k<cj;k++)
+					{
+						sub_prob.x[ci+k] = x[sj+k];
+						sub_prob.y[ci+k] = -1;
+					}
 
-		// build output
+					if(param->probability)
+						svm_binary_svc_probability(&sub_prob,param,weighted_C[i],weighted_C[j],probA[p],probB[p]);
 
-		model->nr_class = nr_class;
+					if(w)
+					{
+						sparse_rows rows = {sub_prob.x};
+						f[p].alpha = NULL;
+						f[p].rho = solve_linear_c_svc(sub_prob.l,sub_prob.y,rows,param,
+							w+(size_t)p*nr_feature,nr_feature,weighted_C[i],weighted_C[j]);
+					}
+					else
+					{
+						double *alpha0 = NULL;
+						if(warm)
+						{
+							int *index = Malloc(int,sub_prob.l);
+							for(k=0;k<ci;k++)
+								index[k] = perm[si+k];
+							for(k=0;k<cj;k++)
+								index[ci+k] = perm[sj+k];
+							alpha0 = warm_alpha(warm,label[i],label[j],index,ci,cj,weighted_C[i],weighted_C[j]);
+							free(index);
+						}
+						f[p] = svm_train_one(&sub_prob,param,weighted_C[i],weighted_C[j],alpha0,NULL);
+						free(alpha0);
+						for(k=0;k<ci;k++)
+							if(!nonzero[si+k] && fabs(f[p].alpha[k]) > 0)
+								nonzero[si+k] = true;
+						for(k=0;k<cj;k++)
+							if(!nonzero[sj+k] && fabs(f[p].alpha[ci+k]) > 0)
+								nonzero[sj+k] = true;
+					}
+					free(sub_prob.x);
+					free(sub_prob.y);
+					++p;
+				}
+		}
+
+		// build output
+
+		model->nr_class = nr_class;
+		model->nr_feature = nr_feature;
+		model->w = w;
 		
 		model->label = Malloc(int,nr_class);
 		for(i=0;i<nr_class;i++)
 			model->label[i] = label[i];
 		
-		model->rho = Malloc(double,nr_class*(nr_class-1)/2);
-		for(i=0;i<nr_class*(nr_class-1)/2;i++)
+		model->rho = Malloc(double,nr_dec);
+		for(i=0;i<nr_dec;i++)
 			model->rho[i] = f[i].rho;
 
 		if(param->probability)
 		{
-			model->probA = Malloc(double,nr_class*(nr_class-1)/2);
-			model->probB = Malloc(double,nr_class*(nr_class-1)/2);
-			for(i=0;i<nr_class*(nr_class-1)/2;i++)
+			model->probA = Malloc(double,nr_dec);
+			model->probB = Malloc(double,nr_dec);
+			for(i=0;i<nr_dec;i++)
 			{
 				model->probA[i] = probA[i];
 				model->probB[i] = probB[i];
@@ -2288,34 +4166,49 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 		for(i=1;i<nr_class;i++)
 			nz_start[i] = nz_start[i-1]+nz_count[i-1];
 
-		model->sv_coef = Malloc(double *,nr_class-1);
-		for(i=0;i<nr_class-1;i++)
+		int nr_coef = nr_sv_coef(*param,nr_class);
+		model->sv_coef = Malloc(double *,nr_coef);
+		for(i=0;i<nr_coef;i++)
 			model->sv_coef[i] = Malloc(double,total_sv);
 
-		p = 0;
-		for(i=0;i<nr_class;i++)
-			for(int j=i+1;j<nr_class;j++)
+		if(ovr)
+		{
+			for(i=0;i<nr_class;i++)
 			{
-				// classifier (i,j): coefficients with
-				// i are in sv_coef[j-1][nz_start[i]...],
-				// j are in sv_coef[i][nz_start[j]...]
-
-				int si = start[i];
-				int sj = start[j];
-				int ci = count[i];
-				int cj = count[j];
-				
-				int q = nz_start[i];
-				int k;
-				for(k=0;k<ci;k++)
-					if(nonzero[si+k])
-						model->sv_coef[j-1][q++] = f[p].alpha[k];
-				q = nz_start[j];
-				for(k=0;k<cj;k++)
-					if(nonzero[sj+k])
-						model->sv_coef[i][q++] = f[p].alpha[ci+k];
-				++p;
+				int q = 0;
+				for(int k=0;k<l;k++)
+					if(nonzero[k])
+						model->sv_coef[i][q++] = f[i].alpha[k];
 			}
+		}
+		else
+		{
+			p = 0;
+			for(i=0;i<nr_class;i++)
+				for(int j=i+1;j<nr_class;j++)
+				{
+					// classifier (i,j): coefficients with
+					// i are in sv_coef[j-1][nz_start[i]...],
+					// j are in sv_coef[i][nz_start[j]...]
+
+					int si = start[i];
+					int sj = start[j];
+					int ci = count[i];
+					int cj = count[j];
+				
+					int q = nz_start[i];
+					int k;
+					for(k=0;k<ci;k++)
+						if(nonzero[si+k])
+							model->sv_coef[j-1][q++] = f[p].alpha[k];
+					q = nz_start[j];
+					for(k=0;k<cj;k++)
+						if(nonzero[sj+k])
+							model->sv_coef[i][q++] = f[p].alpha[ci+k];
+					++p;
+				}
+		
+		}
 		
 		free(label);
 		free(probA);
@@ -2326,7 +4219,7 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 		free(x);
 		free(weighted_C);
 		free(nonzero);
-		for(i=0;i<nr_class*(nr_class-1)/2;i++)
+		for(i=0;i<nr_dec;i++)
 			free(f[i].alpha);
 		free(f);
 		free(nz_count);
@@ -2335,6 +4228,108 @@ svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
 	return model;
 }
 
+//
+// Interface functions
+//
+svm_model *svm_train(const svm_problem *prob, const svm_parameter *param)
+{
+	if(param->approx != NO_APPROX)
+		return svm_train_approx(prob,param);
+	return svm_train_warm(prob,param,NULL);
+}
+
+// Train on the SVs of model, the examples of old_prob (the training set
+// of model, may be NULL) that violate the margin of model, and prob.
+// The alpha of model are the starting point of the solver.  sv_indices
+// of the new model are over old_prob followed by prob, or over the SVs
+// of model followed by prob if old_prob is NULL.
+svm_model *svm_train_incremental(const svm_model *model, const svm_problem *prob,
+	const svm_problem *old_prob, const svm_parameter *param)
+{
+	int nr_class = model->nr_class;
+	int i, j, k;
+
+	// examples of class c with y f(x) < 1 for some pair (c,c'), and
+	// all examples of classes unknown to model, except the SVs
+	int nr_violator = 0;
+	int *violator = NULL;
+	if(old_prob)
+	{
+		int old_l = old_prob->l;
+		bool *keep = Malloc(bool,old_l);
+#pragma omp parallel for private(j,k) schedule(guided) num_threads(param->nr_thread) if(param->nr_thread > 1)
+		for(i=0;i<old_l;i++)
+		{
+			double *dec_values = Malloc(double,nr_decision(model->param,nr_class));
+			svm_predict_values(model,old_prob->x[i],dec_values);
+			int c;
+			for(c=0;c<nr_class;c++)
+				if(model->label[c] == (int)old_prob->y[i])
+					break;
+			keep[i] = (c == nr_class);
+			int p = 0;
+			for(j=0;j<nr_class;j++)
+				for(k=j+1;k<nr_class;k++,p++)
+					if((j == c && dec_values[p] < 1) || (k == c && dec_values[p] > -1))
+						keep[i] = true;
+			free(dec_values);
+		}
+		for(i=0;i<model->l;i++)
+			keep[model->sv_indices[i]-1] = false;
+
+		violator = Malloc(int,old_l);
+		for(i=0;i<old_l;i++)
+			if(keep[i])
+				violator[nr_violator++] = i;
+		free(keep);
+	}
+	info("incremental: %d SVs, %d margin violators, %d new examples\n",
+		model->l,nr_violator,prob->l);
+
+	// the SVs of model come first, so that svm_train_warm finds their alpha
+	svm_problem sub_prob;
+	sub_prob.l = model->l+nr_violator+prob->l;
+	sub_prob.x = Malloc(svm_node *,sub_prob.l);
+	sub_prob.y = Malloc(double,sub_prob.l);
+	k = 0;
+	for(i=0;i<nr_class;i++)
+		for(j=0;j<model->nSV[i];j++,k++)
+		{
+			sub_prob.x[k] = model->SV[k];
+			sub_prob.y[k] = model->label[i];
+		}
+	for(i=0;i<nr_violator;i++,k++)
+	{
+		sub_prob.x[k] = old_prob->x[violator[i]];
+		sub_prob.y[k] = old_prob->y[violator[i]];
+	}
+	for(i=0;i<prob->l;i++,k++)
+	{
+		sub_prob.x[k] = prob->x[i];
+		sub_prob.y[k] = prob->y[i];
+	}
+
+	svm_model *ret = svm_train_warm(&sub_prob,param,model);
+
+	// sv_indices over old_prob, or the SVs of model, followed by prob
+	int old_l = old_prob ? old_prob->l : model->l;
+	for(i=0;i<ret->l;i++)
+	{
+		int o = ret->sv_indices[i]-1;
+		if(o < model->l)
+			ret->sv_indices[i] = old_prob ? model->sv_indices[o] : o+1;
+		else if(o < model->l+nr_violator)
+			ret->sv_indices[i] = violator[o-model->l]+1;
+		else
+			ret->sv_indices[i] = old_l+(o-model->l-nr_violator)+1;
+	}
+
+	free(violator);
+	free(sub_prob.x);
+	free(sub_prob.y);
+	return ret;
+}
+
 // Stratified cross validation
 void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, int nr_fold, double *target)
 {
@@ -2368,7 +4363,7 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 		for (c=0; c<nr_class; c++) 
 			for(i=0;i<count[c];i++)
 			{
-				int j = i+rand()%(count[c]-i);
+				int j = i+random_int(count[c]-i);
 				swap(index[start[c]+j],index[start[c]+i]);
 			}
 		for(i=0;i<nr_fold;i++)
@@ -2405,7 +4400,7 @@ void svm_cross_validation(const svm_problem *prob, const svm_parameter *param, i
 		for(i=0;i<l;i++) perm[i]=i;
 		for(i=0;i<l;i++)
 		{
-			int j = i+rand()%(l-i);
+			int j = i+random_int(l-i);
 			swap(perm[i],perm[j]);
 		}
 		for(i=0;i<=nr_fold;i++)
@@ -2467,6 +4462,15 @@ int svm_get_nr_class(const svm_model *model)
 	return model->nr_class;
 }
 
+int svm_get_nr_decision(const svm_model *model)
+{
+	if(model->param.svm_type == ONE_CLASS ||
+	   model->param.svm_type == EPSILON_SVR ||
+	   model->param.svm_type == NU_SVR)
+		return 1;
+	return nr_decision(model->param,model->nr_class);
+}
+
 void svm_get_labels(const svm_model *model, int* label)
 {
 	if (model->label != NULL)
@@ -2498,490 +4502,3178 @@ double svm_get_svr_probability(const svm_model *model)
 	}
 }
 
-double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+// the part of decision function p from w: w'phi, or w'x if phi is NULL;
+// 0 for models without w
+static double linear_decision(const svm_model *model, int p, const double *phi, const svm_node *x)
+{
+	if(model->w == NULL)
+		return 0;
+	const double *w = model->w+(size_t)p*model->nr_feature;
+	if(phi == NULL)
+		return dot_w(w,model->nr_feature,x);
+	double sum = 0;
+	for(int k=0;k<model->nr_feature;k++)
+		sum += w[k]*phi[k];
+	return sum;
+}
+
+static inline void add_coef_terms(const double *coef, const double *kblock,
+	int begin, int end, int bx, double *dec)
+{
+	for(int j=begin;j<end;j++)
+	{
+		double c = coef[j];
+		const double *k = kblock+(size_t)j*bx;
+		for(int r=0;r<bx;r++)
+			dec[r] += c*k[r];
+	}
+}
+
+// add the SV terms of the decision functions of bx rows, sv_coef times
+// their kernel values kblock[l*bx] (SV-major), to dec[nr_decision*bx]
+static void add_sv_terms(const svm_model *model, const double *kblock, int bx, double *dec)
 {
+	int nr_class = model->nr_class;
+	int l = model->l;
 	int i;
+
 	if(model->param.svm_type == ONE_CLASS ||
 	   model->param.svm_type == EPSILON_SVR ||
 	   model->param.svm_type == NU_SVR)
-	{
-		double *sv_coef = model->sv_coef[0];
-		double sum = 0;
-		for(i=0;i<model->l;i++)
-			sum += sv_coef[i] * Kernel::k_function(x,model->SV[i],model->param);
-		sum -= model->rho[0];
-		*dec_values = sum;
-
-		if(model->param.svm_type == ONE_CLASS)
-			return (sum>0)?1:-1;
-		else
-			return sum;
-	}
+		add_coef_terms(model->sv_coef[0],kblock,0,l,bx,dec);
+	else if(one_vs_rest(model->param,nr_class))
+		for(i=0;i<nr_class;i++)
+			add_coef_terms(model->sv_coef[i],kblock,0,l,bx,dec+(size_t)i*bx);
 	else
 	{
-		int nr_class = model->nr_class;
-		int l = model->l;
-		
-		double *kvalue = Malloc(double,l);
-		for(i=0;i<l;i++)
-			kvalue[i] = Kernel::k_function(x,model->SV[i],model->param);
+		// pair (i,j) takes the SVs of classes i and j
+		int si = 0;
+		int p = 0;
+		for(i=0;i<nr_class;i++)
+		{
+			int sj = si+model->nSV[i];
+			for(int j=i+1;j<nr_class;j++,p++)
+			{
+				add_coef_terms(model->sv_coef[j-1],kblock,si,si+model->nSV[i],bx,dec+(size_t)p*bx);
+				add_coef_terms(model->sv_coef[i],kblock,sj,sj+model->nSV[j],bx,dec+(size_t)p*bx);
+				sj += model->nSV[j];
+			}
+			si += model->nSV[i];
+		}
+	}
+}
 
-		int *start = Malloc(int,nr_class);
-		start[0] = 0;
+// the decision values of x from its kernel values with the SVs, and,
+// for models with w, its features phi (NULL: x itself)
+static void decision_values(const svm_model *model, const double *kvalue,
+	const double *phi, const svm_node *x, double *dec_values)
+{
+	int nr_dec = svm_get_nr_decision(model);
+	int p;
+	for(p=0;p<nr_dec;p++)
+		dec_values[p] = linear_decision(model,p,phi,x);
+	add_sv_terms(model,kvalue,1,dec_values);
+	for(p=0;p<nr_dec;p++)
+		dec_values[p] -= model->rho[p];
+}
+
+static double decision_label(const svm_model *model, const double *dec_values, int *vote)
+{
+	int nr_class = model->nr_class;
+	int i;
+
+	if(model->param.svm_type == ONE_CLASS)
+		return (dec_values[0]>0)?1:-1;
+	if(model->param.svm_type == EPSILON_SVR ||
+	   model->param.svm_type == NU_SVR)
+		return dec_values[0];
+
+	if(one_vs_rest(model->param,nr_class))
+	{
+		int dec_max_idx = 0;
 		for(i=1;i<nr_class;i++)
-			start[i] = start[i-1]+model->nSV[i-1];
+			if(dec_values[i] > dec_values[dec_max_idx])
+				dec_max_idx = i;
+		return model->label[dec_max_idx];
+	}
 
-		int *vote = Malloc(int,nr_class);
-		for(i=0;i<nr_class;i++)
-			vote[i] = 0;
+	for(i=0;i<nr_class;i++)
+		vote[i] = 0;
+	int p=0;
+	for(i=0;i<nr_class;i++)
+		for(int j=i+1;j<nr_class;j++)
+		{
+			if(dec_values[p] > 0)
+				++vote[i];
+			else
+				++vote[j];
+			p++;
+		}
+
+	int vote_max_idx = 0;
+	for(i=1;i<nr_class;i++)
+		if(vote[i] > vote[vote_max_idx])
+			vote_max_idx = i;
+	return model->label[vote_max_idx];
+}
+
+// workspace of probability_block for blocks of bx instances
+static size_t probability_work_size(int nr_class, int bx)
+{
+	return (size_t)(2*nr_class*nr_class+2*nr_class+3)*bx;
+}
+
+// the class probabilities (prob_estimates[b*nr_class+t]) and the most
+// probable labels of bx instances from their decision values
+// (dec_values[b*nr_decision+p]), for a classification model with probA
+// and probB; work holds probability_work_size(nr_class,bx) doubles
+static void probability_block(const svm_model *model, int bx,
+	const double *dec_values, double *prob_estimates, double *labels, double *work)
+{
+	int nr_class = model->nr_class;
+	int nr_dec = nr_decision(model->param,nr_class);
+	int i, j, b;
+	double *r = work;			// r[(i*nr_class+j)*bx+b]
+	double *p = r+(size_t)nr_class*nr_class*bx;	// p[i*bx+b]
+
+	// the sigmoids 1/(1+exp(fApB)) of all decision values, from
+	// exp(-|fApB|) for either sign of fApB to avoid overflow and
+	// cancellation
+	for(int q=0;q<nr_dec;q++)
+	{
+		double A = model->probA[q], B = model->probB[q];
+		double *s = p+(size_t)q*bx;
+		if(!one_vs_rest(model->param,nr_class))
+			s = r+(size_t)q*bx;
+		for(b=0;b<bx;b++)
+		{
+			double fApB = dec_values[(size_t)b*nr_dec+q]*A+B;
+			double e = exp(-fabs(fApB));
+			s[b] = (fApB >= 0 ? e : 1.0)/(1.0+e);
+		}
+	}
 
-		int p=0;
+	if(one_vs_rest(model->param,nr_class))
+	{
+		// the sigmoids of the k decision values, normalized
+		double *sum = r;
+		for(b=0;b<bx;b++)
+			sum[b] = 0;
 		for(i=0;i<nr_class;i++)
-			for(int j=i+1;j<nr_class;j++)
+			for(b=0;b<bx;b++)
+				sum[b] += p[i*bx+b];
+		for(i=0;i<nr_class;i++)
+			for(b=0;b<bx;b++)
+				p[i*bx+b] /= sum[b];
+	}
+	else
+	{
+		// spread the sigmoids of the pairs, stored in the first
+		// nr_dec rows of r, over the pairwise matrix, last one first
+		double min_prob=1e-7;
+		int q = nr_dec;
+		for(i=nr_class-1;i>=0;i--)
+			for(j=nr_class-1;j>i;j--)
 			{
-				double sum = 0;
-				int si = start[i];
-				int sj = start[j];
-				int ci = model->nSV[i];
-				int cj = model->nSV[j];
-				
-				int k;
-				double *coef1 = model->sv_coef[j-1];
-				double *coef2 = model->sv_coef[i];
-				for(k=0;k<ci;k++)
-					sum += coef1[si+k] * kvalue[si+k];
-				for(k=0;k<cj;k++)
-					sum += coef2[sj+k] * kvalue[sj+k];
-				sum -= model->rho[p];
-				dec_values[p] = sum;
-
-				if(dec_values[p] > 0)
-					++vote[i];
-				else
-					++vote[j];
-				p++;
+				q--;
+				double *rij = r+((size_t)i*nr_class+j)*bx;
+				double *rji = r+((size_t)j*nr_class+i)*bx;
+				const double *s = r+(size_t)q*bx;
+				for(b=0;b<bx;b++)
+				{
+					rij[b] = min(max(s[b],min_prob),1-min_prob);
+					rji[b] = 1-rij[b];
+				}
 			}
+		multiclass_probability(nr_class,bx,r,p,p+(size_t)nr_class*bx);
+	}
 
-		int vote_max_idx = 0;
-		for(i=1;i<nr_class;i++)
-			if(vote[i] > vote[vote_max_idx])
-				vote_max_idx = i;
+	for(b=0;b<bx;b++)
+	{
+		int prob_max_idx = 0;
+		for(i=0;i<nr_class;i++)
+		{
+			prob_estimates[(size_t)b*nr_class+i] = p[i*bx+b];
+			if(p[i*bx+b] > p[prob_max_idx*bx+b])
+				prob_max_idx = i;
+		}
+		labels[b] = model->label[prob_max_idx];
+	}
+}
 
-		free(kvalue);
-		free(start);
-		free(vote);
-		return model->label[vote_max_idx];
+double svm_predict_values(const svm_model *model, const svm_node *x, double* dec_values)
+{
+	int l = model->l;
+	double *kvalue = Malloc(double,l);
+	for(int i=0;i<l;i++)
+		kvalue[i] = Kernel::k_function(x,model->SV[i],model->param);
+
+	double *phi = NULL;
+	if(model->param.approx != NO_APPROX)
+	{
+		phi = Malloc(double,approx_size(model));
+		approx_features(model,x,phi);
 	}
+
+	int *vote = Malloc(int,model->nr_class);
+	decision_values(model,kvalue,phi,x,dec_values);
+	double label = decision_label(model,dec_values,vote);
+	free(kvalue);
+	free(phi);
+	free(vote);
+	return label;
 }
 
 double svm_predict(const svm_model *model, const svm_node *x)
 {
-	int nr_class = model->nr_class;
-	double *dec_values;
-	if(model->param.svm_type == ONE_CLASS ||
-	   model->param.svm_type == EPSILON_SVR ||
-	   model->param.svm_type == NU_SVR)
-		dec_values = Malloc(double, 1);
-	else 
-		dec_values = Malloc(double, nr_class*(nr_class-1)/2);
+	double *dec_values = Malloc(double, svm_get_nr_decision(model));
 	double pred_result = svm_predict_values(model, x, dec_values);
 	free(dec_values);
 	return pred_result;
 }
 
+// DAG-SVM (Platt, Cristianini and Shawe-Taylor, NIPS 2000): the first
+// and the last remaining class are compared and the loser is removed,
+// so a one-vs-one model evaluates k-1 of its k(k-1)/2 decision
+// functions.  Kernel values are computed only for the SVs of classes
+// that take part in a comparison, each class at most once.
+double svm_predict_dag(const svm_model *model, const svm_node *x)
+{
+	int nr_class = model->nr_class;
+	int l = model->l;
+	int i, k;
+
+	if((model->param.svm_type != C_SVC && model->param.svm_type != NU_SVC) ||
+	   one_vs_rest(model->param,nr_class))
+		return svm_predict(model,x);
+
+	int *start = Malloc(int,nr_class);
+	start[0] = 0;
+	for(i=1;i<nr_class;i++)
+		start[i] = start[i-1]+model->nSV[i-1];
+	bool *done = Malloc(bool,nr_class);
+	for(i=0;i<nr_class;i++)
+		done[i] = false;
+	double *kvalue = Malloc(double,l);
+	double *phi = NULL;
+	if(model->param.approx != NO_APPROX)
+	{
+		phi = Malloc(double,approx_size(model));
+		approx_features(model,x,phi);
+	}
+
+	int lo = 0, hi = nr_class-1;
+	while(lo < hi)
+	{
+		int c[2] = {lo, hi};
+		for(int t=0;t<2;t++)
+			if(!done[c[t]])
+			{
+				for(k=start[c[t]];k<start[c[t]]+model->nSV[c[t]];k++)
+					kvalue[k] = Kernel::k_function(x,model->SV[k],model->param);
+				done[c[t]] = true;
+			}
+
+		// decision function (lo,hi), as in decision_values
+		int p = lo*nr_class-lo*(lo+1)/2+hi-lo-1;
+		int si = start[lo], sj = start[hi];
+		double *coef1 = model->sv_coef[hi-1];
+		double *coef2 = model->sv_coef[lo];
+		double sum = 0;
+		if(phi)
+		{
+			const double *w = model->w+(size_t)p*model->nr_feature;
+			for(k=0;k<model->nr_feature;k++)
+				sum += w[k]*phi[k];
+		}
+		else if(model->w)
+			sum = dot_w(model->w+(size_t)p*model->nr_feature,model->nr_feature,x);
+		for(k=0;k<model->nSV[lo];k++)
+			sum += coef1[si+k] * kvalue[si+k];
+		for(k=0;k<model->nSV[hi];k++)
+			sum += coef2[sj+k] * kvalue[sj+k];
+		sum -= model->rho[p];
+
+		if(sum > 0)
+			--hi;
+		else
+			++lo;
+	}
+
+	free(start);
+	free(done);
+	free(kvalue);
+	free(phi);
+	return model->label[lo];
+}
+
 double svm_predict_probability(
 	const svm_model *model, const svm_node *x, double *prob_estimates)
 {
 	if ((model->param.svm_type == C_SVC || model->param.svm_type == NU_SVC) &&
 	    model->probA!=NULL && model->probB!=NULL)
 	{
-		int i;
-		int nr_class = model->nr_class;
-		double *dec_values = Malloc(double, nr_class*(nr_class-1)/2);
+		double *dec_values = Malloc(double, svm_get_nr_decision(model));
+		double *work = Malloc(double, probability_work_size(model->nr_class,1));
+		double label;
 		svm_predict_values(model, x, dec_values);
-
-		double min_prob=1e-7;
-		double **pairwise_prob=Malloc(double *,nr_class);
-		for(i=0;i<nr_class;i++)
-			pairwise_prob[i]=Malloc(double,nr_class);
-		int k=0;
-		for(i=0;i<nr_class;i++)
-			for(int j=i+1;j<nr_class;j++)
-			{
-				pairwise_prob[i][j]=min(max(sigmoid_predict(dec_values[k],model->probA[k],model->probB[k]),min_prob),1-min_prob);
-				pairwise_prob[j][i]=1-pairwise_prob[i][j];
-				k++;
-			}
-		multiclass_probability(nr_class,pairwise_prob,prob_estimates);
-
-		int prob_max_idx = 0;
-		for(i=1;i<nr_class;i++)
-			if(prob_estimates[i] > prob_estimates[prob_max_idx])
-				prob_max_idx = i;
-		for(i=0;i<nr_class;i++)
-			free(pairwise_prob[i]);
+		probability_block(model, 1, dec_values, prob_estimates, &label, work);
 		free(dec_values);
-		free(pairwise_prob);
-		return model->label[prob_max_idx];
+		free(work);
+		return label;
 	}
 	else 
 		return svm_predict(model, x);
 }
 
-static const char *svm_type_table[] =
+//
+// Batch prediction
+//
+// Rows are processed in blocks: a block is expanded into a dense,
+// feature-major array so that each SV is streamed once per block and
+// its kernel values with all rows of the block are accumulated in
+// vector loops.  The decision functions then combine the n x l kernel
+// block with sv_coef.  Blocks are distributed over nr_thread threads.
+//
+#define PREDICT_BLOCK 64
+
+// the kernel values of the rows of a block with SV[j], from their dot
+// products (or, for INTERSECTION, the kernel values themselves less the
+// parts that only depend on the rows)
+static void kernel_from_dot(const svm_parameter& param, double sv_aux,
+	const double *x_aux, double *k, int bx)
 {
-	"c_svc","nu_svc","one_class","epsilon_svr","nu_svr",NULL
-};
+	int r;
+	switch(param.kernel_type)
+	{
+		case LINEAR:
+			break;
+		case POLY:
+			for(r=0;r<bx;r++)
+				k[r] = powi(param.gamma*k[r]+param.coef0,param.degree);
+			break;
+		case RBF:
+			for(r=0;r<bx;r++)
+				k[r] = exp(-param.gamma*max(x_aux[r]+sv_aux-2*k[r],0.0));
+			break;
+		case SIGMOID:
+			for(r=0;r<bx;r++)
+				k[r] = tanh(param.gamma*k[r]+param.coef0);
+			break;
+		case INTERSECTION:
+			for(r=0;r<bx;r++)
+				k[r] += x_aux[r];
+			break;
+	}
+}
 
-static const char *kernel_type_table[]=
+// per-thread workspace of svm_predict_batch
+struct predict_workspace
 {
-	"linear","polynomial","rbf","sigmoid","precomputed",NULL
+	double *xt;		// the block, dense and feature-major (xt[dim*block])
+	double *x_aux;		// x_aux[block]
+	double *kblock;		// kernel values with the SVs (kblock[l*block])
+	double *phi;		// the features of one row for approximate models
+	double *dec_t;		// decision values, decision-major (dec_t[nr_decision*block])
+	double *dec;		// decision values of the block (dec[block*nr_decision])
+	int *vote;		// vote[nr_class]
+	double *labels;		// labels[block]
+	double *prob_work;	// for probability_block
 };
 
-int svm_save_model(const char *model_file_name, const svm_model *model)
+// predicted labels, decision values and probabilities of rows
+// [begin,end) of x
+static void predict_block(const svm_model *model, svm_node * const *x,
+	int begin, int end, bool dense, int dim, const double *sv_aux, predict_workspace& ws,
+	double *predicted_labels, double *dec_out, double *prob_estimates)
 {
-	FILE *fp = fopen(model_file_name,"w");
-	if(fp==NULL) return -1;
-
-	char *old_locale = strdup(setlocale(LC_ALL, NULL));
-	setlocale(LC_ALL, "C");
-
+	double *xt = ws.xt;
+	double *x_aux = ws.x_aux;
+	double *kblock = ws.kblock;
 	const svm_parameter& param = model->param;
+	int l = model->l;
+	int bx = end-begin;
+	int nr_dec = svm_get_nr_decision(model);
+	int r, j;
+	const svm_node *p;
 
-	fprintf(fp,"svm_type %s\n", svm_type_table[param.svm_type]);
-	fprintf(fp,"kernel_type %s\n", kernel_type_table[param.kernel_type]);
+	if(l > 0 && dense)
+	{
+		for(r=0;r<bx;r++)
+		{
+			double aux = 0;
+			for(p=x[begin+r];p->index!=-1;p++)
+			{
+				if(p->index >= 1 && p->index <= dim)
+					xt[(size_t)(p->index-1)*bx+r] = p->value;
+				if(param.kernel_type == RBF)
+					aux += p->value*p->value;
+				else if(param.kernel_type == INTERSECTION)
+					aux += min(p->value,0.0);
+			}
+			x_aux[r] = aux;
+		}
 
-	if(param.kernel_type == POLY)
-		fprintf(fp,"degree %d\n", param.degree);
+		for(j=0;j<l;j++)
+		{
+			double *k = kblock+(size_t)j*bx;
+			for(r=0;r<bx;r++)
+				k[r] = 0;
+			for(p=model->SV[j];p->index!=-1;p++)
+			{
+				const double *xc = xt+(size_t)(p->index-1)*bx;
+				double v = p->value;
+				if(param.kernel_type == INTERSECTION)
+					for(r=0;r<bx;r++)
+						k[r] += min(xc[r],v)-min(xc[r],0.0);
+				else
+					for(r=0;r<bx;r++)
+						k[r] += v*xc[r];
+			}
+			kernel_from_dot(param,sv_aux[j],x_aux,k,bx);
+		}
 
-	if(param.kernel_type == POLY || param.kernel_type == RBF || param.kernel_type == SIGMOID)
-		fprintf(fp,"gamma %g\n", param.gamma);
+		// clear only what was set, for the next block
+		for(r=0;r<bx;r++)
+			for(p=x[begin+r];p->index!=-1;p++)
+				if(p->index >= 1 && p->index <= dim)
+					xt[(size_t)(p->index-1)*bx+r] = 0;
+	}
+	else
+		for(j=0;j<l;j++)
+			for(r=0;r<bx;r++)
+				kblock[(size_t)j*bx+r] = Kernel::k_function(x[begin+r],model->SV[j],param);
+
+	// the decision functions of the block as one product, sv_coef times
+	// kblock, on top of the parts from w
+	double *dec_t = ws.dec_t;
+	for(r=0;r<bx;r++)
+	{
+		double *phi = NULL;
+		if(param.approx != NO_APPROX)
+		{
+			phi = ws.phi;
+			approx_features(model,x[begin+r],phi);
+		}
+		for(j=0;j<nr_dec;j++)
+			dec_t[(size_t)j*bx+r] = linear_decision(model,j,phi,x[begin+r]);
+	}
+	add_sv_terms(model,kblock,bx,dec_t);
 
-	if(param.kernel_type == POLY || param.kernel_type == SIGMOID)
-		fprintf(fp,"coef0 %g\n", param.coef0);
+	for(r=0;r<bx;r++)
+	{
+		int i = begin+r;
+		double *dec = dec_out ? dec_out+(size_t)i*nr_dec : ws.dec+(size_t)r*nr_dec;
+		for(j=0;j<nr_dec;j++)
+			dec[j] = dec_t[(size_t)j*bx+r]-model->rho[j];
+		if(!prob_estimates && predicted_labels)
+			predicted_labels[i] = decision_label(model,dec,ws.vote);
+	}
 
-	int nr_class = model->nr_class;
+	if(prob_estimates)
+	{
+		probability_block(model,bx,dec_out ? dec_out+(size_t)begin*nr_dec : ws.dec,
+			prob_estimates+(size_t)begin*model->nr_class,ws.labels,ws.prob_work);
+		if(predicted_labels)
+			for(r=0;r<bx;r++)
+				predicted_labels[begin+r] = ws.labels[r];
+	}
+}
+
+void svm_predict_batch(const svm_model *model, svm_node * const *x, int n,
+	int nr_thread, double *predicted_labels, double *dec_values, double *prob_estimates)
+{
+	const svm_parameter& param = model->param;
 	int l = model->l;
-	fprintf(fp, "nr_class %d\n", nr_class);
-	fprintf(fp, "total_sv %d\n",l);
-	
+	int nr_dec = svm_get_nr_decision(model);
+	int dim = 0;
+	int i;
+	const svm_node *p;
+
+	if(prob_estimates &&
+	   ((param.svm_type != C_SVC && param.svm_type != NU_SVC) ||
+	    model->probA == NULL || model->probB == NULL))
+		prob_estimates = NULL;
+
+	// squared norms of the SVs and the dimension of the dense blocks;
+	// SVs with an index below 1 take Kernel::k_function instead
+	bool dense = param.kernel_type != PRECOMPUTED;
+	double *sv_aux = Malloc(double,l);
+	for(i=0;i<l;i++)
 	{
-		fprintf(fp, "rho");
-		for(int i=0;i<nr_class*(nr_class-1)/2;i++)
-			fprintf(fp," %g",model->rho[i]);
-		fprintf(fp, "\n");
+		double aux = 0;
+		if(param.kernel_type != PRECOMPUTED)
+			for(p=model->SV[i];p->index!=-1;p++)
+			{
+				if(p->index < 1)
+					dense = false;
+				dim = max(dim,p->index);
+				aux += p->value*p->value;
+			}
+		sv_aux[i] = aux;
 	}
-	
-	if(model->label)
+	if(!dense)
+		dim = 0;
+
+	// blocks of rows whose dense copy stays within about 2MB
+	int block = PREDICT_BLOCK;
+	if(dim > 0)
+		block = max(1,min(block,(1<<18)/dim));
+	int nr_block = (n+block-1)/block;
+	int nr_phi = approx_size(model);
+
+	svm_context *ctx = thread_context;
+#pragma omp parallel private(i) num_threads(nr_thread) if(nr_thread > 1)
 	{
-		fprintf(fp, "label");
-		for(int i=0;i<nr_class;i++)
-			fprintf(fp," %d",model->label[i]);
-		fprintf(fp, "\n");
+		// the workers log to the context of the caller
+		svm_context *old_ctx = svm_set_thread_context(ctx);
+		predict_workspace ws;
+		ws.xt = Malloc(double,(size_t)dim*block);
+		ws.x_aux = Malloc(double,block);
+		ws.kblock = Malloc(double,(size_t)l*block);
+		ws.phi = Malloc(double,nr_phi);
+		ws.dec_t = Malloc(double,(size_t)nr_dec*block);
+		ws.dec = Malloc(double,(size_t)nr_dec*block);
+		ws.vote = Malloc(int,model->nr_class);
+		ws.labels = Malloc(double,block);
+		ws.prob_work = NULL;
+		if(prob_estimates)
+			ws.prob_work = Malloc(double,probability_work_size(model->nr_class,block));
+		for(size_t t=0;t<(size_t)dim*block;t++)
+			ws.xt[t] = 0;
+
+#pragma omp for schedule(dynamic)
+		for(i=0;i<nr_block;i++)
+		{
+			int begin = i*block;
+			predict_block(model,x,begin,min(n,begin+block),dense,dim,sv_aux,
+				ws,predicted_labels,dec_values,prob_estimates);
+		}
+
+		free(ws.xt);
+		free(ws.x_aux);
+		free(ws.kblock);
+		free(ws.phi);
+		free(ws.dec_t);
+		free(ws.dec);
+		free(ws.vote);
+		free(ws.labels);
+		free(ws.prob_work);
+		svm_set_thread_context(old_ctx);
 	}
+	free(sv_aux);
+}
 
-	if(model->probA) // regression has probA only
+//
+// Quantized SV values, see svm_compile_model_quantized and
+// svm_save_model_binary_quantized.  SV_FP16 keeps each value as a half
+// float.  SV_UINT8 and SV_UINT16 keep q with value = lo[d]+step[d]*q in
+// dimension d, on a grid that contains 0 so that absent features stay
+// exactly 0.
+//
+static unsigned short float_to_half(float f)
+{
+	unsigned int x, h, rem;
+	memcpy(&x,&f,sizeof(x));
+	unsigned int sign = (x>>16)&0x8000;
+	unsigned int mant = x&0x7fffff;
+	int e = (int)((x>>23)&0xff);
+	if(e == 0xff)
+		return (unsigned short)(sign|0x7c00|(mant ? 0x200 : 0));	// inf, nan
+	e += 15-127;
+	if(e >= 0x1f)
+		return (unsigned short)(sign|0x7c00);
+	if(e <= 0)
 	{
-		fprintf(fp, "probA");
-		for(int i=0;i<nr_class*(nr_class-1)/2;i++)
-			fprintf(fp," %g",model->probA[i]);
-		fprintf(fp, "\n");
+		// subnormal or zero
+		if(e < -10)
+			return (unsigned short)sign;
+		int shift = 14-e;
+		mant |= 0x800000;
+		h = mant>>shift;
+		rem = mant&((1u<<shift)-1);
+		if(rem > (1u<<(shift-1)) || (rem == (1u<<(shift-1)) && (h&1)))
+			h++;
+		return (unsigned short)(sign|h);
 	}
-	if(model->probB)
+	// round to nearest even; a carry moves into the exponent
+	h = ((unsigned int)e<<10)|(mant>>13);
+	rem = mant&0x1fff;
+	if(rem > 0x1000 || (rem == 0x1000 && (h&1)))
+		h++;
+	return (unsigned short)(sign|h);
+}
+
+static inline float half_to_float(unsigned short h)
+{
+	unsigned int sign = (unsigned int)(h&0x8000)<<16;
+	unsigned int e = (h>>10)&0x1f, mant = h&0x3ff, x;
+	if(e == 0x1f)
+		x = sign|0x7f800000|(mant<<13);
+	else if(e != 0)
+		x = sign|((e+112)<<23)|(mant<<13);
+	else if(mant == 0)
+		x = sign;
+	else
 	{
-		fprintf(fp, "probB");
-		for(int i=0;i<nr_class*(nr_class-1)/2;i++)
-			fprintf(fp," %g",model->probB[i]);
-		fprintf(fp, "\n");
+		// subnormal
+		for(e=113;!(mant&0x400);e--)
+			mant <<= 1;
+		x = sign|(e<<23)|((mant&0x3ff)<<13);
 	}
+	float f;
+	memcpy(&f,&x,sizeof(f));
+	return f;
+}
 
-	if(model->nSV)
+static int quantized_size(int quantization)
+{
+	switch(quantization)
 	{
-		fprintf(fp, "nr_sv");
-		for(int i=0;i<nr_class;i++)
-			fprintf(fp," %d",model->nSV[i]);
-		fprintf(fp, "\n");
+		case SV_FP16: case SV_UINT16: return 2;
+		case SV_UINT8: return 1;
+		default: return sizeof(double);
 	}
+}
 
-	fprintf(fp, "SV\n");
-	const double * const *sv_coef = model->sv_coef;
-	const svm_node * const *SV = model->SV;
+static inline unsigned int quantized_max(int quantization)
+{
+	return quantization == SV_UINT8 ? 255 : 65535;
+}
+
+// the grid of SV_UINT8/SV_UINT16 in dimensions 1..dim; all SV indices
+// must be >= 1
+static void quantize_grid(const svm_model *model, int dim, int quantization, double *lo, double *step)
+{
+	double *hi = Malloc(double,dim);
+	int i, k;
+	for(k=0;k<dim;k++)
+		lo[k] = hi[k] = 0;
+	for(i=0;i<model->l;i++)
+		for(const svm_node *p=model->SV[i];p->index!=-1;p++)
+		{
+			lo[p->index-1] = min(lo[p->index-1],p->value);
+			hi[p->index-1] = max(hi[p->index-1],p->value);
+		}
+	// 0 on the grid: lo is moved down by at most one step, which
+	// max-1 steps leave room for
+	double nr_step = quantized_max(quantization)-1;
+	for(k=0;k<dim;k++)
+	{
+		step[k] = hi[k] > lo[k] ? (hi[k]-lo[k])/nr_step : 1;
+		lo[k] = -ceil(-lo[k]/step[k])*step[k];
+	}
+	free(hi);
+}
 
+static inline unsigned int quantize(double v, double lo, double step, unsigned int max_q)
+{
+	double q = floor((v-lo)/step+0.5);
+	return q <= 0 ? 0 : q >= max_q ? max_q : (unsigned int)q;
+}
+
+static double dequantize(const void *q, size_t i, int quantization, double lo, double step)
+{
+	switch(quantization)
+	{
+		case SV_FP16: return half_to_float(((const unsigned short *)q)[i]);
+		case SV_UINT8: return lo+step*((const unsigned char *)q)[i];
+		case SV_UINT16: return lo+step*((const unsigned short *)q)[i];
+		default: return ((const double *)q)[i];
+	}
+}
+
+// kvalue[i] = c + sum_k step[k]*min(t[k],q[i][k]) for INTERSECTION,
+// c + sum_k t[k]*q[i][k] otherwise
+template <class T> static void grid_rows(const T *q, int l, int dim, const double *t,
+	const double *step, double c, bool intersection, double *kvalue)
+{
 	for(int i=0;i<l;i++)
 	{
-		for(int j=0;j<nr_class-1;j++)
-			fprintf(fp, "%.16g ",sv_coef[j][i]);
+		const T *row = q+(size_t)i*dim;
+		double sum = 0;
+		if(intersection)
+			for(int k=0;k<dim;k++)
+				sum += step[k]*min(t[k],(double)row[k]);
+		else
+			for(int k=0;k<dim;k++)
+				sum += t[k]*row[k];
+		kvalue[i] = c+sum;
+	}
+}
 
-		const svm_node *p = SV[i];
+// kvalue[i] = sum_k min(xd[k],q[i][k]) for INTERSECTION, sum_k
+// xd[k]*q[i][k] otherwise.  With __F16C__ (e.g. -mf16c) eight halves
+// are decoded at a time; half_to_float handles the rest.
+static void half_rows(const unsigned short *q, int l, int dim, const double *xd,
+	bool intersection, double *kvalue)
+{
+	for(int i=0;i<l;i++)
+	{
+		const unsigned short *row = q+(size_t)i*dim;
+		double sum = 0;
+		int k = 0;
+#if defined(__F16C__) && defined(__AVX__)
+		__m256d vsum = _mm256_setzero_pd();
+		for(;k+8<=dim;k+=8)
+		{
+			__m256 h = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(row+k)));
+			__m256d h1 = _mm256_cvtps_pd(_mm256_castps256_ps128(h));
+			__m256d h2 = _mm256_cvtps_pd(_mm256_extractf128_ps(h,1));
+			__m256d x1 = _mm256_loadu_pd(xd+k), x2 = _mm256_loadu_pd(xd+k+4);
+			if(intersection)
+				vsum = _mm256_add_pd(vsum,_mm256_add_pd(_mm256_min_pd(x1,h1),_mm256_min_pd(x2,h2)));
+			else
+				vsum = _mm256_add_pd(vsum,_mm256_add_pd(_mm256_mul_pd(x1,h1),_mm256_mul_pd(x2,h2)));
+		}
+		double s[4];
+		_mm256_storeu_pd(s,vsum);
+		sum = (s[0]+s[1])+(s[2]+s[3]);
+#endif
+		if(intersection)
+			for(;k<dim;k++)
+				sum += min(xd[k],(double)half_to_float(row[k]));
+		else
+			for(;k<dim;k++)
+				sum += xd[k]*half_to_float(row[k]);
+		kvalue[i] = sum;
+	}
+}
 
-		if(param.kernel_type == PRECOMPUTED)
-			fprintf(fp,"0:%d ",(int)(p->value));
+//
+// Compiled models
+//
+// svm_compile_model lays out what prediction needs in one contiguous
+// block: the SVs as rows of a dense matrix, their squared norms, the
+// coefficients of every SV in every decision function as an
+// nr_decision x l matrix, and nr_thread workspaces.  All arrays start
+// on 64-byte boundaries.  Prediction with workspace t, 0 <= t <
+// nr_thread, then makes no heap allocation; calls running at the same
+// time must use different workspaces.  The model must outlive its
+// compiled form.  If an SV has an index below 1, the SVs are not
+// expanded and kernels are computed from model->SV.
+// svm_compile_model_quantized keeps the dense SVs quantized instead,
+// and kernels use them without expanding them.
+//
+#define COMPILED_ALIGN 8	// in doubles
+
+struct svm_compiled_model
+{
+	const svm_model *model;
+	int l;
+	int dim;		/* number of columns of SV */
+	int nr_decision;
+	int nr_thread;
+	int quantization;
+	bool dense;		/* false: kernels by k_function on model->SV */
+	double *SV;		/* dense SVs (SV[l*dim]) */
+	void *qSV;		/* or quantized, with the grid lo[dim] and step[dim] */
+	double *lo, *step;
+	double *sv_norm;	/* squared norms of the SVs (sv_norm[l]) */
+	double *coef;		/* coef[p*l+k]: coefficient of SV k in decision function p */
+	double *work;		/* nr_thread workspaces of work_size doubles */
+	size_t work_size;
+	void *mem;
+};
+
+static size_t compiled_round(size_t n)
+{
+	return (n+COMPILED_ALIGN-1)/COMPILED_ALIGN*COMPILED_ALIGN;
+}
+
+svm_compiled_model *svm_compile_model(const svm_model *model, int nr_thread)
+{
+	return svm_compile_model_quantized(model,nr_thread,SV_DOUBLE);
+}
+
+svm_compiled_model *svm_compile_model_quantized(const svm_model *model, int nr_thread, int quantization)
+{
+	const svm_parameter& param = model->param;
+	int l = model->l;
+	int nr_class = model->nr_class;
+	int nr_dec = svm_get_nr_decision(model);
+	int dim = 0, min_index = 1;
+	int i, j, k;
+	const svm_node *p;
+
+	if(nr_thread < 1)
+		nr_thread = 1;
+	if(param.kernel_type != PRECOMPUTED)
+		for(i=0;i<l;i++)
+			for(p=model->SV[i];p->index!=-1;p++)
+			{
+				dim = max(dim,p->index);
+				min_index = min(min_index,p->index);
+			}
+	// SVs with indices below 1 have no dense column
+	bool dense = param.kernel_type != PRECOMPUTED && min_index >= 1;
+	if(!dense)
+		dim = 0;
+	if(!dense || l == 0 ||
+	   quantization < SV_DOUBLE || quantization > SV_UINT16)
+		quantization = SV_DOUBLE;
+	bool grid = quantization == SV_UINT8 || quantization == SV_UINT16;
+
+	// workspace: dense x, x scaled to the grid, kernel values,
+	// features, decision values, votes
+	int nr_phi = approx_size(model);
+	size_t work_size = compiled_round(dim)+(grid ? compiled_round(dim) : 0)+compiled_round(l)+
+		compiled_round(nr_phi)+compiled_round(nr_dec)+
+		compiled_round((nr_class*sizeof(int)+sizeof(double)-1)/sizeof(double));
+	size_t sv_size = compiled_round(((size_t)l*dim*quantized_size(quantization)+sizeof(double)-1)/sizeof(double));
+	size_t grid_size = grid ? 2*compiled_round(dim) : 0;
+	size_t norm_size = compiled_round(l);
+	size_t coef_size = compiled_round((size_t)nr_dec*l);
+	size_t total = sv_size+grid_size+norm_size+coef_size+work_size*nr_thread;
+
+	svm_compiled_model *cm = Malloc(svm_compiled_model,1);
+	cm->mem = malloc((total+COMPILED_ALIGN)*sizeof(double));
+	double *base = (double *)(((size_t)cm->mem+COMPILED_ALIGN*sizeof(double)-1)/
+		(COMPILED_ALIGN*sizeof(double))*(COMPILED_ALIGN*sizeof(double)));
+	cm->model = model;
+	cm->l = l;
+	cm->dim = dim;
+	cm->nr_decision = nr_dec;
+	cm->nr_thread = nr_thread;
+	cm->quantization = quantization;
+	cm->dense = dense;
+	cm->SV = quantization == SV_DOUBLE ? base : NULL;
+	cm->qSV = base;
+	cm->lo = grid ? base+sv_size : NULL;
+	cm->step = grid ? cm->lo+compiled_round(dim) : NULL;
+	cm->sv_norm = base+sv_size+grid_size;
+	cm->coef = cm->sv_norm+norm_size;
+	cm->work = cm->coef+coef_size;
+	cm->work_size = work_size;
+	memset(base,0,total*sizeof(double));
+
+	if(grid)
+		quantize_grid(model,dim,quantization,cm->lo,cm->step);
+	unsigned int max_q = quantized_max(quantization);
+	for(i=0;i<l;i++)
+	{
+		size_t row = (size_t)i*dim;
+		double norm = 0;
+		if(dense)
+		{
+			if(grid)
+				for(k=0;k<dim;k++)
+				{
+					unsigned int q = quantize(0,cm->lo[k],cm->step[k],max_q);
+					if(quantization == SV_UINT8)
+						((unsigned char *)cm->qSV)[row+k] = (unsigned char)q;
+					else
+						((unsigned short *)cm->qSV)[row+k] = (unsigned short)q;
+				}
+			for(p=model->SV[i];p->index!=-1;p++)
+			{
+				int d = p->index-1;
+				double v;
+				switch(quantization)
+				{
+					case SV_FP16:
+						((unsigned short *)cm->qSV)[row+d] = float_to_half((float)p->value);
+						break;
+					case SV_UINT8:
+						((unsigned char *)cm->qSV)[row+d] =
+							(unsigned char)quantize(p->value,cm->lo[d],cm->step[d],max_q);
+						break;
+					case SV_UINT16:
+						((unsigned short *)cm->qSV)[row+d] =
+							(unsigned short)quantize(p->value,cm->lo[d],cm->step[d],max_q);
+						break;
+					default:
+						cm->SV[row+d] = p->value;
+				}
+				v = dequantize(cm->qSV,row+d,quantization,grid ? cm->lo[d] : 0,grid ? cm->step[d] : 0);
+				norm += v*v;
+			}
+		}
+		cm->sv_norm[i] = norm;
+	}
+
+	// models with w have no SVs
+	if(l == 0)
+		return cm;
+
+	if(param.svm_type == ONE_CLASS ||
+	   param.svm_type == EPSILON_SVR ||
+	   param.svm_type == NU_SVR)
+		memcpy(cm->coef,model->sv_coef[0],sizeof(double)*l);
+	else if(one_vs_rest(param,nr_class))
+		for(i=0;i<nr_class;i++)
+			memcpy(cm->coef+(size_t)i*l,model->sv_coef[i],sizeof(double)*l);
+	else
+	{
+		int *start = Malloc(int,nr_class);
+		start[0] = 0;
+		for(i=1;i<nr_class;i++)
+			start[i] = start[i-1]+model->nSV[i-1];
+		int q = 0;
+		for(i=0;i<nr_class;i++)
+			for(j=i+1;j<nr_class;j++)
+			{
+				double *coef = cm->coef+(size_t)q*l;
+				for(k=start[i];k<start[i]+model->nSV[i];k++)
+					coef[k] = model->sv_coef[j-1][k];
+				for(k=start[j];k<start[j]+model->nSV[j];k++)
+					coef[k] = model->sv_coef[i][k];
+				q++;
+			}
+		free(start);
+	}
+	return cm;
+}
+
+void svm_free_compiled_model(svm_compiled_model **cm_ptr_ptr)
+{
+	if(cm_ptr_ptr != NULL && *cm_ptr_ptr != NULL)
+	{
+		free((*cm_ptr_ptr)->mem);
+		free(*cm_ptr_ptr);
+		*cm_ptr_ptr = NULL;
+	}
+}
+
+int svm_get_compiled_nr_thread(const svm_compiled_model *cm)
+{
+	return cm->nr_thread;
+}
+
+double svm_compiled_predict_values(const svm_compiled_model *cm, int thread,
+	const svm_node *x, double *dec_values)
+{
+	const svm_model *model = cm->model;
+	const svm_parameter& param = model->param;
+	int l = cm->l;
+	int dim = cm->dim;
+	int nr_dec = cm->nr_decision;
+	int nr_phi = approx_size(model);
+	int i, k;
+	const svm_node *p;
+
+	bool grid = cm->lo != NULL;
+	double *xd = cm->work+cm->work_size*thread;
+	double *xt = xd+compiled_round(dim);
+	double *kvalue = xt+(grid ? compiled_round(dim) : 0);
+	double *phi = kvalue+compiled_round(l);
+	double *dec = phi+compiled_round(nr_phi);
+	int *vote = (int *)(dec+compiled_round(nr_dec));
+	if(dec_values == NULL)
+		dec_values = dec;
+
+	if(l > 0 && cm->dense)
+	{
+		// x as a dense vector; xx: its squared norm, or for
+		// INTERSECTION the sum of min(x,0) outside the SV columns
+		double xx = 0;
+		for(p=x;p->index!=-1;p++)
+		{
+			bool in_sv = p->index >= 1 && p->index <= dim;
+			if(in_sv)
+				xd[p->index-1] = p->value;
+			if(param.kernel_type == RBF)
+				xx += p->value*p->value;
+			else if(param.kernel_type == INTERSECTION && !in_sv)
+				xx += min(p->value,0.0);
+		}
+
+		bool intersection = param.kernel_type == INTERSECTION;
+		if(grid)
+		{
+			// x on the grid: min(x,lo+step*q) = lo+step*min((x-lo)/step,q)
+			// and x*(lo+step*q) = x*lo+(x*step)*q
+			double c = 0;
+			for(k=0;k<dim;k++)
+				if(intersection)
+				{
+					xt[k] = (xd[k]-cm->lo[k])/cm->step[k];
+					c += cm->lo[k];
+				}
+				else
+				{
+					xt[k] = xd[k]*cm->step[k];
+					c += xd[k]*cm->lo[k];
+				}
+			if(cm->quantization == SV_UINT8)
+				grid_rows((const unsigned char *)cm->qSV,l,dim,xt,cm->step,c,intersection,kvalue);
+			else
+				grid_rows((const unsigned short *)cm->qSV,l,dim,xt,cm->step,c,intersection,kvalue);
+		}
+		else if(cm->quantization == SV_FP16)
+			half_rows((const unsigned short *)cm->qSV,l,dim,xd,intersection,kvalue);
 		else
-			while(p->index != -1)
+			for(i=0;i<l;i++)
 			{
-				fprintf(fp,"%d:%.8g ",p->index,p->value);
+				const double *sv = cm->SV+(size_t)i*dim;
+				double sum = 0;
+				if(intersection)
+					for(k=0;k<dim;k++)
+						sum += min(xd[k],sv[k]);
+				else
+					for(k=0;k<dim;k++)
+						sum += xd[k]*sv[k];
+				kvalue[i] = sum;
+			}
+
+		switch(param.kernel_type)
+		{
+			case POLY:
+				for(i=0;i<l;i++)
+					kvalue[i] = powi(param.gamma*kvalue[i]+param.coef0,param.degree);
+				break;
+			case RBF:
+				for(i=0;i<l;i++)
+					kvalue[i] = exp(-param.gamma*max(xx+cm->sv_norm[i]-2*kvalue[i],0.0));
+				break;
+			case SIGMOID:
+				for(i=0;i<l;i++)
+					kvalue[i] = tanh(param.gamma*kvalue[i]+param.coef0);
+				break;
+			case INTERSECTION:
+				for(i=0;i<l;i++)
+					kvalue[i] += xx;
+				break;
+		}
+
+		for(p=x;p->index!=-1;p++)
+			if(p->index >= 1 && p->index <= dim)
+				xd[p->index-1] = 0;
+	}
+	else
+		for(i=0;i<l;i++)
+			kvalue[i] = Kernel::k_function(x,model->SV[i],param);
+
+	if(l > 0)
+		for(i=0;i<nr_dec;i++)
+		{
+			const double *coef = cm->coef+(size_t)i*l;
+			double sum = 0;
+			for(k=0;k<l;k++)
+				sum += coef[k]*kvalue[k];
+			dec_values[i] = sum-model->rho[i];
+		}
+	else
+	{
+		// models with w
+		if(nr_phi > 0)
+			approx_features(model,x,phi);
+		decision_values(model,kvalue,nr_phi > 0 ? phi : NULL,x,dec_values);
+	}
+	return decision_label(model,dec_values,vote);
+}
+
+double svm_compiled_predict(const svm_compiled_model *cm, int thread, const svm_node *x)
+{
+	return svm_compiled_predict_values(cm,thread,x,NULL);
+}
+
+// Fold the SVs of a model with the LINEAR kernel into w, one vector per
+// decision function, as if it was trained by the linear solver.
+// Prediction then costs O(#nonzeros of x) per decision function, but
+// the model no longer has SVs to train from or to report.
+// Returns 0 if the model was converted, -1 if it is left unchanged.
+int svm_linearize_model(svm_model *model)
+{
+	const svm_parameter& param = model->param;
+	int l = model->l;
+	int nr_class = model->nr_class;
+	int nr_dec = svm_get_nr_decision(model);
+	int nr_feature = 1, min_index = 1;
+	int i, j, k;
+	const svm_node *px;
+
+	if(param.kernel_type != LINEAR || model->w != NULL || l == 0 ||
+	   param.approx != NO_APPROX || model->mapping != NULL)
+		return -1;
+
+	for(k=0;k<l;k++)
+		for(px=model->SV[k];px->index!=-1;px++)
+		{
+			nr_feature = max(nr_feature,px->index);
+			min_index = min(min_index,px->index);
+		}
+	// w has no room for indices below 1
+	if(min_index < 1)
+		return -1;
+	double *w = Malloc(double,(size_t)nr_dec*nr_feature);
+	for(size_t t=0;t<(size_t)nr_dec*nr_feature;t++)
+		w[t] = 0;
+
+	if(param.svm_type == ONE_CLASS ||
+	   param.svm_type == EPSILON_SVR ||
+	   param.svm_type == NU_SVR)
+		for(k=0;k<l;k++)
+			axpy_w(model->sv_coef[0][k],model->SV[k],w);
+	else if(one_vs_rest(param,nr_class))
+		for(i=0;i<nr_class;i++)
+			for(k=0;k<l;k++)
+				axpy_w(model->sv_coef[i][k],model->SV[k],w+(size_t)i*nr_feature);
+	else
+	{
+		int *start = Malloc(int,nr_class);
+		start[0] = 0;
+		for(i=1;i<nr_class;i++)
+			start[i] = start[i-1]+model->nSV[i-1];
+		int p = 0;
+		for(i=0;i<nr_class;i++)
+			for(j=i+1;j<nr_class;j++)
+			{
+				double *wp = w+(size_t)p*nr_feature;
+				for(k=start[i];k<start[i]+model->nSV[i];k++)
+					axpy_w(model->sv_coef[j-1][k],model->SV[k],wp);
+				for(k=start[j];k<start[j]+model->nSV[j];k++)
+					axpy_w(model->sv_coef[i][k],model->SV[k],wp);
 				p++;
 			}
-		fprintf(fp, "\n");
+		free(start);
+	}
+
+	// drop the SVs; nSV, sv_coef and sv_indices as the linear solver
+	// leaves them
+	if(model->free_sv)
+		free((void *)(model->SV[0]));
+	for(i=0;i<nr_sv_coef(param,nr_class);i++)
+	{
+		free(model->sv_coef[i]);
+		model->sv_coef[i] = NULL;
+	}
+	free(model->SV);
+	model->SV = NULL;
+	free(model->sv_indices);
+	model->sv_indices = NULL;
+	if(model->nSV)
+		for(i=0;i<nr_class;i++)
+			model->nSV[i] = 0;
+	model->l = 0;
+	model->nr_feature = nr_feature;
+	model->w = w;
+	return 0;
+}
+
+static const char *svm_type_table[] =
+{
+	"c_svc","nu_svc","one_class","epsilon_svr","nu_svr",NULL
+};
+
+static const char *kernel_type_table[]=
+{
+	"linear","polynomial","rbf","sigmoid","precomputed","intersection",NULL
+};
+
+static const char *approx_table[]=
+{
+	"none","nystrom_uniform","nystrom_kmeans","fourier",NULL
+};
+
+//
+// Reduced sets
+//
+// A reduced model keeps m of the SVs and refits the coefficients of
+// each decision function f = sum_i a_i K(x_i,.) by projecting f onto
+// the span of the kept SVs in the feature space: with Z the kept SVs
+// among those of f, K_ZZ b = K_ZS a.  The SVs are taken in the order
+// of a pivoted Cholesky factorization of their kernel matrix, so that
+// every m gives the m SVs that are the best spread and carry the
+// largest coefficients.
+//
+
+// Pivoted Cholesky factorization of the kernel matrix of the SVs,
+// stopped after m pivots or at its numerical rank.  The pivot is the
+// SV with the largest residual d_i times weight[i].  Returns the number
+// of pivots; piv[k] is the k-th one and Kcol[k*l+i] its kernel value
+// with SV i.
+static int sv_pivots(const svm_model *model, const double *weight, int m, int nr_thread,
+	int *piv, double *Kcol)
+{
+	int l = model->l;
+	int i, j, k;
+	double *d = Malloc(double,l);
+	double *L = Malloc(double,(size_t)m*l);	// L[k*l+i]
+	bool *picked = Malloc(bool,l);
+	double d_max = 0;
+
+	for(i=0;i<l;i++)
+	{
+		d[i] = Kernel::k_function(model->SV[i],model->SV[i],model->param);
+		d_max = max(d_max,d[i]);
+		picked[i] = false;
+	}
+
+	for(k=0;k<m;k++)
+	{
+		int p = -1;
+		for(i=0;i<l;i++)
+			if(!picked[i] && (p < 0 || d[i]*weight[i] > d[p]*weight[p]))
+				p = i;
+		if(p < 0 || d[p] <= 1e-10*d_max)
+			break;
+		picked[p] = true;
+		piv[k] = p;
+
+		double *K_k = Kcol+(size_t)k*l;
+		double *L_k = L+(size_t)k*l;
+		double L_pp = sqrt(d[p]);
+#pragma omp parallel for private(j) schedule(guided) num_threads(nr_thread) if(nr_thread > 1)
+		for(i=0;i<l;i++)
+		{
+			K_k[i] = Kernel::k_function(model->SV[i],model->SV[p],model->param);
+			double v = K_k[i];
+			for(j=0;j<k;j++)
+				v -= L[(size_t)j*l+i]*L[(size_t)j*l+p];
+			L_k[i] = v/L_pp;
+			d[i] -= L_k[i]*L_k[i];
+		}
+	}
+
+	free(d);
+	free(L);
+	free(picked);
+	return k;
+}
+
+// the coefficients b[nz] of the kept SVs (rank[i] >= 0) among S[0..n-1]
+// that project sum_s a[s] K(x_S[s],.) onto their span; returns nz
+static int project_coef(int l, const int *S, const double *a, int n,
+	const int *rank, const double *Kcol, double *b)
+{
+	int i, j, k;
+	int *Z = Malloc(int,n);
+	int nz = 0;
+	for(i=0;i<n;i++)
+		if(rank[S[i]] >= 0)
+			Z[nz++] = S[i];
+
+	// K_ZZ, with a small ridge, and K_ZS a
+	double *A = Malloc(double,(size_t)nz*nz);
+	double diag_max = 0;
+	for(i=0;i<nz;i++)
+	{
+		const double *K_i = Kcol+(size_t)rank[Z[i]]*l;
+		for(j=0;j<=i;j++)
+			A[(size_t)i*nz+j] = K_i[Z[j]];
+		diag_max = max(diag_max,A[(size_t)i*nz+i]);
+		double v = 0;
+		for(k=0;k<n;k++)
+			v += K_i[S[k]]*a[k];
+		b[i] = v;
+	}
+	for(i=0;i<nz;i++)
+		A[(size_t)i*nz+i] += 1e-10*diag_max;
+
+	// Cholesky A = L L^T in the lower triangle, then two substitutions
+	for(j=0;j<nz;j++)
+	{
+		double v = A[(size_t)j*nz+j];
+		for(k=0;k<j;k++)
+			v -= A[(size_t)j*nz+k]*A[(size_t)j*nz+k];
+		double L_jj = sqrt(max(v,1e-300));
+		A[(size_t)j*nz+j] = L_jj;
+		for(i=j+1;i<nz;i++)
+		{
+			double u = A[(size_t)i*nz+j];
+			for(k=0;k<j;k++)
+				u -= A[(size_t)i*nz+k]*A[(size_t)j*nz+k];
+			A[(size_t)i*nz+j] = u/L_jj;
+		}
+	}
+	for(i=0;i<nz;i++)
+	{
+		double v = b[i];
+		for(k=0;k<i;k++)
+			v -= A[(size_t)i*nz+k]*b[k];
+		b[i] = v/A[(size_t)i*nz+i];
+	}
+	for(i=nz-1;i>=0;i--)
+	{
+		double v = b[i];
+		for(k=i+1;k<nz;k++)
+			v -= A[(size_t)k*nz+i]*b[k];
+		b[i] = v/A[(size_t)i*nz+i];
+	}
+
+	free(Z);
+	free(A);
+	return nz;
+}
+
+// the model with the first m pivots as its SVs
+static svm_model *reduced_model(const svm_model *model, int m, const int *piv, const double *Kcol)
+{
+	const svm_parameter& param = model->param;
+	int l = model->l;
+	int nr_class = model->nr_class;
+	int nr_dec = svm_get_nr_decision(model);
+	int nr_coef = nr_sv_coef(param,nr_class);
+	int i, j, k;
+
+	int *rank = Malloc(int,l);
+	int *pos = Malloc(int,l);
+	for(i=0;i<l;i++)
+		rank[i] = -1;
+	for(k=0;k<m;k++)
+		rank[piv[k]] = k;
+	int *kept = Malloc(int,m);
+	int q = 0;
+	for(i=0;i<l;i++)
+		if(rank[i] >= 0)
+		{
+			pos[i] = q;
+			kept[q++] = i;
+		}
+
+	svm_model *reduced = Malloc(svm_model,1);
+	*reduced = *model;
+	reduced->l = m;
+	svm_node **SV = Malloc(svm_node *,m);
+	for(i=0;i<m;i++)
+		SV[i] = model->SV[kept[i]];
+	reduced->SV = copy_nodes(SV,m);
+	free(SV);
+	reduced->free_sv = 1;
+	reduced->mapping = NULL;
+	reduced->sv_indices = NULL;
+	if(model->sv_indices)
+	{
+		reduced->sv_indices = Malloc(int,m);
+		for(i=0;i<m;i++)
+			reduced->sv_indices[i] = model->sv_indices[kept[i]];
+	}
+	reduced->rho = Malloc(double,nr_dec);
+	memcpy(reduced->rho,model->rho,sizeof(double)*nr_dec);
+	reduced->probA = NULL;
+	reduced->probB = NULL;
+	if(model->probA)
+	{
+		reduced->probA = Malloc(double,nr_dec);
+		memcpy(reduced->probA,model->probA,sizeof(double)*nr_dec);
+	}
+	if(model->probB)
+	{
+		reduced->probB = Malloc(double,nr_dec);
+		memcpy(reduced->probB,model->probB,sizeof(double)*nr_dec);
+	}
+	reduced->label = NULL;
+	reduced->nSV = NULL;
+	if(model->label)
+	{
+		reduced->label = Malloc(int,nr_class);
+		memcpy(reduced->label,model->label,sizeof(int)*nr_class);
+	}
+	int *start = Malloc(int,nr_class);
+	if(model->nSV)
+	{
+		reduced->nSV = Malloc(int,nr_class);
+		for(i=0;i<nr_class;i++)
+			reduced->nSV[i] = 0;
+		start[0] = 0;
+		for(i=1;i<nr_class;i++)
+			start[i] = start[i-1]+model->nSV[i-1];
+		for(i=0;i<nr_class;i++)
+			for(k=start[i];k<start[i]+model->nSV[i];k++)
+				if(rank[k] >= 0)
+					reduced->nSV[i]++;
+	}
+	reduced->sv_coef = Malloc(double *,nr_coef);
+	for(i=0;i<nr_coef;i++)
+		reduced->sv_coef[i] = Malloc(double,m);
+
+	int *S = Malloc(int,l);
+	double *a = Malloc(double,l);
+	double *b = Malloc(double,l);
+	if(param.svm_type == ONE_CLASS ||
+	   param.svm_type == EPSILON_SVR ||
+	   param.svm_type == NU_SVR ||
+	   one_vs_rest(param,nr_class))
+	{
+		// every decision function uses all SVs
+		for(i=0;i<l;i++)
+			S[i] = i;
+		for(j=0;j<nr_coef;j++)
+		{
+			project_coef(l,S,model->sv_coef[j],l,rank,Kcol,b);
+			memcpy(reduced->sv_coef[j],b,sizeof(double)*m);
+		}
+	}
+	else
+		for(i=0;i<nr_class;i++)
+			for(j=i+1;j<nr_class;j++)
+			{
+				// classifier (i,j): coefficients of class i in
+				// sv_coef[j-1], of class j in sv_coef[i]
+				int n = 0;
+				for(k=start[i];k<start[i]+model->nSV[i];k++)
+				{
+					S[n] = k;
+					a[n++] = model->sv_coef[j-1][k];
+				}
+				for(k=start[j];k<start[j]+model->nSV[j];k++)
+				{
+					S[n] = k;
+					a[n++] = model->sv_coef[i][k];
+				}
+				project_coef(l,S,a,n,rank,Kcol,b);
+				int z = 0;
+				for(k=0;k<n;k++)
+					if(rank[S[k]] >= 0)
+					{
+						if(S[k] < start[j])
+							reduced->sv_coef[j-1][pos[S[k]]] = b[z++];
+						else
+							reduced->sv_coef[i][pos[S[k]]] = b[z++];
+					}
+			}
+
+	free(rank);
+	free(pos);
+	free(kept);
+	free(start);
+	free(S);
+	free(a);
+	free(b);
+	return reduced;
+}
+
+// error rate, or mean squared error for regression, on prob
+static double reduce_loss(const svm_model *model, const svm_problem *prob, int nr_thread)
+{
+	int svm_type = model->param.svm_type;
+	double *labels = Malloc(double,prob->l);
+	double loss = 0;
+	svm_predict_batch(model,prob->x,prob->l,nr_thread,labels,NULL,NULL);
+	for(int i=0;i<prob->l;i++)
+		if(svm_type == EPSILON_SVR || svm_type == NU_SVR)
+			loss += (labels[i]-prob->y[i])*(labels[i]-prob->y[i]);
+		else if(labels[i] != prob->y[i])
+			++loss;
+	free(labels);
+	return prob->l > 0 ? loss/prob->l : 0;
+}
+
+svm_model *svm_reduce_model(const svm_model *model, int nr_sv,
+	const svm_problem *prob, double max_loss, int nr_thread)
+{
+	int l = model->l;
+	int i, j;
+
+	if(nr_thread < 1)
+		nr_thread = 1;
+	if(l == 0 || model->param.kernel_type == PRECOMPUTED ||
+	   (nr_sv <= 0 && prob == NULL))
+		return NULL;
+
+	double *weight = Malloc(double,l);
+	for(i=0;i<l;i++)
+	{
+		weight[i] = 0;
+		for(j=0;j<nr_sv_coef(model->param,model->nr_class);j++)
+			weight[i] += model->sv_coef[j][i]*model->sv_coef[j][i];
+	}
+
+	// with a loss budget, at most half the SVs are kept, as more
+	// pivots cost O(l^2) memory for little saving; NULL if even those
+	// are over the budget
+	int m_max = max(1,l/2);
+	int m = nr_sv > 0 ? min(nr_sv,l) : min(m_max,8);
+	int *piv = NULL;
+	double *Kcol = NULL;
+	svm_model *reduced = NULL;
+	double loss = 0, base_loss = prob ? reduce_loss(model,prob,nr_thread) : 0;
+	int r, lo = 0;	// lo SVs are over the budget
+
+	// with a loss budget, double m until the reduced model is within
+	// it, then bisect between m/2 and m on the same pivots
+	while(1)
+	{
+		piv = (int *)realloc(piv,sizeof(int)*m);
+		Kcol = (double *)realloc(Kcol,sizeof(double)*m*l);
+		r = sv_pivots(model,weight,m,nr_thread,piv,Kcol);
+		reduced = reduced_model(model,r,piv,Kcol);
+		if(prob)
+			loss = reduce_loss(reduced,prob,nr_thread);
+		if(nr_sv > 0 || r < m || loss <= base_loss+max_loss)
+			break;
+		svm_free_and_destroy_model(&reduced);
+		if(m == m_max)
+		{
+			info("Reduced set: %d of %d SVs are still over the loss budget\n",m,l);
+			free(weight);
+			free(piv);
+			free(Kcol);
+			return NULL;
+		}
+		lo = m;
+		m = min(2*m,m_max);
+	}
+	if(nr_sv <= 0)
+	{
+		int hi = r;
+		while(hi-lo > 1)
+		{
+			int mid = (lo+hi)/2;
+			svm_model *cand = reduced_model(model,mid,piv,Kcol);
+			double cand_loss = reduce_loss(cand,prob,nr_thread);
+			if(cand_loss <= base_loss+max_loss)
+			{
+				svm_free_and_destroy_model(&reduced);
+				reduced = cand;
+				loss = cand_loss;
+				hi = mid;
+			}
+			else
+			{
+				svm_free_and_destroy_model(&cand);
+				lo = mid;
+			}
+		}
+	}
+
+	if(prob)
+	{
+		if(model->param.svm_type == EPSILON_SVR || model->param.svm_type == NU_SVR)
+			info("Reduced set: %d of %d SVs, mean squared error %g -> %g (%d examples)\n",
+				reduced->l,l,base_loss,loss,prob->l);
+		else
+			info("Reduced set: %d of %d SVs, accuracy %g%% -> %g%% (%d examples)\n",
+				reduced->l,l,100*(1-base_loss),100*(1-loss),prob->l);
+	}
+	else
+		info("Reduced set: %d of %d SVs\n",reduced->l,l);
+
+	free(weight);
+	free(piv);
+	free(Kcol);
+	return reduced;
+}
+
+struct file_mapping
+{
+	void *base;
+	size_t size;
+};
+
+static file_mapping *map_file(const char *file_name)
+{
+	void *base;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file = CreateFileA(file_name,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+	if(file == INVALID_HANDLE_VALUE)
+		return NULL;
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file,&file_size) || file_size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return NULL;
+	}
+	size = (size_t)file_size.QuadPart;
+	// copy-on-write, as the model arrays are not const
+	HANDLE mapping = CreateFileMappingA(file,NULL,PAGE_WRITECOPY,0,0,NULL);
+	CloseHandle(file);
+	if(mapping == NULL)
+		return NULL;
+	base = MapViewOfFile(mapping,FILE_MAP_COPY,0,0,0);
+	CloseHandle(mapping);
+	if(base == NULL)
+		return NULL;
+#else
+	int fd = open(file_name,O_RDONLY);
+	if(fd < 0)
+		return NULL;
+	struct stat st;
+	if(fstat(fd,&st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+	size = (size_t)st.st_size;
+	// copy-on-write, as the model arrays are not const
+	base = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(base == MAP_FAILED)
+		return NULL;
+#endif
+	file_mapping *mapping = Malloc(file_mapping,1);
+	mapping->base = base;
+	mapping->size = size;
+	return mapping;
+}
+
+static void unmap_file(file_mapping *mapping)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(mapping->base);
+#else
+	munmap(mapping->base,mapping->size);
+#endif
+	free(mapping);
+}
+
+//
+// The "C" locale for the numbers of model files, for the calling thread
+// only
+//
+#ifdef _WIN32
+typedef _locale_t c_locale_t;
+#else
+typedef locale_t c_locale_t;
+#endif
+
+static c_locale_t c_locale()
+{
+#ifdef _WIN32
+	static const c_locale_t locale = _create_locale(LC_ALL,"C");
+#else
+	static const c_locale_t locale = newlocale(LC_ALL_MASK,"C",(locale_t)0);
+#endif
+	return locale;
+}
+
+// strtod in the "C" locale, for the numbers of svm_parse.h
+static double strtod_c(const char *s, char **endptr)
+{
+#ifdef _WIN32
+	return _strtod_l(s,endptr,c_locale());
+#else
+	return strtod_l(s,endptr,c_locale());
+#endif
+}
+
+struct locale_scope
+{
+#ifdef _WIN32
+	int per_thread;
+	char *old_locale;
+#else
+	locale_t old_locale;
+#endif
+};
+
+static void use_c_locale(locale_scope *scope)
+{
+#ifdef _WIN32
+	scope->per_thread = _configthreadlocale(_ENABLE_PER_THREAD_LOCALE);
+	scope->old_locale = strdup(setlocale(LC_ALL,NULL));
+	setlocale(LC_ALL,"C");
+#else
+	scope->old_locale = uselocale(c_locale());
+#endif
+}
+
+static void restore_locale(locale_scope *scope)
+{
+#ifdef _WIN32
+	setlocale(LC_ALL,scope->old_locale);
+	free(scope->old_locale);
+	_configthreadlocale(scope->per_thread);
+#else
+	uselocale(scope->old_locale);
+#endif
+}
+
+int svm_save_model(const char *model_file_name, const svm_model *model)
+{
+	FILE *fp = fopen(model_file_name,"w");
+	if(fp==NULL) return -1;
+
+	locale_scope locale;
+	use_c_locale(&locale);
+
+	const svm_parameter& param = model->param;
+
+	fprintf(fp,"svm_type %s\n", svm_type_table[param.svm_type]);
+	fprintf(fp,"kernel_type %s\n", kernel_type_table[param.kernel_type]);
+
+	if(param.kernel_type == POLY)
+		fprintf(fp,"degree %d\n", param.degree);
+
+	if(param.kernel_type == POLY || param.kernel_type == RBF || param.kernel_type == SIGMOID)
+		fprintf(fp,"gamma %g\n", param.gamma);
+
+	if(param.kernel_type == POLY || param.kernel_type == SIGMOID)
+		fprintf(fp,"coef0 %g\n", param.coef0);
+
+	if(param.approx != NO_APPROX)
+		fprintf(fp,"approx %s\n", approx_table[param.approx]);
+
+	if(param.svm_type == C_SVC && param.multiclass == OVR)
+		fprintf(fp,"multiclass ovr\n");
+
+	int nr_class = model->nr_class;
+	int nr_dec = nr_decision(param,nr_class);
+	int l = model->l;
+	fprintf(fp, "nr_class %d\n", nr_class);
+	fprintf(fp, "total_sv %d\n",l);
+	
+	{
+		fprintf(fp, "rho");
+		for(int i=0;i<nr_dec;i++)
+			fprintf(fp," %g",model->rho[i]);
+		fprintf(fp, "\n");
+	}
+	
+	if(model->label)
+	{
+		fprintf(fp, "label");
+		for(int i=0;i<nr_class;i++)
+			fprintf(fp," %d",model->label[i]);
+		fprintf(fp, "\n");
+	}
+
+	if(model->probA) // regression has probA only
+	{
+		fprintf(fp, "probA");
+		for(int i=0;i<nr_dec;i++)
+			fprintf(fp," %g",model->probA[i]);
+		fprintf(fp, "\n");
+	}
+	if(model->probB)
+	{
+		fprintf(fp, "probB");
+		for(int i=0;i<nr_dec;i++)
+			fprintf(fp," %g",model->probB[i]);
+		fprintf(fp, "\n");
+	}
+
+	if(model->nSV)
+	{
+		fprintf(fp, "nr_sv");
+		for(int i=0;i<nr_class;i++)
+			fprintf(fp," %d",model->nSV[i]);
+		fprintf(fp, "\n");
+	}
+
+	if(model->w)
+	{
+		fprintf(fp, "nr_feature %d\n", model->nr_feature);
+		fprintf(fp, "w\n");
+		const double *w = model->w;
+		for(int i=0;i<nr_dec;i++)
+		{
+			for(int j=0;j<model->nr_feature;j++)
+				fprintf(fp, "%.16g ",*w++);
+			fprintf(fp, "\n");
+		}
+	}
+
+	if(model->landmark)
+	{
+		// one landmark per line, led by its number of nonzeros
+		fprintf(fp, "landmark\n");
+		for(int i=0;i<model->nr_feature;i++)
+		{
+			const svm_node *p = model->landmark[i];
+			int nnz = 0;
+			while(p[nnz].index != -1)
+				nnz++;
+			fprintf(fp, "%d ",nnz);
+			for(;p->index != -1;p++)
+				fprintf(fp,"%d:%.17g ",p->index,p->value);
+			fprintf(fp, "\n");
+		}
+	}
+
+	if(model->omega)
+	{
+		// one omega_k per line
+		fprintf(fp, "omega %d\n",model->omega_dim);
+		const double *omega = model->omega;
+		for(int i=0;i<model->nr_feature;i++)
+		{
+			for(int j=0;j<model->omega_dim;j++)
+				fprintf(fp, "%.17g ",*omega++);
+			fprintf(fp, "\n");
+		}
+	}
+
+	if(model->phase)
+	{
+		fprintf(fp, "phase\n");
+		for(int i=0;i<model->nr_feature;i++)
+			fprintf(fp, "%.17g ",model->phase[i]);
+		fprintf(fp, "\n");
+	}
+
+	fprintf(fp, "SV\n");
+	const double * const *sv_coef = model->sv_coef;
+	const svm_node * const *SV = model->SV;
+
+	for(int i=0;i<l;i++)
+	{
+		for(int j=0;j<nr_sv_coef(param,nr_class);j++)
+			fprintf(fp, "%.16g ",sv_coef[j][i]);
+
+		const svm_node *p = SV[i];
+
+		if(param.kernel_type == PRECOMPUTED)
+			fprintf(fp,"0:%d ",(int)(p->value));
+		else
+			while(p->index != -1)
+			{
+				fprintf(fp,"%d:%.8g ",p->index,p->value);
+				p++;
+			}
+		fprintf(fp, "\n");
+	}
+
+	restore_locale(&locale);
+
+	if (ferror(fp) != 0 || fclose(fp) != 0) return -1;
+	else return 0;
+}
+
+//
+// Text parsing over a mapped file, with the number parsers of
+// svm_parse.h; those that are not exact in double arithmetic fall back
+// to strtod in the "C" locale.
+//
+#define PARSE_CHUNK (1<<20)	// bytes per thread at least
+
+// first byte of the line after the one containing p
+static const char *next_line(const char *p, const char *end)
+{
+	const char *q = (const char *)memchr(p,'\n',(size_t)(end-p));
+	return q ? q+1 : end;
+}
+
+// split [begin,end) into at most nr_thread pieces at line starts
+static int split_lines(const char *begin, const char *end, int nr_thread, const char **cut)
+{
+	size_t size = (size_t)(end-begin);
+	int n = (int)min((size_t)nr_thread,size/PARSE_CHUNK+1);
+	cut[0] = begin;
+	for(int t=1;t<n;t++)
+	{
+		const char *p = begin+size/n*t;
+		cut[t] = max(cut[t-1],p == begin ? begin : next_line(p-1,end));
+	}
+	cut[n] = end;
+	return n;
+}
+
+static int max_parse_thread()
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+struct text_cursor
+{
+	const char *p, *end;
+};
+
+static bool read_word(text_cursor *c, char *word, int size)
+{
+	const char *p = c->p;
+	while(p < c->end && (is_blank(*p) || *p == '\n'))
+		p++;
+	int n = 0;
+	for(;p < c->end && !is_blank(*p) && *p != '\n';p++)
+		if(n < size-1)
+			word[n++] = *p;
+	word[n] = '\0';
+	c->p = p;
+	return n > 0;
+}
+
+static bool read_int(text_cursor *c, int *v)
+{
+	const char *p = c->p;
+	while(p < c->end && (is_blank(*p) || *p == '\n'))
+		p++;
+	if((p = parse_int(p,c->end,v)) == NULL)
+		return false;
+	c->p = p;
+	return true;
+}
+
+static bool read_double(text_cursor *c, double *v)
+{
+	const char *p = c->p;
+	while(p < c->end && (is_blank(*p) || *p == '\n'))
+		p++;
+	if((p = parse_double(p,c->end,v)) == NULL)
+		return false;
+	c->p = p;
+	return true;
+}
+
+//
+// READ helps to handle read failures.
+// Its do-while block avoids the ambiguity when
+// if (...)
+//    READ();
+// is used
+//
+#define READ(_read, _cursor, _var) do{ if (!_read(_cursor, _var)) return false; }while(0)
+static bool read_model_header(text_cursor *c, svm_model* model)
+{
+	svm_parameter& param = model->param;
+	char cmd[81];
+	while(1)
+	{
+		if(!read_word(c,cmd,sizeof(cmd)))
+			return false;
+
+		if(strcmp(cmd,"svm_type")==0)
+		{
+			read_word(c,cmd,sizeof(cmd));
+			int i;
+			for(i=0;svm_type_table[i];i++)
+			{
+				if(strcmp(svm_type_table[i],cmd)==0)
+				{
+					param.svm_type=i;
+					break;
+				}
+			}
+			if(svm_type_table[i] == NULL)
+			{
+				fprintf(stderr,"unknown svm type.\n");
+				return false;
+			}
+		}
+		else if(strcmp(cmd,"kernel_type")==0)
+		{		
+			read_word(c,cmd,sizeof(cmd));
+			int i;
+			for(i=0;kernel_type_table[i];i++)
+			{
+				if(strcmp(kernel_type_table[i],cmd)==0)
+				{
+					param.kernel_type=i;
+					break;
+				}
+			}
+			if(kernel_type_table[i] == NULL)
+			{
+				fprintf(stderr,"unknown kernel function.\n");	
+				return false;
+			}
+		}
+		else if(strcmp(cmd,"degree")==0)
+			READ(read_int,c,&param.degree);
+		else if(strcmp(cmd,"gamma")==0)
+			READ(read_double,c,&param.gamma);
+		else if(strcmp(cmd,"coef0")==0)
+			READ(read_double,c,&param.coef0);
+		else if(strcmp(cmd,"multiclass")==0)
+		{
+			read_word(c,cmd,sizeof(cmd));
+			if(strcmp(cmd,"ovr")==0)
+				param.multiclass = OVR;
+			else if(strcmp(cmd,"ovo")==0)
+				param.multiclass = OVO;
+			else
+			{
+				fprintf(stderr,"unknown multiclass type.\n");
+				return false;
+			}
+		}
+		else if(strcmp(cmd,"approx")==0)
+		{
+			read_word(c,cmd,sizeof(cmd));
+			int i;
+			for(i=0;approx_table[i];i++)
+			{
+				if(strcmp(approx_table[i],cmd)==0)
+				{
+					param.approx=i;
+					break;
+				}
+			}
+			if(approx_table[i] == NULL)
+			{
+				fprintf(stderr,"unknown kernel approximation.\n");
+				return false;
+			}
+		}
+		else if(strcmp(cmd,"nr_class")==0)
+			READ(read_int,c,&model->nr_class);
+		else if(strcmp(cmd,"total_sv")==0)
+			READ(read_int,c,&model->l);
+		else if(strcmp(cmd,"rho")==0)
+		{
+			int n = nr_decision(param,model->nr_class);
+			model->rho = Malloc(double,n);
+			for(int i=0;i<n;i++)
+				READ(read_double,c,&model->rho[i]);
+		}
+		else if(strcmp(cmd,"label")==0)
+		{
+			int n = model->nr_class;
+			model->label = Malloc(int,n);
+			for(int i=0;i<n;i++)
+				READ(read_int,c,&model->label[i]);
+		}
+		else if(strcmp(cmd,"probA")==0)
+		{
+			int n = nr_decision(param,model->nr_class);
+			model->probA = Malloc(double,n);
+			for(int i=0;i<n;i++)
+				READ(read_double,c,&model->probA[i]);
+		}
+		else if(strcmp(cmd,"probB")==0)
+		{
+			int n = nr_decision(param,model->nr_class);
+			model->probB = Malloc(double,n);
+			for(int i=0;i<n;i++)
+				READ(read_double,c,&model->probB[i]);
+		}
+		else if(strcmp(cmd,"nr_sv")==0)
+		{
+			int n = model->nr_class;
+			model->nSV = Malloc(int,n);
+			for(int i=0;i<n;i++)
+				READ(read_int,c,&model->nSV[i]);
+		}
+		else if(strcmp(cmd,"nr_feature")==0)
+			READ(read_int,c,&model->nr_feature);
+		else if(strcmp(cmd,"w")==0)
+		{
+			int n = nr_decision(param,model->nr_class) * model->nr_feature;
+			model->w = Malloc(double,n);
+			for(int i=0;i<n;i++)
+				READ(read_double,c,&model->w[i]);
+		}
+		else if(strcmp(cmd,"landmark")==0)
+		{
+			int n = model->nr_feature;
+			int *start = Malloc(int,n+1);
+			int max_elements = 1024, elements = 0;
+			svm_node *x_space = Malloc(svm_node,max_elements);
+			start[0] = 0;
+			for(int i=0;i<n;i++)
+			{
+				int nnz;
+				if(!read_int(c,&nnz) || nnz < 0)
+				{
+					free(start);
+					free(x_space);
+					return false;
+				}
+				if(elements+nnz+1 > max_elements)
+				{
+					max_elements = max(2*max_elements,elements+nnz+1);
+					x_space = (svm_node *)realloc(x_space,max_elements*sizeof(svm_node));
+				}
+				for(int j=0;j<nnz;j++,elements++)
+					if(!read_int(c,&x_space[elements].index) || c->p == c->end || *c->p++ != ':' ||
+					   (c->p = parse_double(c->p,c->end,&x_space[elements].value)) == NULL)
+					{
+						free(start);
+						free(x_space);
+						return false;
+					}
+				x_space[elements++].index = -1;
+				start[i+1] = elements;
+			}
+			model->landmark = Malloc(svm_node *,n);
+			for(int i=0;i<n;i++)
+				model->landmark[i] = x_space+start[i];
+			if(n == 0)
+				free(x_space);
+			free(start);
+		}
+		else if(strcmp(cmd,"omega")==0)
+		{
+			int dim;
+			if(!read_int(c,&dim) || dim < 0)
+				return false;
+			size_t n = (size_t)model->nr_feature*dim;
+			model->omega = Malloc(double,max(n,(size_t)1));
+			model->omega_dim = dim;
+			for(size_t i=0;i<n;i++)
+				READ(read_double,c,&model->omega[i]);
+		}
+		else if(strcmp(cmd,"phase")==0)
+		{
+			int n = model->nr_feature;
+			model->phase = Malloc(double,n);
+			for(int i=0;i<n;i++)
+				READ(read_double,c,&model->phase[i]);
+		}
+		else if(strcmp(cmd,"SV")==0)
+		{
+			c->p = next_line(c->p,c->end);
+			break;
+		}
+		else
+		{
+			fprintf(stderr,"unknown text in model file: [%s]\n",cmd);
+			return false;
+		}
+	}
+
+	return true;
+
+}
+
+// SV lines parsed by one thread, appended to growing arrays
+struct sv_chunk
+{
+	const char *begin, *end;
+	int l, max_l;
+	size_t nr_node, max_node;
+	double *coef;		// coef[i*m+k]
+	size_t *start;		// first node of each line
+	svm_node *node;
+	bool error;
+};
+
+static void parse_sv_chunk(sv_chunk *c, int m)
+{
+	const char *p = c->begin, *end = c->end;
+	c->l = c->max_l = 0;
+	c->nr_node = c->max_node = 0;
+	c->coef = NULL;
+	c->start = NULL;
+	c->node = NULL;
+	c->error = false;
+	while(p < end)
+	{
+		p = skip_blank(p,end);
+		if(p == end)
+			break;
+		if(*p == '\n')
+		{
+			p++;
+			continue;
+		}
+		if(c->l == c->max_l)
+		{
+			c->max_l = max(2*c->max_l,64);
+			c->coef = (double *)realloc(c->coef,sizeof(double)*c->max_l*m);
+			c->start = (size_t *)realloc(c->start,sizeof(size_t)*c->max_l);
+		}
+		double *coef = c->coef+(size_t)c->l*m;
+		for(int k=0;k<m;k++)
+		{
+			p = skip_blank(p,end);
+			if((p = parse_double(p,end,&coef[k])) == NULL)
+			{
+				c->error = true;
+				return;
+			}
+		}
+		c->start[c->l++] = c->nr_node;
+		while(1)
+		{
+			if(c->nr_node == c->max_node)
+			{
+				c->max_node = max(2*c->max_node,(size_t)1024);
+				c->node = (svm_node *)realloc(c->node,sizeof(svm_node)*c->max_node);
+			}
+			svm_node *x = &c->node[c->nr_node++];
+			p = skip_blank(p,end);
+			if(p == end || *p == '\n')
+			{
+				x->index = -1;
+				break;
+			}
+			if((p = parse_int(p,end,&x->index)) == NULL || p == end || *p++ != ':' ||
+			   (p = parse_double(p,end,&x->value)) == NULL)
+			{
+				c->error = true;
+				return;
+			}
+		}
+	}
+}
+
+// omega of a FOURIER model saved with omega_k as landmark[k]
+static void landmark_to_omega(svm_model *model)
+{
+	int n = model->nr_feature;
+	int i, dim = 0;
+	const svm_node *p;
+	if(model->landmark == NULL)
+		return;
+	for(i=0;i<n;i++)
+		for(p=model->landmark[i];p->index!=-1;p++)
+			dim = max(dim,p->index);
+	model->omega = Malloc(double,max((size_t)n*dim,(size_t)1));
+	model->omega_dim = dim;
+	for(i=0;i<n;i++)
+		densify(model->landmark[i],model->omega+(size_t)i*dim,dim);
+	if(n > 0)
+		free(model->landmark[0]);
+	free(model->landmark);
+	model->landmark = NULL;
+}
+
+svm_model *svm_load_model(const char *model_file_name)
+{
+	file_mapping *mapping = map_file(model_file_name);
+	if(mapping==NULL) return NULL;
+
+	// read parameters
+
+	svm_model *model = Malloc(svm_model,1);
+	model->rho = NULL;
+	model->probA = NULL;
+	model->probB = NULL;
+	model->sv_indices = NULL;
+	model->label = NULL;
+	model->nSV = NULL;
+	model->nr_feature = 0;
+	model->w = NULL;
+	model->landmark = NULL;
+	model->phase = NULL;
+	model->omega = NULL;
+	model->omega_dim = 0;
+	model->mapping = NULL;
+	// fields the model file does not hold: no training parameters
+	memset(&model->param,0,sizeof(model->param));
+	model->param.nr_thread = 1;
+	model->param.approx = NO_APPROX;
+	model->param.multiclass = OVO;
+	
+	// read header
+	text_cursor cursor;
+	cursor.p = (const char *)mapping->base;
+	cursor.end = cursor.p+mapping->size;
+	if (!read_model_header(&cursor, model))
+	{
+		fprintf(stderr, "ERROR: failed to read model\n");
+		unmap_file(mapping);
+		free(model->rho);
+		free(model->label);
+		free(model->nSV);
+		free(model->w);
+		if(model->landmark && model->nr_feature > 0)
+			free(model->landmark[0]);
+		free(model->landmark);
+		free(model->phase);
+		free(model->omega);
+		free(model);
+		return NULL;
+	}
+	if(model->param.approx == FOURIER && model->omega == NULL)
+		landmark_to_omega(model);
+	
+	// read sv_coef and SV, the lines split among threads
+
+	int m = nr_sv_coef(model->param,model->nr_class);
+	int l = model->l;
+	int nr_thread = max_parse_thread();
+	const char **cut = Malloc(const char *,nr_thread+1);
+	int nr_chunk = split_lines(cursor.p,cursor.end,nr_thread,cut);
+	sv_chunk *chunk = Malloc(sv_chunk,nr_chunk);
+	int t;
+#pragma omp parallel for schedule(static,1) num_threads(nr_chunk) if(nr_chunk > 1)
+	for(t=0;t<nr_chunk;t++)
+	{
+		chunk[t].begin = cut[t];
+		chunk[t].end = cut[t+1];
+		parse_sv_chunk(&chunk[t],m);
+	}
+	free(cut);
+
+	unmap_file(mapping);
+
+	// offsets of the chunks in the model
+	int *line_offset = Malloc(int,nr_chunk+1);
+	size_t *node_offset = Malloc(size_t,nr_chunk+1);
+	bool error = false;
+	line_offset[0] = 0;
+	node_offset[0] = 0;
+	for(t=0;t<nr_chunk;t++)
+	{
+		error = error || chunk[t].error;
+		line_offset[t+1] = line_offset[t]+chunk[t].l;
+		node_offset[t+1] = node_offset[t]+chunk[t].nr_node;
+	}
+
+	model->sv_coef = Malloc(double *,m);
+	int i;
+	for(i=0;i<m;i++)
+		model->sv_coef[i] = Malloc(double,l);
+	model->SV = Malloc(svm_node*,l);
+	svm_node *x_space = NULL;
+	if(!error && line_offset[nr_chunk] == l)
+	{
+		if(l>0) x_space = Malloc(svm_node,node_offset[nr_chunk]);
+#pragma omp parallel for private(i) schedule(static,1) num_threads(nr_chunk) if(nr_chunk > 1)
+		for(t=0;t<nr_chunk;t++)
+		{
+			const sv_chunk& c = chunk[t];
+			if(c.nr_node > 0)
+				memcpy(x_space+node_offset[t],c.node,sizeof(svm_node)*c.nr_node);
+			for(i=0;i<c.l;i++)
+			{
+				model->SV[line_offset[t]+i] = x_space+node_offset[t]+c.start[i];
+				for(int k=0;k<m;k++)
+					model->sv_coef[k][line_offset[t]+i] = c.coef[(size_t)i*m+k];
+			}
+		}
+	}
+	else
+		error = true;
+	for(t=0;t<nr_chunk;t++)
+	{
+		free(chunk[t].coef);
+		free(chunk[t].start);
+		free(chunk[t].node);
+	}
+	free(chunk);
+	free(line_offset);
+	free(node_offset);
+
+	model->free_sv = 1;	// XXX
+	if(error)
+	{
+		fprintf(stderr, "ERROR: failed to read model\n");
+		model->l = 0;	// no SV nodes to free
+		svm_free_and_destroy_model(&model);
+		return NULL;
+	}
+
+	return model;
+}
+
+//
+// Binary model file: a header followed by 64-byte aligned arrays laid
+// out as in memory on a little-endian host, so that svm_load_model_mmap
+// points the model into the mapped file instead of parsing it.  With
+// quantized SVs, the nodes are split into indices and quantized values
+// and are expanded when loaded.
+//
+#define BINARY_MAGIC "LIBSVMB"
+#define BINARY_VERSION 3
+#define BINARY_BYTE_ORDER 0x01020304u
+#define BINARY_ALIGN 64
+
+enum { SEC_RHO, SEC_PROBA, SEC_PROBB, SEC_LABEL, SEC_NSV, SEC_SV_INDICES, SEC_SV_COEF,
+       SEC_SV_START, SEC_SV_NODE, SEC_W, SEC_LANDMARK_START, SEC_LANDMARK_NODE, SEC_PHASE,
+       SEC_SV_INDEX, SEC_SV_QVALUE, SEC_SV_LO, SEC_SV_STEP, SEC_OMEGA, NR_SECTION };
+
+struct binary_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t header_size;
+	uint32_t node_size;	// sizeof(svm_node)
+	uint64_t file_size;
+	uint64_t checksum;	// of the file with this field 0
+	int32_t svm_type, kernel_type, degree, approx;
+	int32_t multiclass, nr_class, l, nr_feature;
+	int32_t quantization, sv_dim;	// sv_dim: the number of lo and step values
+	double gamma, coef0;
+	uint64_t offset[NR_SECTION];	// 0 if the array is absent
+	uint64_t size[NR_SECTION];	// in bytes
+};
+
+static bool little_endian_host()
+{
+	uint32_t one = 1;
+	return *(unsigned char *)&one == 1;
+}
+
+// 64-bit hash of n words in four interleaved lanes
+static uint64_t checksum_words(uint64_t seed, const uint64_t *p, size_t n)
+{
+	const uint64_t prime = 0x100000001b3ULL;
+	uint64_t h[4] = {seed, seed^1, seed^2, seed^3};
+	size_t i = 0;
+	for(;i+4<=n;i+=4)
+		for(int t=0;t<4;t++)
+		{
+			h[t] = (h[t]^p[i+t])*prime;
+			h[t] ^= h[t]>>29;
+		}
+	for(;i<n;i++)
+		h[0] = (h[0]^p[i])*prime;
+	uint64_t r = 0xcbf29ce484222325ULL;
+	for(int t=0;t<4;t++)
+	{
+		r = (r^h[t])*prime;
+		r ^= r>>32;
+	}
+	return r;
+}
+
+// checksum of a file image of header->file_size bytes starting at base
+static uint64_t binary_checksum(const binary_header *header, const char *base)
+{
+	binary_header h = *header;
+	h.checksum = 0;
+	uint64_t seed = checksum_words(0,(const uint64_t *)&h,sizeof(h)/8);
+	return checksum_words(seed,(const uint64_t *)(base+sizeof(h)),(size_t)(h.file_size-sizeof(h))/8);
+}
+
+static int nr_nodes(const svm_node *x, int kernel_type)
+{
+	if(kernel_type == PRECOMPUTED)
+		return 2;
+	int n = 0;
+	while(x[n].index != -1)
+		n++;
+	return n+1;
+}
+
+// copy rows of nodes into the file image, with their start offsets
+static void write_nodes(char *base, uint64_t start_offset, uint64_t node_offset,
+	const svm_node * const *x, int n, int kernel_type)
+{
+	uint64_t *start = (uint64_t *)(base+start_offset);
+	svm_node *node = (svm_node *)(base+node_offset);
+	start[0] = 0;
+	for(int i=0;i<n;i++)
+	{
+		int len = nr_nodes(x[i],kernel_type);
+		memcpy(node+start[i],x[i],sizeof(svm_node)*(len-1));
+		node[start[i]+len-1].index = -1;
+		node[start[i]+len-1].value = 0;
+		start[i+1] = start[i]+len;
+	}
+}
+
+// split rows of nodes into indices and quantized values
+static void write_quantized_nodes(char *base, const binary_header *header,
+	const svm_model *model, const double *lo, const double *step)
+{
+	int quantization = header->quantization;
+	unsigned int max_q = quantized_max(quantization);
+	uint64_t *start = (uint64_t *)(base+header->offset[SEC_SV_START]);
+	int32_t *index = (int32_t *)(base+header->offset[SEC_SV_INDEX]);
+	void *q = base+header->offset[SEC_SV_QVALUE];
+	size_t j = 0;
+	start[0] = 0;
+	for(int i=0;i<model->l;i++)
+	{
+		for(const svm_node *p=model->SV[i];p->index!=-1;p++,j++)
+		{
+			int d = p->index-1;
+			index[j] = p->index;
+			if(quantization == SV_FP16)
+				((unsigned short *)q)[j] = float_to_half((float)p->value);
+			else if(quantization == SV_UINT8)
+				((unsigned char *)q)[j] = (unsigned char)quantize(p->value,lo[d],step[d],max_q);
+			else
+				((unsigned short *)q)[j] = (unsigned short)quantize(p->value,lo[d],step[d],max_q);
+		}
+		index[j++] = -1;
+		start[i+1] = j;
+	}
+}
+
+int svm_save_model_binary(const char *model_file_name, const svm_model *model)
+{
+	return svm_save_model_binary_quantized(model_file_name,model,SV_DOUBLE);
+}
+
+int svm_save_model_binary_quantized(const char *model_file_name, const svm_model *model, int quantization)
+{
+	if(!little_endian_host())
+		return -1;
+
+	const svm_parameter& param = model->param;
+	int nr_class = model->nr_class;
+	int nr_dec = nr_decision(param,nr_class);
+	int nr_coef = nr_sv_coef(param,nr_class);
+	int l = model->l;
+	int i;
+
+	uint64_t nr_sv_node = 0, nr_landmark_node = 0;
+	int sv_dim = 0, min_index = 1;
+	for(i=0;i<l;i++)
+	{
+		nr_sv_node += nr_nodes(model->SV[i],param.kernel_type);
+		if(param.kernel_type != PRECOMPUTED)
+			for(const svm_node *p=model->SV[i];p->index!=-1;p++)
+			{
+				sv_dim = max(sv_dim,p->index);
+				min_index = min(min_index,p->index);
+			}
+	}
+	if(param.kernel_type == PRECOMPUTED || l == 0 || min_index < 1 ||
+	   quantization < SV_DOUBLE || quantization > SV_UINT16)
+		quantization = SV_DOUBLE;
+	bool grid = quantization == SV_UINT8 || quantization == SV_UINT16;
+	if(!grid)
+		sv_dim = 0;
+	if(model->landmark)
+		for(i=0;i<model->nr_feature;i++)
+			nr_landmark_node += nr_nodes(model->landmark[i],LINEAR);
+
+	binary_header header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,BINARY_MAGIC,sizeof(header.magic));
+	header.version = BINARY_VERSION;
+	header.byte_order = BINARY_BYTE_ORDER;
+	header.header_size = sizeof(header);
+	header.node_size = sizeof(svm_node);
+	header.svm_type = param.svm_type;
+	header.kernel_type = param.kernel_type;
+	header.degree = param.degree;
+	header.approx = param.approx;
+	header.multiclass = param.multiclass;
+	header.nr_class = nr_class;
+	header.l = l;
+	header.nr_feature = model->nr_feature;
+	header.quantization = quantization;
+	header.sv_dim = sv_dim;
+	header.gamma = param.gamma;
+	header.coef0 = param.coef0;
+
+	header.size[SEC_RHO] = sizeof(double)*nr_dec;
+	if(model->probA) header.size[SEC_PROBA] = sizeof(double)*nr_dec;
+	if(model->probB) header.size[SEC_PROBB] = sizeof(double)*nr_dec;
+	if(model->label) header.size[SEC_LABEL] = sizeof(int32_t)*nr_class;
+	if(model->nSV) header.size[SEC_NSV] = sizeof(int32_t)*nr_class;
+	if(model->sv_indices && l > 0) header.size[SEC_SV_INDICES] = sizeof(int32_t)*l;
+	header.size[SEC_SV_COEF] = sizeof(double)*nr_coef*l;
+	header.size[SEC_SV_START] = sizeof(uint64_t)*(l+1);
+	if(quantization == SV_DOUBLE)
+		header.size[SEC_SV_NODE] = sizeof(svm_node)*nr_sv_node;
+	else
+	{
+		header.size[SEC_SV_INDEX] = sizeof(int32_t)*nr_sv_node;
+		header.size[SEC_SV_QVALUE] = quantized_size(quantization)*nr_sv_node;
+		header.size[SEC_SV_LO] = sizeof(double)*sv_dim;
+		header.size[SEC_SV_STEP] = sizeof(double)*sv_dim;
+	}
+	if(model->w) header.size[SEC_W] = sizeof(double)*nr_dec*model->nr_feature;
+	if(model->landmark)
+	{
+		header.size[SEC_LANDMARK_START] = sizeof(uint64_t)*(model->nr_feature+1);
+		header.size[SEC_LANDMARK_NODE] = sizeof(svm_node)*nr_landmark_node;
 	}
+	if(model->phase) header.size[SEC_PHASE] = sizeof(double)*model->nr_feature;
+	if(model->omega) header.size[SEC_OMEGA] = sizeof(double)*model->nr_feature*model->omega_dim;
 
-	setlocale(LC_ALL, old_locale);
-	free(old_locale);
-
-	if (ferror(fp) != 0 || fclose(fp) != 0) return -1;
+	uint64_t offset = sizeof(header);
+	for(i=0;i<NR_SECTION;i++)
+		if(header.size[i] > 0)
+		{
+			offset = (offset+BINARY_ALIGN-1)/BINARY_ALIGN*BINARY_ALIGN;
+			header.offset[i] = offset;
+			offset += header.size[i];
+		}
+	header.file_size = (offset+7)/8*8;
+
+	char *base = (char *)calloc((size_t)header.file_size,1);
+	if(base == NULL)
+		return -1;
+	memcpy(base+header.offset[SEC_RHO],model->rho,(size_t)header.size[SEC_RHO]);
+	if(model->probA) memcpy(base+header.offset[SEC_PROBA],model->probA,(size_t)header.size[SEC_PROBA]);
+	if(model->probB) memcpy(base+header.offset[SEC_PROBB],model->probB,(size_t)header.size[SEC_PROBB]);
+	if(model->label) memcpy(base+header.offset[SEC_LABEL],model->label,(size_t)header.size[SEC_LABEL]);
+	if(model->nSV) memcpy(base+header.offset[SEC_NSV],model->nSV,(size_t)header.size[SEC_NSV]);
+	if(header.size[SEC_SV_INDICES] > 0)
+		memcpy(base+header.offset[SEC_SV_INDICES],model->sv_indices,(size_t)header.size[SEC_SV_INDICES]);
+	for(i=0;i<nr_coef && l>0;i++)
+		memcpy(base+header.offset[SEC_SV_COEF]+sizeof(double)*i*l,model->sv_coef[i],sizeof(double)*l);
+	if(quantization == SV_DOUBLE)
+		write_nodes(base,header.offset[SEC_SV_START],header.offset[SEC_SV_NODE],model->SV,l,param.kernel_type);
+	else
+	{
+		double *lo = (double *)(base+header.offset[SEC_SV_LO]);
+		double *step = (double *)(base+header.offset[SEC_SV_STEP]);
+		if(grid)
+			quantize_grid(model,sv_dim,quantization,lo,step);
+		write_quantized_nodes(base,&header,model,lo,step);
+	}
+	if(model->w) memcpy(base+header.offset[SEC_W],model->w,(size_t)header.size[SEC_W]);
+	if(model->landmark)
+		write_nodes(base,header.offset[SEC_LANDMARK_START],header.offset[SEC_LANDMARK_NODE],
+			model->landmark,model->nr_feature,LINEAR);
+	if(model->phase) memcpy(base+header.offset[SEC_PHASE],model->phase,(size_t)header.size[SEC_PHASE]);
+	if(model->omega) memcpy(base+header.offset[SEC_OMEGA],model->omega,(size_t)header.size[SEC_OMEGA]);
+
+	header.checksum = binary_checksum(&header,base);
+	memcpy(base,&header,sizeof(header));
+
+	FILE *fp = fopen(model_file_name,"wb");
+	if(fp == NULL)
+	{
+		free(base);
+		return -1;
+	}
+	size_t written = fwrite(base,1,(size_t)header.file_size,fp);
+	free(base);
+	if(written != header.file_size || ferror(fp) != 0 || fclose(fp) != 0) return -1;
 	else return 0;
 }
 
-static char *line = NULL;
-static int max_line_len;
+// point n rows into the nodes, checking that each one is terminated
+static svm_node **map_nodes(const uint64_t *start, svm_node *node, uint64_t nr_node, int n)
+{
+	if(start[0] != 0 || start[n] != nr_node)
+		return NULL;
+	for(int i=0;i<n;i++)
+		if(start[i+1] <= start[i] || start[i+1] > nr_node || node[start[i+1]-1].index != -1)
+			return NULL;
+	svm_node **x = Malloc(svm_node *,n > 0 ? n : 1);
+	for(int i=0;i<n;i++)
+		x[i] = node+start[i];
+	return x;
+}
 
-static char* readline(FILE *input)
+// expand quantized SVs into allocated nodes, NULL if an index is invalid
+static svm_node *expand_nodes(const char *base, const binary_header *header)
 {
-	int len;
+	int quantization = header->quantization;
+	bool grid = quantization != SV_FP16;
+	uint64_t nr_node = header->size[SEC_SV_INDEX]/sizeof(int32_t);
+	const int32_t *index = (const int32_t *)(base+header->offset[SEC_SV_INDEX]);
+	const void *q = base+header->offset[SEC_SV_QVALUE];
+	const double *lo = (const double *)(base+header->offset[SEC_SV_LO]);
+	const double *step = (const double *)(base+header->offset[SEC_SV_STEP]);
+	svm_node *node = Malloc(svm_node,nr_node > 0 ? nr_node : 1);
+	for(uint64_t j=0;j<nr_node;j++)
+	{
+		int d = index[j];
+		node[j].index = d;
+		if(d == -1)
+			node[j].value = 0;
+		else if(d < 1 || (grid && d > header->sv_dim))
+		{
+			free(node);
+			return NULL;
+		}
+		else
+			node[j].value = dequantize(q,j,quantization,grid ? lo[d-1] : 0,grid ? step[d-1] : 0);
+	}
+	return node;
+}
 
-	if(fgets(line,max_line_len,input) == NULL)
+// Load a model saved by svm_save_model_binary. The model uses the
+// arrays of the mapped file directly; only the row pointers of SV,
+// sv_coef and landmark are allocated, and the SVs if they are quantized.
+svm_model *svm_load_model_mmap(const char *model_file_name)
+{
+	if(!little_endian_host())
 		return NULL;
+	file_mapping *mapping = map_file(model_file_name);
+	if(mapping == NULL)
+		return NULL;
+	char *base = (char *)mapping->base;
+	const binary_header *header = (const binary_header *)base;
+
+	const char *error = NULL;
+	if(mapping->size < sizeof(binary_header) ||
+	   memcmp(header->magic,BINARY_MAGIC,sizeof(header->magic)) != 0)
+		error = "not a binary model file";
+	else if(header->version != BINARY_VERSION || header->byte_order != BINARY_BYTE_ORDER ||
+		header->header_size != sizeof(binary_header) || header->node_size != sizeof(svm_node))
+		error = "unsupported binary model format";
+	else if(header->file_size != mapping->size || header->file_size % 8 != 0 ||
+		binary_checksum(header,base) != header->checksum)
+		error = "corrupted binary model file";
+
+	int nr_dec = 0, nr_coef = 0;
+	if(error == NULL)
+	{
+		svm_parameter param;
+		param.svm_type = header->svm_type;
+		param.multiclass = header->multiclass;
+		if(header->nr_class < 1 || header->l < 0 || header->nr_feature < 0 ||
+		   header->quantization < SV_DOUBLE || header->quantization > SV_UINT16 || header->sv_dim < 0)
+			error = "corrupted binary model file";
+		else
+		{
+			nr_dec = nr_decision(param,header->nr_class);
+			nr_coef = nr_sv_coef(param,header->nr_class);
+		}
+		for(int i=0;i<NR_SECTION && error==NULL;i++)
+			if(header->size[i] > 0 && (header->offset[i] % BINARY_ALIGN != 0 ||
+			   header->offset[i] < sizeof(binary_header) || header->offset[i] > header->file_size ||
+			   header->size[i] > header->file_size-header->offset[i]))
+				error = "corrupted binary model file";
+	}
+	if(error == NULL &&
+	   (header->size[SEC_RHO] != sizeof(double)*nr_dec ||
+	    header->size[SEC_SV_COEF] != sizeof(double)*nr_coef*header->l ||
+	    header->size[SEC_SV_START] != sizeof(uint64_t)*(header->l+1) ||
+	    (header->size[SEC_PROBA] && header->size[SEC_PROBA] != sizeof(double)*nr_dec) ||
+	    (header->size[SEC_PROBB] && header->size[SEC_PROBB] != sizeof(double)*nr_dec) ||
+	    (header->size[SEC_LABEL] && header->size[SEC_LABEL] != sizeof(int32_t)*header->nr_class) ||
+	    (header->size[SEC_NSV] && header->size[SEC_NSV] != sizeof(int32_t)*header->nr_class) ||
+	    (header->size[SEC_SV_INDICES] && header->size[SEC_SV_INDICES] != sizeof(int32_t)*header->l) ||
+	    (header->size[SEC_W] && header->size[SEC_W] != sizeof(double)*nr_dec*header->nr_feature) ||
+	    (header->size[SEC_LANDMARK_START] && header->size[SEC_LANDMARK_START] != sizeof(uint64_t)*(header->nr_feature+1)) ||
+	    (header->size[SEC_PHASE] && header->size[SEC_PHASE] != sizeof(double)*header->nr_feature) ||
+	    (header->size[SEC_OMEGA] && (header->nr_feature == 0 ||
+	     header->size[SEC_OMEGA] % (sizeof(double)*header->nr_feature) != 0))))
+		error = "corrupted binary model file";
+	int quantization = header->quantization;
+	if(error == NULL && quantization != SV_DOUBLE)
+	{
+		bool grid = quantization != SV_FP16;
+		uint64_t nr_node = header->size[SEC_SV_INDEX]/sizeof(int32_t);
+		if(header->l == 0 || header->kernel_type == PRECOMPUTED ||
+		   header->size[SEC_SV_NODE] != 0 || header->size[SEC_SV_INDEX] % sizeof(int32_t) != 0 ||
+		   header->size[SEC_SV_QVALUE] != quantized_size(quantization)*nr_node ||
+		   header->size[SEC_SV_LO] != (grid ? sizeof(double)*header->sv_dim : 0) ||
+		   header->size[SEC_SV_STEP] != (grid ? sizeof(double)*header->sv_dim : 0))
+			error = "corrupted binary model file";
+	}
 
-	while(strrchr(line,'\n') == NULL)
+	svm_node **SV = NULL, **landmark = NULL, *node = NULL;
+	if(error == NULL)
 	{
-		max_line_len *= 2;
-		line = (char *) realloc(line,max_line_len);
-		len = (int) strlen(line);
-		if(fgets(line+len,max_line_len-len,input) == NULL)
-			break;
+		const uint64_t *start = (const uint64_t *)(base+header->offset[SEC_SV_START]);
+		if(quantization == SV_DOUBLE)
+			SV = map_nodes(start,(svm_node *)(base+header->offset[SEC_SV_NODE]),
+				header->size[SEC_SV_NODE]/sizeof(svm_node),header->l);
+		else if((node = expand_nodes(base,header)) != NULL)
+			SV = map_nodes(start,node,header->size[SEC_SV_INDEX]/sizeof(int32_t),header->l);
+		if(header->size[SEC_LANDMARK_START] > 0)
+			landmark = map_nodes((const uint64_t *)(base+header->offset[SEC_LANDMARK_START]),
+				(svm_node *)(base+header->offset[SEC_LANDMARK_NODE]),
+				header->size[SEC_LANDMARK_NODE]/sizeof(svm_node),header->nr_feature);
+		if(SV == NULL || (header->size[SEC_LANDMARK_START] > 0 && landmark == NULL))
+			error = "corrupted binary model file";
+	}
+	if(error != NULL)
+	{
+		fprintf(stderr,"ERROR: %s\n",error);
+		free(SV);
+		free(landmark);
+		free(node);
+		unmap_file(mapping);
+		return NULL;
 	}
-	return line;
+
+	svm_model *model = Malloc(svm_model,1);
+	svm_parameter& param = model->param;
+	memset(&param,0,sizeof(param));
+	param.nr_thread = 1;
+	param.svm_type = header->svm_type;
+	param.kernel_type = header->kernel_type;
+	param.degree = header->degree;
+	param.gamma = header->gamma;
+	param.coef0 = header->coef0;
+	param.approx = header->approx;
+	param.multiclass = header->multiclass;
+	model->nr_class = header->nr_class;
+	model->l = header->l;
+	model->nr_feature = header->nr_feature;
+
+#define SECTION(type,sec) (header->size[sec] > 0 ? (type *)(base+header->offset[sec]) : NULL)
+	model->rho = SECTION(double,SEC_RHO);
+	model->probA = SECTION(double,SEC_PROBA);
+	model->probB = SECTION(double,SEC_PROBB);
+	model->label = SECTION(int,SEC_LABEL);
+	model->nSV = SECTION(int,SEC_NSV);
+	model->sv_indices = SECTION(int,SEC_SV_INDICES);
+	model->w = SECTION(double,SEC_W);
+	model->phase = SECTION(double,SEC_PHASE);
+	model->omega = SECTION(double,SEC_OMEGA);
+#undef SECTION
+	model->omega_dim = model->omega ? (int)(header->size[SEC_OMEGA]/(sizeof(double)*model->nr_feature)) : 0;
+	model->sv_coef = Malloc(double *,nr_coef);
+	for(int i=0;i<nr_coef;i++)
+		model->sv_coef[i] = (double *)(base+header->offset[SEC_SV_COEF])+(size_t)i*model->l;
+	model->SV = SV;
+	model->landmark = landmark;
+	model->free_sv = quantization != SV_DOUBLE;	// SV[0] is the expanded nodes
+	model->mapping = mapping;
+	return model;
 }
 
 //
-// FSCANF helps to handle fscanf failures.
-// Its do-while block avoids the ambiguity when
-// if (...)
-//    FSCANF();
-// is used
+// Binary dataset file, see svm_dataset.h
 //
-#define FSCANF(_stream, _format, _var) do{ if (fscanf(_stream, _format, _var) != 1) return false; }while(0)
-bool read_model_header(FILE *fp, svm_model* model)
+int svm_save_problem_binary(const char *file_name, const svm_problem *prob)
 {
-	svm_parameter& param = model->param;
-	char cmd[81];
-	while(1)
-	{
-		FSCANF(fp,"%80s",cmd);
+	if(!little_endian_host())
+		return -1;
 
-		if(strcmp(cmd,"svm_type")==0)
-		{
-			FSCANF(fp,"%80s",cmd);
-			int i;
-			for(i=0;svm_type_table[i];i++)
-			{
-				if(strcmp(svm_type_table[i],cmd)==0)
-				{
-					param.svm_type=i;
-					break;
-				}
-			}
-			if(svm_type_table[i] == NULL)
-			{
-				fprintf(stderr,"unknown svm type.\n");
-				return false;
-			}
-		}
-		else if(strcmp(cmd,"kernel_type")==0)
-		{		
-			FSCANF(fp,"%80s",cmd);
-			int i;
-			for(i=0;kernel_type_table[i];i++)
-			{
-				if(strcmp(kernel_type_table[i],cmd)==0)
-				{
-					param.kernel_type=i;
-					break;
-				}
-			}
-			if(kernel_type_table[i] == NULL)
-			{
-				fprintf(stderr,"unknown kernel function.\n");	
-				return false;
-			}
-		}
-		else if(strcmp(cmd,"degree")==0)
-			FSCANF(fp,"%d",&param.degree);
-		else if(strcmp(cmd,"gamma")==0)
-			FSCANF(fp,"%lf",&param.gamma);
-		else if(strcmp(cmd,"coef0")==0)
-			FSCANF(fp,"%lf",&param.coef0);
-		else if(strcmp(cmd,"nr_class")==0)
-			FSCANF(fp,"%d",&model->nr_class);
-		else if(strcmp(cmd,"total_sv")==0)
-			FSCANF(fp,"%d",&model->l);
-		else if(strcmp(cmd,"rho")==0)
-		{
-			int n = model->nr_class * (model->nr_class-1)/2;
-			model->rho = Malloc(double,n);
-			for(int i=0;i<n;i++)
-				FSCANF(fp,"%lf",&model->rho[i]);
-		}
-		else if(strcmp(cmd,"label")==0)
-		{
-			int n = model->nr_class;
-			model->label = Malloc(int,n);
-			for(int i=0;i<n;i++)
-				FSCANF(fp,"%d",&model->label[i]);
-		}
-		else if(strcmp(cmd,"probA")==0)
-		{
-			int n = model->nr_class * (model->nr_class-1)/2;
-			model->probA = Malloc(double,n);
-			for(int i=0;i<n;i++)
-				FSCANF(fp,"%lf",&model->probA[i]);
-		}
-		else if(strcmp(cmd,"probB")==0)
+	int l = prob->l;
+	int i;
+	const svm_node *p;
+	svm_dataset_header header;
+	svm_dataset_init(&header,SVM_DATASET_CSR,0);
+	header.l = l;
+	for(i=0;i<l;i++)
+		for(p=prob->x[i];p->index!=-1;p++)
 		{
-			int n = model->nr_class * (model->nr_class-1)/2;
-			model->probB = Malloc(double,n);
-			for(int i=0;i<n;i++)
-				FSCANF(fp,"%lf",&model->probB[i]);
+			if(p->index < 0)
+				return -1;
+			header.min_index = min(header.min_index,p->index);
+			header.max_index = max(header.max_index,p->index);
+			header.nnz++;
 		}
-		else if(strcmp(cmd,"nr_sv")==0)
+	header.file_size = svm_dataset_layout(&header);
+
+	FILE *fp = fopen(file_name,"wb");
+	if(fp == NULL)
+		return -1;
+	uint64_t pos = 0;
+	bool ok = svm_dataset_write_header(fp,&pos,&header) &&
+		svm_dataset_write(fp,&pos,prob->y,sizeof(double)*l);
+
+	// the rows go out through buffers of block entries
+	const size_t block = 1<<16;
+	uint64_t *start = Malloc(uint64_t,block);
+	uint32_t *index = Malloc(uint32_t,block);
+	float *value = Malloc(float,block);
+	uint64_t k = 0;
+	size_t n = 0;
+
+	ok = ok && svm_dataset_pad(fp,&pos,header.offset_start);
+	start[n++] = 0;
+	for(i=0;i<l && ok;i++)
+	{
+		for(p=prob->x[i];p->index!=-1;p++)
+			k++;
+		start[n++] = k;
+		if(n == block)
 		{
-			int n = model->nr_class;
-			model->nSV = Malloc(int,n);
-			for(int i=0;i<n;i++)
-				FSCANF(fp,"%d",&model->nSV[i]);
+			ok = svm_dataset_write(fp,&pos,start,sizeof(uint64_t)*n);
+			n = 0;
 		}
-		else if(strcmp(cmd,"SV")==0)
+	}
+	ok = ok && svm_dataset_write(fp,&pos,start,sizeof(uint64_t)*n) && svm_dataset_pad(fp,&pos,header.offset_index);
+	n = 0;
+	for(i=0;i<l && ok;i++)
+		for(p=prob->x[i];p->index!=-1 && ok;p++)
 		{
-			while(1)
+			index[n++] = (uint32_t)p->index;
+			if(n == block)
 			{
-				int c = getc(fp);
-				if(c==EOF || c=='\n') break;
+				ok = svm_dataset_write(fp,&pos,index,sizeof(uint32_t)*n);
+				n = 0;
 			}
-			break;
 		}
-		else
+	ok = ok && svm_dataset_write(fp,&pos,index,sizeof(uint32_t)*n) && svm_dataset_pad(fp,&pos,header.offset_value);
+	n = 0;
+	for(i=0;i<l && ok;i++)
+		for(p=prob->x[i];p->index!=-1 && ok;p++)
 		{
-			fprintf(stderr,"unknown text in model file: [%s]\n",cmd);
-			return false;
+			value[n++] = (float)p->value;
+			if(n == block)
+			{
+				ok = svm_dataset_write(fp,&pos,value,sizeof(float)*n);
+				n = 0;
+			}
 		}
-	}
-
-	return true;
+	ok = ok && svm_dataset_write(fp,&pos,value,sizeof(float)*n) && svm_dataset_pad(fp,&pos,header.file_size);
 
+	free(start);
+	free(index);
+	free(value);
+	if(fclose(fp) != 0 || !ok) return -1;
+	else return 0;
 }
 
-svm_model *svm_load_model(const char *model_file_name)
+// Write the rows as svm_node arrays (SVM_DATASET_NODES) for training on
+// the mapped file.  With group_classes the rows are stored in the order of
+// svm_group_classes, so that training reads the file front to back.
+int svm_save_problem_nodes(const char *file_name, const svm_problem *prob, int group_classes)
 {
-	FILE *fp = fopen(model_file_name,"rb");
-	if(fp==NULL) return NULL;
+	if(!little_endian_host())
+		return -1;
 
-	char *old_locale = strdup(setlocale(LC_ALL, NULL));
-	setlocale(LC_ALL, "C");
-
-	// read parameters
+	int l = prob->l;
+	int i;
+	const svm_node *p;
+	svm_dataset_header header;
+	svm_dataset_init(&header,SVM_DATASET_NODES,sizeof(svm_node));
+	header.l = l;
+	for(i=0;i<l;i++)
+		for(p=prob->x[i];p->index!=-1;p++)
+		{
+			if(p->index < 0)
+				return -1;
+			header.min_index = min(header.min_index,p->index);
+			header.max_index = max(header.max_index,p->index);
+			header.nnz++;
+		}
+	header.file_size = svm_dataset_layout(&header);
 
-	svm_model *model = Malloc(svm_model,1);
-	model->rho = NULL;
-	model->probA = NULL;
-	model->probB = NULL;
-	model->sv_indices = NULL;
-	model->label = NULL;
-	model->nSV = NULL;
-	
-	// read header
-	if (!read_model_header(fp, model))
+	int *perm = Malloc(int,l > 0 ? l : 1);
+	if(group_classes && l > 0)
 	{
-		fprintf(stderr, "ERROR: fscanf failed to read model\n");
-		setlocale(LC_ALL, old_locale);
-		free(old_locale);
-		free(model->rho);
-		free(model->label);
-		free(model->nSV);
-		free(model);
-		return NULL;
+		int nr_class;
+		int *label = NULL;
+		int *start = NULL;
+		int *count = NULL;
+		svm_group_classes(prob,&nr_class,&label,&start,&count,perm);
+		free(label);
+		free(start);
+		free(count);
 	}
-	
-	// read sv_coef and SV
-
-	int elements = 0;
-	long pos = ftell(fp);
-
-	max_line_len = 1024;
-	line = Malloc(char,max_line_len);
-	char *p,*endptr,*idx,*val;
+	else
+		for(i=0;i<l;i++)
+			perm[i] = i;
 
-	while(readline(fp)!=NULL)
+	FILE *fp = fopen(file_name,"wb");
+	if(fp == NULL)
 	{
-		p = strtok(line,":");
-		while(1)
+		free(perm);
+		return -1;
+	}
+	uint64_t pos = 0;
+	bool ok = svm_dataset_write_header(fp,&pos,&header);
+
+	const size_t block = 1<<16;
+	double *y = Malloc(double,block);
+	uint64_t *start = Malloc(uint64_t,block);
+	uint64_t k = 0;
+	size_t n = 0;
+	for(i=0;i<l && ok;i++)
+	{
+		y[n++] = prob->y[perm[i]];
+		if(n == block)
 		{
-			p = strtok(NULL,":");
-			if(p == NULL)
-				break;
-			++elements;
+			ok = svm_dataset_write(fp,&pos,y,sizeof(double)*n);
+			n = 0;
 		}
 	}
-	elements += model->l;
-
-	fseek(fp,pos,SEEK_SET);
-
-	int m = model->nr_class - 1;
-	int l = model->l;
-	model->sv_coef = Malloc(double *,m);
-	int i;
-	for(i=0;i<m;i++)
-		model->sv_coef[i] = Malloc(double,l);
-	model->SV = Malloc(svm_node*,l);
-	svm_node *x_space = NULL;
-	if(l>0) x_space = Malloc(svm_node,elements);
-
-	int j=0;
-	for(i=0;i<l;i++)
+	ok = ok && svm_dataset_write(fp,&pos,y,sizeof(double)*n) && svm_dataset_pad(fp,&pos,header.offset_start);
+	n = 0;
+	start[n++] = 0;
+	for(i=0;i<l && ok;i++)
 	{
-		readline(fp);
-		model->SV[i] = &x_space[j];
-
-		p = strtok(line, " \t");
-		model->sv_coef[0][i] = strtod(p,&endptr);
-		for(int k=1;k<m;k++)
+		for(p=prob->x[perm[i]];p->index!=-1;p++)
+			k++;
+		start[n++] = ++k;
+		if(n == block)
 		{
-			p = strtok(NULL, " \t");
-			model->sv_coef[k][i] = strtod(p,&endptr);
+			ok = svm_dataset_write(fp,&pos,start,sizeof(uint64_t)*n);
+			n = 0;
 		}
+	}
+	ok = ok && svm_dataset_write(fp,&pos,start,sizeof(uint64_t)*n) && svm_dataset_pad(fp,&pos,header.offset_index);
+	// the rows are contiguous with their terminators already
+	for(i=0;i<l && ok;i++)
+	{
+		p = prob->x[perm[i]];
+		size_t len = 1;
+		while(p[len-1].index != -1)
+			len++;
+		ok = svm_dataset_write(fp,&pos,p,sizeof(svm_node)*len);
+	}
+	ok = ok && svm_dataset_pad(fp,&pos,header.file_size);
 
-		while(1)
-		{
-			idx = strtok(NULL, ":");
-			val = strtok(NULL, " \t");
+	free(perm);
+	free(y);
+	free(start);
+	if(fclose(fp) != 0 || !ok) return -1;
+	else return 0;
+}
 
-			if(val == NULL)
-				break;
-			x_space[j].index = (int) strtol(idx,&endptr,10);
-			x_space[j].value = strtod(val,&endptr);
+// the header of a valid dataset file, NULL otherwise.  The feature
+// indices of SVM_DATASET_NODES rows are checked only with check_index;
+// the header, row offsets and terminators always are.
+static const svm_dataset_header *check_problem_file(const file_mapping *mapping, bool check_index)
+{
+	const char *base = (const char *)mapping->base;
+	const svm_dataset_header *header = (const svm_dataset_header *)base;
+	if(!svm_dataset_check(header,mapping->size) || header->l > INT_MAX)
+		return NULL;
+	uint64_t l = header->l;
+	const uint64_t *start = (const uint64_t *)(base+header->offset_start);
+	bool ok = start[0] == 0;
+	if(header->layout == SVM_DATASET_NODES)
+	{
+		// as map_nodes: each row ends at its own terminator
+		const svm_node *node = (const svm_node *)(base+header->offset_index);
+		ok = ok && header->node_size == sizeof(svm_node) && start[l] == header->nnz+l;
+		for(uint64_t i=0;i<l && ok;i++)
+			ok = start[i] < start[i+1] && start[i+1] <= start[l] && node[start[i+1]-1].index == -1;
+		for(uint64_t i=0,k=0;i<l && ok && check_index;i++,k++)
+			for(;k+1<start[i+1] && ok;k++)
+				ok = node[k].index >= header->min_index && node[k].index <= header->max_index;
+	}
+	else
+	{
+		const uint32_t *index = (const uint32_t *)(base+header->offset_index);
+		ok = ok && start[l] == header->nnz;
+		for(uint64_t i=0;i<l && ok;i++)
+			ok = start[i] <= start[i+1];
+		for(uint64_t k=0;k<header->nnz && ok;k++)
+			ok = index[k] >= (uint32_t)header->min_index && index[k] <= (uint32_t)header->max_index;
+	}
+	return ok ? header : NULL;
+}
 
-			++j;
+// copy the rows of a checked file into allocated arrays
+static void expand_problem(const char *base, const svm_dataset_header *header, svm_problem *prob, svm_node **x_space)
+{
+	int l = (int)header->l;
+	const uint64_t *start = (const uint64_t *)(base+header->offset_start);
+	prob->l = l;
+	prob->y = Malloc(double,l > 0 ? l : 1);
+	prob->x = Malloc(svm_node *,l > 0 ? l : 1);
+	*x_space = Malloc(svm_node,header->nnz+l > 0 ? header->nnz+l : 1);
+	if(l > 0)
+		memcpy(prob->y,base+header->offset_y,sizeof(double)*l);
+	svm_node *node = *x_space;
+	if(header->layout == SVM_DATASET_NODES)
+	{
+		memcpy(node,base+header->offset_index,sizeof(svm_node)*(header->nnz+l));
+		for(int i=0;i<l;i++)
+			prob->x[i] = node+start[i];
+		return;
+	}
+	const uint32_t *index = (const uint32_t *)(base+header->offset_index);
+	const float *value = (const float *)(base+header->offset_value);
+	int nr_thread = max_parse_thread();
+#pragma omp parallel for schedule(static) num_threads(nr_thread) if(nr_thread > 1 && header->nnz > PARSE_CHUNK)
+	for(int i=0;i<l;i++)
+	{
+		svm_node *x = node+start[i]+i;
+		prob->x[i] = x;
+		for(uint64_t k=start[i];k<start[i+1];k++,x++)
+		{
+			x->index = (int)index[k];
+			x->value = value[k];
 		}
-		x_space[j++].index = -1;
+		x->index = -1;
+	}
+}
+
+// Read a file of svm_save_problem_binary or svm_save_problem_nodes into
+// prob; the rows point into *x_space.  The caller frees prob->y, prob->x
+// and *x_space.
+int svm_load_problem_binary(const char *file_name, svm_problem *prob, svm_node **x_space)
+{
+	prob->l = 0;
+	prob->y = NULL;
+	prob->x = NULL;
+	*x_space = NULL;
+	if(!little_endian_host())
+		return -1;
+	file_mapping *mapping = map_file(file_name);
+	if(mapping == NULL)
+		return -1;
+	const svm_dataset_header *header = check_problem_file(mapping,true);
+	if(header == NULL)
+	{
+		fprintf(stderr,"ERROR: not a valid binary dataset file\n");
+		unmap_file(mapping);
+		return -1;
 	}
-	free(line);
+	expand_problem((const char *)mapping->base,header,prob,x_space);
+	unmap_file(mapping);
+	return 0;
+}
 
-	setlocale(LC_ALL, old_locale);
-	free(old_locale);
+struct problem_mapping
+{
+	file_mapping *file;	// the rows of a SVM_DATASET_NODES file
+	svm_node *x_space;	// or the expanded rows of a SVM_DATASET_CSR file
+	double *y;
+};
 
-	if (ferror(fp) != 0 || fclose(fp) != 0)
+// Map a dataset file for training: with SVM_DATASET_NODES the labels and
+// rows stay in the file and are paged in as the solver needs them, so
+// the problem may exceed the memory and the kernel cache takes what is
+// left.  Other files are read as svm_load_problem_binary does.  The
+// feature indices of a mapped file are checked only with check_index, as
+// that reads the whole file; without it the caller checks them when it
+// first goes through the rows.  The model trained on prob points into the
+// mapping; free it (or save it) before svm_unmap_problem.  Returns NULL
+// on error.
+void *svm_load_problem_mmap(const char *file_name, svm_problem *prob, int check_index)
+{
+	prob->l = 0;
+	prob->y = NULL;
+	prob->x = NULL;
+	if(!little_endian_host())
 		return NULL;
+	file_mapping *file = map_file(file_name);
+	if(file == NULL)
+		return NULL;
+	char *base = (char *)file->base;
+#if !defined(_WIN32) && defined(MADV_SEQUENTIAL) && defined(MADV_NORMAL)
+	// the check reads the file front to back, training does not
+	madvise(base,file->size,MADV_SEQUENTIAL);
+	const svm_dataset_header *header = check_problem_file(file,check_index != 0);
+	madvise(base,file->size,MADV_NORMAL);
+#else
+	const svm_dataset_header *header = check_problem_file(file,check_index != 0);
+#endif
+	if(header == NULL)
+	{
+		fprintf(stderr,"ERROR: not a valid binary dataset file\n");
+		unmap_file(file);
+		return NULL;
+	}
 
-	model->free_sv = 1;	// XXX
-	return model;
+	problem_mapping *mapping = Malloc(problem_mapping,1);
+	if(header->layout != SVM_DATASET_NODES)
+	{
+		expand_problem(base,header,prob,&mapping->x_space);
+		unmap_file(file);
+		mapping->file = NULL;
+		mapping->y = prob->y;
+		return mapping;
+	}
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+	// labels and row offsets are small and wanted up front
+	madvise(base,(size_t)header->offset_index,MADV_WILLNEED);
+#endif
+	int l = (int)header->l;
+	const uint64_t *start = (const uint64_t *)(base+header->offset_start);
+	svm_node *node = (svm_node *)(base+header->offset_index);
+	prob->l = l;
+	prob->y = (double *)(base+header->offset_y);
+	prob->x = Malloc(svm_node *,l > 0 ? l : 1);
+	for(int i=0;i<l;i++)
+		prob->x[i] = node+start[i];
+	mapping->file = file;
+	mapping->x_space = NULL;
+	mapping->y = NULL;
+	return mapping;
+}
+
+void svm_unmap_problem(svm_problem *prob, void *mapping_ptr)
+{
+	problem_mapping *mapping = (problem_mapping *)mapping_ptr;
+	free(prob->x);
+	prob->l = 0;
+	prob->y = NULL;
+	prob->x = NULL;
+	if(mapping == NULL)
+		return;
+	free(mapping->y);
+	free(mapping->x_space);
+	if(mapping->file)
+		unmap_file(mapping->file);
+	free(mapping);
 }
 
 void svm_free_model_content(svm_model* model_ptr)
 {
+	if(model_ptr->mapping)
+	{
+		// only the row pointers are allocated, the arrays are in the file
+		if(model_ptr->free_sv && model_ptr->l > 0 && model_ptr->SV != NULL)
+			free((void *)(model_ptr->SV[0]));
+		free(model_ptr->SV);
+		free(model_ptr->sv_coef);
+		free(model_ptr->landmark);
+		unmap_file((file_mapping *)model_ptr->mapping);
+		model_ptr->mapping = NULL;
+		model_ptr->SV = NULL;
+		model_ptr->sv_coef = NULL;
+		model_ptr->landmark = NULL;
+		model_ptr->rho = NULL;
+		model_ptr->probA = NULL;
+		model_ptr->probB = NULL;
+		model_ptr->label = NULL;
+		model_ptr->nSV = NULL;
+		model_ptr->sv_indices = NULL;
+		model_ptr->w = NULL;
+		model_ptr->phase = NULL;
+		model_ptr->omega = NULL;
+		return;
+	}
 	if(model_ptr->free_sv && model_ptr->l > 0 && model_ptr->SV != NULL)
 		free((void *)(model_ptr->SV[0]));
 	if(model_ptr->sv_coef)
 	{
-		for(int i=0;i<model_ptr->nr_class-1;i++)
+		for(int i=0;i<nr_sv_coef(model_ptr->param,model_ptr->nr_class);i++)
 			free(model_ptr->sv_coef[i]);
 	}
 
@@ -3008,6 +7700,20 @@ void svm_free_model_content(svm_model* model_ptr)
 
 	free(model_ptr->nSV);
 	model_ptr->nSV = NULL;
+
+	free(model_ptr->w);
+	model_ptr->w = NULL;
+
+	if(model_ptr->landmark && model_ptr->nr_feature > 0)
+		free(model_ptr->landmark[0]);
+	free(model_ptr->landmark);
+	model_ptr->landmark = NULL;
+
+	free(model_ptr->phase);
+	model_ptr->phase = NULL;
+
+	free(model_ptr->omega);
+	model_ptr->omega = NULL;
 }
 
 void svm_free_and_destroy_model(svm_model** model_ptr_ptr)
@@ -3045,7 +7751,8 @@ const char *svm_check_parameter(const svm_problem *prob, const svm_parameter *pa
 	   kernel_type != POLY &&
 	   kernel_type != RBF &&
 	   kernel_type != SIGMOID &&
-	   kernel_type != PRECOMPUTED)
+	   kernel_type != PRECOMPUTED &&
+	   kernel_type != INTERSECTION)
 		return "unknown kernel type";
 
 	if(param->gamma < 0)
@@ -3082,6 +7789,44 @@ const char *svm_check_parameter(const svm_problem *prob, const svm_parameter *pa
 	   param->shrinking != 1)
 		return "shrinking != 0 and shrinking != 1";
 
+	if(param->nr_thread < 1)
+		return "nr_thread < 1";
+
+	if(param->ws_size < 2)
+		return "ws_size < 2";
+
+	if(param->linear_solver != SOLVER_AUTO &&
+	   param->linear_solver != SOLVER_SMO &&
+	   param->linear_solver != SOLVER_DCD_L1 &&
+	   param->linear_solver != SOLVER_DCD_L2)
+		return "unknown linear solver";
+	if(svm_type == C_SVC && kernel_type == LINEAR &&
+	   (param->linear_solver == SOLVER_DCD_L1 || param->linear_solver == SOLVER_DCD_L2) &&
+	   has_index_below_one(prob))
+		return "dual coordinate descent needs feature indices >= 1";
+
+	if(param->multiclass != OVO &&
+	   param->multiclass != OVR)
+		return "unknown multiclass type";
+	if(param->multiclass == OVR && svm_type != C_SVC)
+		return "one-vs-rest is only supported for C-SVC";
+
+	if(param->approx != NO_APPROX)
+	{
+		if(param->approx != NYSTROM_UNIFORM &&
+		   param->approx != NYSTROM_KMEANS &&
+		   param->approx != FOURIER)
+			return "unknown kernel approximation";
+		if(svm_type != C_SVC)
+			return "kernel approximation is only supported for C-SVC";
+		if(kernel_type != RBF && kernel_type != INTERSECTION)
+			return "kernel approximation needs the RBF or intersection kernel";
+		if(param->approx == FOURIER && kernel_type != RBF)
+			return "random Fourier features need the RBF kernel";
+		if(param->approx_dim < 1)
+			return "approx_dim < 1";
+	}
+
 	if(param->probability != 0 &&
 	   param->probability != 1)
 		return "probability != 0 and probability != 1";
@@ -3147,6 +7892,28 @@ const char *svm_check_parameter(const svm_problem *prob, const svm_parameter *pa
 	return NULL;
 }
 
+const char *svm_check_incremental_parameter(const svm_model *model, const svm_problem *old_prob, const svm_parameter *param)
+{
+	if(model->param.svm_type != C_SVC || param->svm_type != C_SVC)
+		return "incremental training is only supported for C-SVC";
+	if(model->param.multiclass != OVO || param->multiclass != OVO)
+		return "incremental training is only supported for one-vs-one";
+	if(model->w || param->approx != NO_APPROX ||
+	   (param->kernel_type == LINEAR && (param->linear_solver == SOLVER_DCD_L1 || param->linear_solver == SOLVER_DCD_L2)))
+		return "incremental training needs models with SVs";
+	if(model->param.kernel_type == PRECOMPUTED || param->kernel_type == PRECOMPUTED)
+		return "incremental training does not support precomputed kernels";
+	if(old_prob)
+	{
+		if(model->sv_indices == NULL)
+			return "old_prob needs the sv_indices of the model";
+		for(int i=0;i<model->l;i++)
+			if(model->sv_indices[i] < 1 || model->sv_indices[i] > old_prob->l)
+				return "sv_indices of the model do not match old_prob";
+	}
+	return NULL;
+}
+
 int svm_check_probability_model(const svm_model *model)
 {
 	return ((model->param.svm_type == C_SVC || model->param.svm_type == NU_SVC) &&
@@ -3162,3 +7929,39 @@ void svm_set_print_string_function(void (*print_func)(const char *))
 	else
 		svm_print_string = print_func;
 }
+
+svm_context *svm_create_context()
+{
+	svm_context *ctx = Malloc(svm_context,1);
+	ctx->print_func = &print_string_stdout;
+	ctx->rng = rng_init(1);
+	return ctx;
+}
+
+void svm_free_context(svm_context **ctx_ptr_ptr)
+{
+	if(ctx_ptr_ptr != NULL && *ctx_ptr_ptr != NULL)
+	{
+		if(thread_context == *ctx_ptr_ptr)
+			thread_context = NULL;
+		free(*ctx_ptr_ptr);
+		*ctx_ptr_ptr = NULL;
+	}
+}
+
+void svm_context_set_print_string_function(svm_context *ctx, void (*print_func)(const char *))
+{
+	ctx->print_func = print_func != NULL ? print_func : &print_string_stdout;
+}
+
+void svm_context_srand(svm_context *ctx, int seed)
+{
+	ctx->rng = rng_init(seed);
+}
+
+svm_context *svm_set_thread_context(svm_context *ctx)
+{
+	svm_context *old_ctx = thread_context;
+	thread_context = ctx;
+	return old_ctx;
+}
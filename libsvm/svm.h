@@ -23,7 +23,11 @@ struct svm_problem
 };
 
 enum { C_SVC, NU_SVC, ONE_CLASS, EPSILON_SVR, NU_SVR };	/* svm_type */
-enum { LINEAR, POLY, RBF, SIGMOID, PRECOMPUTED }; /* kernel_type */
+enum { LINEAR, POLY, RBF, SIGMOID, PRECOMPUTED, INTERSECTION }; /* kernel_type */
+enum { SOLVER_AUTO, SOLVER_SMO, SOLVER_DCD_L1, SOLVER_DCD_L2 };	/* linear_solver */
+enum { NO_APPROX, NYSTROM_UNIFORM, NYSTROM_KMEANS, FOURIER };	/* approx */
+enum { OVO, OVR };	/* multiclass */
+enum { SV_DOUBLE, SV_FP16, SV_UINT8, SV_UINT16 };	/* quantization */
 
 struct svm_parameter
 {
@@ -44,6 +48,13 @@ struct svm_parameter
 	double p;	/* for EPSILON_SVR */
 	int shrinking;	/* use the shrinking heuristics */
 	int probability; /* do probability estimates */
+	int nr_thread;	/* number of threads for training (OpenMP) */
+	int ws_size;	/* working set size of the solver, 2 for SMO */
+	int linear_solver;	/* for C_SVC with the LINEAR kernel */
+	int approx;	/* kernel approximation, for C_SVC */
+	int approx_dim;	/* number of landmarks or random features */
+	int seed;	/* for the random choices of approx */
+	int multiclass;	/* one-vs-one or one-vs-rest, for C_SVC */
 };
 
 //
@@ -56,10 +67,21 @@ struct svm_model
 	int l;			/* total #SV */
 	struct svm_node **SV;		/* SVs (SV[l]) */
 	double **sv_coef;	/* coefficients for SVs in decision functions (sv_coef[k-1][l]) */
+				/* (sv_coef[k][l] for one-vs-rest with k > 2) */
 	double *rho;		/* constants in decision functions (rho[k*(k-1)/2]) */
+				/* (rho[k] for one-vs-rest with k > 2) */
 	double *probA;		/* pariwise probability information */
 	double *probB;
 	int *sv_indices;        /* sv_indices[0,...,nSV-1] are values in [1,...,num_traning_data] to indicate SVs in the training set */
+	int nr_feature;		/* dimension of w */
+	double *w;		/* primal weights of linear decision functions (w[k*(k-1)/2*nr_feature]), */
+				/* NULL if the model uses SVs */
+	struct svm_node **landmark;	/* with NYSTROM_*, w applies to the kernel values */
+				/* with the landmarks (landmark[nr_feature]) */
+	double *phase;		/* with FOURIER, w applies to cos(omega_k.x + phase[k]) */
+	double *omega;		/* with FOURIER, omega_k = omega[k*omega_dim..(k+1)*omega_dim-1] */
+				/* for the inputs 1..omega_dim (landmark is NULL) */
+	int omega_dim;
 
 	/* for classification only */
 
@@ -69,16 +91,31 @@ struct svm_model
 	/* XXX */
 	int free_sv;		/* 1 if svm_model is created by svm_load_model*/
 				/* 0 if svm_model is created by svm_train */
+	void *mapping;		/* the mapped file if svm_model is created by */
+				/* svm_load_model_mmap, NULL otherwise */
 };
 
+/* prediction-only form of a model, see svm_compile_model */
+struct svm_compiled_model;
+
 struct svm_model *svm_train(const struct svm_problem *prob, const struct svm_parameter *param);
+struct svm_model *svm_train_incremental(const struct svm_model *model, const struct svm_problem *prob, const struct svm_problem *old_prob, const struct svm_parameter *param);
 void svm_cross_validation(const struct svm_problem *prob, const struct svm_parameter *param, int nr_fold, double *target);
 
 int svm_save_model(const char *model_file_name, const struct svm_model *model);
 struct svm_model *svm_load_model(const char *model_file_name);
+int svm_save_model_binary(const char *model_file_name, const struct svm_model *model);
+int svm_save_model_binary_quantized(const char *model_file_name, const struct svm_model *model, int quantization);
+struct svm_model *svm_load_model_mmap(const char *model_file_name);
+int svm_save_problem_binary(const char *file_name, const struct svm_problem *prob);
+int svm_load_problem_binary(const char *file_name, struct svm_problem *prob, struct svm_node **x_space);
+int svm_save_problem_nodes(const char *file_name, const struct svm_problem *prob, int group_classes);
+void *svm_load_problem_mmap(const char *file_name, struct svm_problem *prob, int check_index);
+void svm_unmap_problem(struct svm_problem *prob, void *mapping);
 
 int svm_get_svm_type(const struct svm_model *model);
 int svm_get_nr_class(const struct svm_model *model);
+int svm_get_nr_decision(const struct svm_model *model);
 void svm_get_labels(const struct svm_model *model, int *label);
 void svm_get_sv_indices(const struct svm_model *model, int *sv_indices);
 int svm_get_nr_sv(const struct svm_model *model);
@@ -87,16 +124,41 @@ double svm_get_svr_probability(const struct svm_model *model);
 double svm_predict_values(const struct svm_model *model, const struct svm_node *x, double* dec_values);
 double svm_predict(const struct svm_model *model, const struct svm_node *x);
 double svm_predict_probability(const struct svm_model *model, const struct svm_node *x, double* prob_estimates);
+double svm_predict_dag(const struct svm_model *model, const struct svm_node *x);
+void svm_predict_batch(const struct svm_model *model, struct svm_node * const *x, int n, int nr_thread, double *predicted_labels, double *dec_values, double *prob_estimates);
+
+struct svm_compiled_model *svm_compile_model(const struct svm_model *model, int nr_thread);
+struct svm_compiled_model *svm_compile_model_quantized(const struct svm_model *model, int nr_thread, int quantization);
+int svm_get_compiled_nr_thread(const struct svm_compiled_model *compiled);
+/* thread picks a workspace: 0 <= thread < svm_get_compiled_nr_thread(compiled) */
+double svm_compiled_predict_values(const struct svm_compiled_model *compiled, int thread, const struct svm_node *x, double* dec_values);
+double svm_compiled_predict(const struct svm_compiled_model *compiled, int thread, const struct svm_node *x);
+void svm_free_compiled_model(struct svm_compiled_model **compiled_ptr_ptr);
+int svm_linearize_model(struct svm_model *model);
+struct svm_model *svm_reduce_model(const struct svm_model *model, int nr_sv, const struct svm_problem *prob, double max_loss, int nr_thread);
 
 void svm_free_model_content(struct svm_model *model_ptr);
 void svm_free_and_destroy_model(struct svm_model **model_ptr_ptr);
 void svm_destroy_param(struct svm_parameter *param);
 
 const char *svm_check_parameter(const struct svm_problem *prob, const struct svm_parameter *param);
+const char *svm_check_incremental_parameter(const struct svm_model *model, const struct svm_problem *old_prob, const struct svm_parameter *param);
 int svm_check_probability_model(const struct svm_model *model);
 
 void svm_set_print_string_function(void (*print_func)(const char *));
 
+/* per-thread output and random numbers, for training models concurrently: */
+/* a thread bound to a context by svm_set_thread_context logs to its print */
+/* function and draws the shuffles of cross validation, probability */
+/* estimates and the linear solver from its own generator; other threads */
+/* use svm_set_print_string_function's and rand() */
+struct svm_context;
+struct svm_context *svm_create_context(void);
+void svm_free_context(struct svm_context **ctx_ptr_ptr);
+void svm_context_set_print_string_function(struct svm_context *ctx, void (*print_func)(const char *));
+void svm_context_srand(struct svm_context *ctx, int seed);
+struct svm_context *svm_set_thread_context(struct svm_context *ctx);	/* returns the previous one */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,126 @@
+#ifndef _SVM_DATASET_H
+#define _SVM_DATASET_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define inline __inline
+#endif
+
+/*
+ * Binary dataset file, written by svm_save_problem_binary and
+ * libsvmwrite(..., '-b 1'): this header followed by 64-byte aligned
+ * arrays in little-endian order
+ *
+ *	double y[l];			labels
+ *	uint64_t start[l+1];		row i is [start[i],start[i+1])
+ *	uint32_t index[nnz];		feature indices as in the text format
+ *	float value[nnz];
+ *
+ * With SVM_DATASET_NODES (svm_save_problem_nodes) the rows are stored
+ * as struct svm_node, each ended by index -1, so that a mapped file can
+ * be trained on in place (svm_load_problem_mmap)
+ *
+ *	double y[l];
+ *	uint64_t start[l+1];		row i begins at node[start[i]], start[l] = nnz+l
+ *	struct svm_node node[nnz+l];	node_size bytes each
+ */
+#define SVM_DATASET_MAGIC "LIBSVMD"
+#define SVM_DATASET_VERSION 2
+#define SVM_DATASET_BYTE_ORDER 0x01020304u
+#define SVM_DATASET_ALIGN 64
+
+enum { SVM_DATASET_CSR, SVM_DATASET_NODES };	/* layout */
+
+struct svm_dataset_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;	/* SVM_DATASET_BYTE_ORDER as written by the host */
+	uint64_t l, nnz;
+	int32_t min_index;	/* 0 if some index is 0 (precomputed kernel), 1 otherwise */
+	int32_t max_index;	/* number of features */
+	uint32_t layout;
+	uint32_t node_size;	/* sizeof(struct svm_node) of the writer, 0 for SVM_DATASET_CSR */
+	uint64_t offset_y, offset_start, offset_index, offset_value;
+	uint64_t file_size;
+};
+
+/* offsets of the arrays, returns the file size */
+static inline uint64_t svm_dataset_layout(struct svm_dataset_header *header)
+{
+	uint64_t offset = sizeof(struct svm_dataset_header);
+#define SVM_DATASET_NEXT(off,size) \
+	(offset = (offset+SVM_DATASET_ALIGN-1)/SVM_DATASET_ALIGN*SVM_DATASET_ALIGN, \
+	 off = offset, offset += (size))
+	SVM_DATASET_NEXT(header->offset_y, sizeof(double)*header->l);
+	SVM_DATASET_NEXT(header->offset_start, sizeof(uint64_t)*(header->l+1));
+	if(header->layout == SVM_DATASET_NODES)
+	{
+		SVM_DATASET_NEXT(header->offset_index, (uint64_t)header->node_size*(header->nnz+header->l));
+		header->offset_value = 0;
+	}
+	else
+	{
+		SVM_DATASET_NEXT(header->offset_index, sizeof(uint32_t)*header->nnz);
+		SVM_DATASET_NEXT(header->offset_value, sizeof(float)*header->nnz);
+	}
+#undef SVM_DATASET_NEXT
+	return (offset+7)/8*8;
+}
+
+/* a header of the given layout with no rows; the writer fills in l, nnz,
+   min_index and max_index, then file_size = svm_dataset_layout(header) */
+static inline void svm_dataset_init(struct svm_dataset_header *header, uint32_t layout, uint32_t node_size)
+{
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, SVM_DATASET_MAGIC, sizeof(header->magic));
+	header->version = SVM_DATASET_VERSION;
+	header->byte_order = SVM_DATASET_BYTE_ORDER;
+	header->min_index = 1;
+	header->layout = layout;
+	header->node_size = node_size;
+}
+
+/* the writers track the file position in *pos; 1 on success */
+static inline int svm_dataset_write(FILE *fp, uint64_t *pos, const void *p, size_t size)
+{
+	*pos += size;
+	return size == 0 || fwrite(p, 1, size, fp) == size;
+}
+
+/* zeros up to offset, the start of the next array */
+static inline int svm_dataset_pad(FILE *fp, uint64_t *pos, uint64_t offset)
+{
+	static const char zero[SVM_DATASET_ALIGN] = {0};
+	size_t n = (size_t)(offset - *pos);
+	*pos = offset;
+	return n == 0 || fwrite(zero, 1, n, fp) == n;
+}
+
+/* the header, padded up to y */
+static inline int svm_dataset_write_header(FILE *fp, uint64_t *pos, const struct svm_dataset_header *header)
+{
+	return svm_dataset_write(fp, pos, header, sizeof(*header)) &&
+		svm_dataset_pad(fp, pos, header->offset_y);
+}
+
+/* 1 if a mapped file of the given size holds a valid header and layout */
+static inline int svm_dataset_check(const struct svm_dataset_header *header, uint64_t size)
+{
+	struct svm_dataset_header expected;
+	if(size < sizeof(struct svm_dataset_header) ||
+	   memcmp(header->magic, SVM_DATASET_MAGIC, sizeof(header->magic)) != 0 ||
+	   header->version != SVM_DATASET_VERSION || header->byte_order != SVM_DATASET_BYTE_ORDER ||
+	   header->l >= (uint64_t)1<<40 || header->nnz >= (uint64_t)1<<40 ||
+	   header->min_index < 0 || header->min_index > 1 || header->max_index < 0)
+		return 0;
+	expected = *header;
+	return svm_dataset_layout(&expected) == size && header->file_size == size &&
+		expected.offset_y == header->offset_y && expected.offset_start == header->offset_start &&
+		expected.offset_index == header->offset_index && expected.offset_value == header->offset_value;
+}
+
+#endif /* _SVM_DATASET_H */
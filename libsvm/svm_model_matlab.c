@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "svm.h"
 
 #include "mex.h"
@@ -10,7 +11,8 @@ typedef int mwIndex;
 #endif
 #endif
 
-#define NUM_OF_RETURN_FIELD 11
+#define NUM_OF_RETURN_FIELD 14
+#define NUM_OF_REQUIRED_FIELD 11	// the fields before "w"
 
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 
@@ -25,26 +27,207 @@ static const char *field_names[] = {
 	"ProbB",
 	"nSV",
 	"sv_coef",
-	"SVs"
+	"SVs",
+	"w",
+	"landmarks",
+	"phase"
 };
 
+// rows x[0..l-1] as a sparse l x num_of_feature matrix
+static const char *nodes_to_matlab(mxArray **out, struct svm_node **x, int l, int num_of_feature, int precomputed)
+{
+	int i, j, ir_index, nonzero_element;
+	double *ptr;
+	mwIndex *ir, *jc;
+	mxArray *pprhs[1], *pplhs[1];	
+
+	if(precomputed)
+	{
+		nonzero_element = l;
+		num_of_feature = 1;
+	}
+	else
+	{
+		nonzero_element = 0;
+		for(i = 0; i < l; i++) {
+			j = 0;
+			while(x[i][j].index != -1) 
+			{
+				nonzero_element++;
+				j++;
+			}
+		}
+	}
+
+	// rows in column, easier accessing
+	*out = mxCreateSparse(num_of_feature, l, nonzero_element, mxREAL);
+	ir = mxGetIr(*out);
+	jc = mxGetJc(*out);
+	ptr = mxGetPr(*out);
+	jc[0] = ir_index = 0;		
+	for(i = 0;i < l; i++)
+	{
+		if(precomputed)
+		{
+			// make a (1 x l) matrix
+			ir[ir_index] = 0; 
+			ptr[ir_index] = x[i][0].value;
+			ir_index++;
+			jc[i+1] = jc[i] + 1;
+		}
+		else
+		{
+			int x_index = 0;
+			while (x[i][x_index].index != -1)
+			{
+				ir[ir_index] = x[i][x_index].index - 1; 
+				ptr[ir_index] = x[i][x_index].value;
+				ir_index++, x_index++;
+			}
+			jc[i+1] = jc[i] + x_index;
+		}
+	}
+	// transpose back to rows
+	pprhs[0] = *out;
+	if(mexCallMATLAB(1, pplhs, 1, pprhs, "transpose"))
+		return "cannot transpose SV matrix";
+	*out = pplhs[0];
+	return NULL;
+}
+
+// Rows begin..end-1 of an m x n sparse matrix as x[0..end-begin-1],
+// converted from its columns in two passes (count, then scatter)
+// without a transposed copy. cursor[j] is the first entry of column j
+// at row begin or later, and is moved past row end-1, so that blocks of
+// rows taken in order cost one pass over the matrix. With dense set, a
+// row has all n columns, zeros included, as a full matrix for the
+// precomputed kernel. Returns the block of nodes that the rows point
+// into.
+struct svm_node *matlab_sparse_rows_to_nodes(const mxArray *matrix, int dense, size_t begin, size_t end, size_t *cursor, struct svm_node **x)
+{
+	size_t i, j, m = end-begin, n = mxGetN(matrix), *pos;
+	mwIndex k, *ir = mxGetIr(matrix), *jc = mxGetJc(matrix);
+	double *ptr = mxGetPr(matrix);
+	struct svm_node *x_space;
+
+	pos = Malloc(size_t, m+1);
+	if(dense)
+		for(i=0;i<=m;i++)
+			pos[i] = i*(n+1);
+	else
+	{
+		memset(pos, 0, (m+1)*sizeof(size_t));
+		for(j=0;j<n;j++)
+			for(k=cursor[j];k<jc[j+1] && ir[k]<end;k++)
+				pos[ir[k]-begin+1]++;
+		// count the '-1' element
+		for(i=0;i<m;i++)
+			pos[i+1] += pos[i]+1;
+	}
+
+	x_space = Malloc(struct svm_node, pos[m] > 0 ? pos[m] : 1);
+	for(i=0;i<m;i++)
+		x[i] = &x_space[pos[i]];
+	if(dense)
+	{
+		for(i=0;i<m;i++)
+		{
+			for(j=0;j<n;j++)
+			{
+				x[i][j].index = (int)j+1;
+				x[i][j].value = 0;
+			}
+			x[i][n].index = -1;
+		}
+		for(j=0;j<n;j++)
+		{
+			for(k=cursor[j];k<jc[j+1] && ir[k]<end;k++)
+				x[ir[k]-begin][j].value = ptr[k];
+			cursor[j] = k;
+		}
+	}
+	else
+	{
+		// columns in order, so each row comes out sorted by index
+		for(j=0;j<n;j++)
+		{
+			for(k=cursor[j];k<jc[j+1] && ir[k]<end;k++)
+			{
+				struct svm_node *node = &x_space[pos[ir[k]-begin]++];
+				node->index = (int)j+1;
+				node->value = ptr[k];
+			}
+			cursor[j] = k;
+		}
+		for(i=0;i<m;i++)
+			x_space[pos[i]].index = -1;
+	}
+	free(pos);
+	return x_space;
+}
+
+// all the rows of a sparse matrix, see matlab_sparse_rows_to_nodes
+struct svm_node *matlab_sparse_to_nodes(const mxArray *matrix, int dense, struct svm_node **x)
+{
+	size_t j, n = mxGetN(matrix), *cursor;
+	mwIndex *jc = mxGetJc(matrix);
+	struct svm_node *x_space;
+
+	cursor = Malloc(size_t, n > 0 ? n : 1);
+	for(j=0;j<n;j++)
+		cursor[j] = jc[j];
+	x_space = matlab_sparse_rows_to_nodes(matrix, dense, 0, mxGetM(matrix), cursor, x);
+	free(cursor);
+	return x_space;
+}
+
+// the rows of a sparse matrix in one block of svm_node; returns the
+// number of rows, -1 if the matrix is not sparse
+static int matlab_to_nodes(const mxArray *matrix, struct svm_node ***x_ret)
+{
+	int sr;
+	struct svm_node **x, *x_space;
+
+	if(!mxIsSparse(matrix))
+		return -1;
+	sr = (int)mxGetM(matrix);
+	x = (struct svm_node **) malloc(sr * sizeof(struct svm_node *));
+	x_space = matlab_sparse_to_nodes(matrix, 0, x);
+	if(sr == 0)
+		free(x_space);
+
+	*x_ret = x;
+	return sr;
+}
+
+// columns of sv_coef: k for one-vs-rest with k > 2 classes, else k-1
+static int nr_sv_coef(const struct svm_model *model)
+{
+	if(model->param.svm_type == C_SVC && model->param.multiclass == OVR && model->nr_class > 2)
+		return model->nr_class;
+	return model->nr_class-1;
+}
+
 const char *model_to_matlab_structure(mxArray *plhs[], int num_of_feature, struct svm_model *model)
 {
 	int i, j, n;
 	double *ptr;
 	mxArray *return_model, **rhs;
 	int out_id = 0;
+	const char *error_msg;
 
 	rhs = (mxArray **)mxMalloc(sizeof(mxArray *)*NUM_OF_RETURN_FIELD);
 
 	// Parameters
-	rhs[out_id] = mxCreateDoubleMatrix(5, 1, mxREAL);
+	rhs[out_id] = mxCreateDoubleMatrix(7, 1, mxREAL);
 	ptr = mxGetPr(rhs[out_id]);
 	ptr[0] = model->param.svm_type;
 	ptr[1] = model->param.kernel_type;
 	ptr[2] = model->param.degree;
 	ptr[3] = model->param.gamma;
 	ptr[4] = model->param.coef0;
+	ptr[5] = model->param.approx;
+	ptr[6] = model->param.multiclass;
 	out_id++;
 
 	// nr_class
@@ -60,7 +243,7 @@ const char *model_to_matlab_structure(mxArray *plhs[], int num_of_feature, struc
 	out_id++;
 
 	// rho
-	n = model->nr_class*(model->nr_class-1)/2;
+	n = svm_get_nr_decision(model);
 	rhs[out_id] = mxCreateDoubleMatrix(n, 1, mxREAL);
 	ptr = mxGetPr(rhs[out_id]);
 	for(i = 0; i < n; i++)
@@ -128,72 +311,62 @@ const char *model_to_matlab_structure(mxArray *plhs[], int num_of_feature, struc
 	out_id++;
 
 	// sv_coef
-	rhs[out_id] = mxCreateDoubleMatrix(model->l, model->nr_class-1, mxREAL);
+	rhs[out_id] = mxCreateDoubleMatrix(model->l, nr_sv_coef(model), mxREAL);
 	ptr = mxGetPr(rhs[out_id]);
-	for(i = 0; i < model->nr_class-1; i++)
+	for(i = 0; i < nr_sv_coef(model); i++)
 		for(j = 0; j < model->l; j++)
 			ptr[(i*(model->l))+j] = model->sv_coef[i][j];
 	out_id++;
 
 	// SVs
+	error_msg = nodes_to_matlab(&rhs[out_id], model->SV, model->l, num_of_feature,
+		model->param.kernel_type == PRECOMPUTED);
+	if(error_msg)
+		return error_msg;
+	out_id++;
+
+	// w, one column per decision function
+	if(model->w)
 	{
-		int ir_index, nonzero_element;
-		mwIndex *ir, *jc;
-		mxArray *pprhs[1], *pplhs[1];	
+		rhs[out_id] = mxCreateDoubleMatrix(model->nr_feature, n, mxREAL);
+		ptr = mxGetPr(rhs[out_id]);
+		for(i = 0; i < model->nr_feature*n; i++)
+			ptr[i] = model->w[i];
+	}
+	else
+		rhs[out_id] = mxCreateDoubleMatrix(0, 0, mxREAL);
+	out_id++;
 
-		if(model->param.kernel_type == PRECOMPUTED)
-		{
-			nonzero_element = model->l;
-			num_of_feature = 1;
-		}
-		else
-		{
-			nonzero_element = 0;
-			for(i = 0; i < model->l; i++) {
-				j = 0;
-				while(model->SV[i][j].index != -1) 
-				{
-					nonzero_element++;
-					j++;
-				}
-			}
-		}
+	// landmarks, or the omega_k of FOURIER as a full matrix
+	if(model->omega)
+	{
+		rhs[out_id] = mxCreateDoubleMatrix(model->nr_feature, model->omega_dim, mxREAL);
+		ptr = mxGetPr(rhs[out_id]);
+		for(i = 0; i < model->nr_feature; i++)
+			for(j = 0; j < model->omega_dim; j++)
+				ptr[j*model->nr_feature+i] = model->omega[i*model->omega_dim+j];
+	}
+	else if(model->landmark)
+	{
+		error_msg = nodes_to_matlab(&rhs[out_id], model->landmark, model->nr_feature, num_of_feature, 0);
+		if(error_msg)
+			return error_msg;
+	}
+	else
+		rhs[out_id] = mxCreateDoubleMatrix(0, 0, mxREAL);
+	out_id++;
 
-		// SV in column, easier accessing
-		rhs[out_id] = mxCreateSparse(num_of_feature, model->l, nonzero_element, mxREAL);
-		ir = mxGetIr(rhs[out_id]);
-		jc = mxGetJc(rhs[out_id]);
+	// phase
+	if(model->phase)
+	{
+		rhs[out_id] = mxCreateDoubleMatrix(model->nr_feature, 1, mxREAL);
 		ptr = mxGetPr(rhs[out_id]);
-		jc[0] = ir_index = 0;		
-		for(i = 0;i < model->l; i++)
-		{
-			if(model->param.kernel_type == PRECOMPUTED)
-			{
-				// make a (1 x model->l) matrix
-				ir[ir_index] = 0; 
-				ptr[ir_index] = model->SV[i][0].value;
-				ir_index++;
-				jc[i+1] = jc[i] + 1;
-			}
-			else
-			{
-				int x_index = 0;
-				while (model->SV[i][x_index].index != -1)
-				{
-					ir[ir_index] = model->SV[i][x_index].index - 1; 
-					ptr[ir_index] = model->SV[i][x_index].value;
-					ir_index++, x_index++;
-				}
-				jc[i+1] = jc[i] + x_index;
-			}
-		}
-		// transpose back to SV in row
-		pprhs[0] = rhs[out_id];
-		if(mexCallMATLAB(1, pplhs, 1, pprhs, "transpose"))
-			return "cannot transpose SV matrix";
-		rhs[out_id] = pplhs[0];
-		out_id++;
+		for(i = 0; i < model->nr_feature; i++)
+			ptr[i] = model->phase[i];
 	}
+	else
+		rhs[out_id] = mxCreateDoubleMatrix(0, 0, mxREAL);
+	out_id++;
 
 	/* Create a struct matrix contains NUM_OF_RETURN_FIELD fields */
 	return_model = mxCreateStructMatrix(1, 1, NUM_OF_RETURN_FIELD, field_names);
@@ -213,12 +386,11 @@ struct svm_model *matlab_matrix_to_model(const mxArray *matlab_struct, const cha
 	int i, j, n, num_of_fields;
 	double *ptr;
 	int id = 0;
-	struct svm_node *x_space;
 	struct svm_model *model;
 	mxArray **rhs;
 
 	num_of_fields = mxGetNumberOfFields(matlab_struct);
-	if(num_of_fields != NUM_OF_RETURN_FIELD) 
+	if(num_of_fields < NUM_OF_REQUIRED_FIELD) 
 	{
 		*msg = "number of return field is not correct";
 		return NULL;
@@ -235,7 +407,18 @@ struct svm_model *matlab_matrix_to_model(const mxArray *matlab_struct, const cha
 	model->label = NULL;
 	model->sv_indices = NULL;
 	model->nSV = NULL;
+	model->nr_feature = 0;
+	model->w = NULL;
+	model->landmark = NULL;
+	model->phase = NULL;
+	model->omega = NULL;
+	model->omega_dim = 0;
+	model->SV = NULL;
 	model->free_sv = 1; // XXX
+	model->mapping = NULL;
+	/* the structure holds no training parameters */
+	memset(&model->param, 0, sizeof(model->param));
+	model->param.nr_thread = 1;
 
 	ptr = mxGetPr(rhs[id]);
 	model->param.svm_type = (int)ptr[0];
@@ -243,6 +426,8 @@ struct svm_model *matlab_matrix_to_model(const mxArray *matlab_struct, const cha
 	model->param.degree	  = (int)ptr[2];
 	model->param.gamma	  = ptr[3];
 	model->param.coef0	  = ptr[4];
+	model->param.approx	  = mxGetM(rhs[id]) > 5 ? (int)ptr[5] : NO_APPROX;
+	model->param.multiclass	  = mxGetM(rhs[id]) > 6 ? (int)ptr[6] : OVO;
 	id++;
 
 	ptr = mxGetPr(rhs[id]);
@@ -254,7 +439,7 @@ struct svm_model *matlab_matrix_to_model(const mxArray *matlab_struct, const cha
 	id++;
 
 	// rho
-	n = model->nr_class * (model->nr_class-1)/2;
+	n = svm_get_nr_decision(model);
 	model->rho = (double*) malloc(n*sizeof(double));
 	ptr = mxGetPr(rhs[id]);
 	for(i=0;i<n;i++)
@@ -313,62 +498,184 @@ struct svm_model *matlab_matrix_to_model(const mxArray *matlab_struct, const cha
 
 	// sv_coef
 	ptr = mxGetPr(rhs[id]);
-	model->sv_coef = (double**) malloc((model->nr_class-1)*sizeof(double));
-	for( i=0 ; i< model->nr_class -1 ; i++ )
+	model->sv_coef = (double**) malloc(nr_sv_coef(model)*sizeof(double));
+	for( i=0 ; i< nr_sv_coef(model) ; i++ )
 		model->sv_coef[i] = (double*) malloc((model->l)*sizeof(double));
-	for(i = 0; i < model->nr_class - 1; i++)
+	for(i = 0; i < nr_sv_coef(model); i++)
 		for(j = 0; j < model->l; j++)
 			model->sv_coef[i][j] = ptr[i*(model->l)+j];
 	id++;
 
 	// SV
+	if(matlab_to_nodes(rhs[id], &model->SV) < 0)
 	{
-		int sr, elements;
-		int num_samples;
-		mwIndex *ir, *jc;
-		mxArray *pprhs[1], *pplhs[1];
-
-		// transpose SV
-		pprhs[0] = rhs[id];
-		if(mexCallMATLAB(1, pplhs, 1, pprhs, "transpose")) 
+		svm_free_and_destroy_model(&model);
+		*msg = "SV matrix should be sparse";
+		return NULL;
+	}
+	id++;
+
+	// w, landmarks and phase, absent in models of older versions
+	{
+		mxArray *w = mxGetField(matlab_struct, 0, "w");
+		mxArray *landmarks = mxGetField(matlab_struct, 0, "landmarks");
+		mxArray *phase = mxGetField(matlab_struct, 0, "phase");
+		struct svm_node **z = NULL;
+		int nr_landmark = -1;
+		if(w != NULL && mxIsEmpty(w) == 0)
+		{
+			n = (int)(mxGetM(w)*mxGetN(w));
+			model->nr_feature = (int)mxGetM(w);
+			model->w = Malloc(double, n);
+			ptr = mxGetPr(w);
+			for(i=0;i<n;i++)
+				model->w[i] = ptr[i];
+		}
+		if(model->param.approx == FOURIER)
+		{
+			// full, or sparse in structs of older versions
+			if(landmarks == NULL || (int)mxGetM(landmarks) != model->nr_feature)
+			{
+				svm_free_and_destroy_model(&model);
+				*msg = "landmarks of the model are not correct";
+				return NULL;
+			}
+			model->omega_dim = (int)mxGetN(landmarks);
+			n = model->nr_feature*model->omega_dim;
+			model->omega = Malloc(double, n > 0 ? n : 1);
+			ptr = mxGetPr(landmarks);
+			if(mxIsSparse(landmarks))
+			{
+				mwIndex k, *ir = mxGetIr(landmarks), *jc = mxGetJc(landmarks);
+				memset(model->omega, 0, (n > 0 ? n : 1)*sizeof(double));
+				for(j=0;j<model->omega_dim;j++)
+					for(k=jc[j];k<jc[j+1];k++)
+						model->omega[ir[k]*model->omega_dim+j] = ptr[k];
+			}
+			else
+				for(i=0;i<model->nr_feature;i++)
+					for(j=0;j<model->omega_dim;j++)
+						model->omega[i*model->omega_dim+j] = ptr[j*model->nr_feature+i];
+		}
+		else if(model->param.approx != NO_APPROX)
 		{
-			svm_free_and_destroy_model(&model);
-			*msg = "cannot transpose SV matrix";
-			return NULL;
+			if(landmarks != NULL)
+				nr_landmark = matlab_to_nodes(landmarks, &z);
+			if(nr_landmark != model->nr_feature)
+			{
+				if(nr_landmark > 0)
+					free(z[0]);
+				free(z);
+				svm_free_and_destroy_model(&model);
+				*msg = "landmarks of the model are not correct";
+				return NULL;
+			}
+			model->landmark = z;
+		}
+		if(model->param.approx == FOURIER)
+		{
+			if(phase == NULL || (int)(mxGetM(phase)*mxGetN(phase)) != model->nr_feature)
+			{
+				svm_free_and_destroy_model(&model);
+				*msg = "phase of the model is not correct";
+				return NULL;
+			}
+			model->phase = Malloc(double, model->nr_feature);
+			ptr = mxGetPr(phase);
+			for(i=0;i<model->nr_feature;i++)
+				model->phase[i] = ptr[i];
 		}
-		rhs[id] = pplhs[0];
+	}
+	mxFree(rhs);
 
-		sr = (int)mxGetN(rhs[id]);
+	return model;
+}
 
-		ptr = mxGetPr(rhs[id]);
-		ir = mxGetIr(rhs[id]);
-		jc = mxGetJc(rhs[id]);
+// A model handle is a 1x1 uint64 id of a model kept in a table of the
+// mex file that created it: svmpredict, which svmtrain '-H 1' calls.
+// Ids are looked up in the table before use and never reused, and the
+// models still live are freed when the mex file is cleared.
+struct model_handle
+{
+	unsigned long long id;
+	struct svm_model *model;
+};
 
-		num_samples = (int)mxGetNzmax(rhs[id]);
+static struct model_handle *handles = NULL;
+static int nr_handle = 0, max_handle = 0;
+static unsigned long long next_id = 0;
 
-		elements = num_samples + sr;
+static void free_matlab_handles(void)
+{
+	int i;
+	for(i=0;i<nr_handle;i++)
+		svm_free_and_destroy_model(&handles[i].model);
+	free(handles);
+	handles = NULL;
+	nr_handle = max_handle = 0;
+}
 
-		model->SV = (struct svm_node **) malloc(sr * sizeof(struct svm_node *));
-		x_space = (struct svm_node *)malloc(elements * sizeof(struct svm_node));
+mxArray *model_to_matlab_handle(struct svm_model *model)
+{
+	mxArray *handle;
 
-		// SV is in column
-		for(i=0;i<sr;i++)
-		{
-			int low = (int)jc[i], high = (int)jc[i+1];
-			int x_index = 0;
-			model->SV[i] = &x_space[low+i];
-			for(j=low;j<high;j++)
-			{
-				model->SV[i][x_index].index = (int)ir[j] + 1; 
-				model->SV[i][x_index].value = ptr[j];
-				x_index++;
-			}
-			model->SV[i][x_index].index = -1;
-		}
+	if(next_id == 0)
+	{
+		// ids from before the mex file was cleared stay invalid
+		next_id = ((unsigned long long)time(NULL) << 24) + 1;
+		mexAtExit(free_matlab_handles);
+	}
+	if(nr_handle == max_handle)
+	{
+		max_handle = max_handle > 0 ? 2*max_handle : 16;
+		handles = (struct model_handle *) realloc(handles, max_handle*sizeof(struct model_handle));
+	}
+	handles[nr_handle].id = next_id;
+	handles[nr_handle].model = model;
+	nr_handle++;
+	handle = mxCreateNumericMatrix(1, 1, mxUINT64_CLASS, mxREAL);
+	*(uint64_T *)mxGetData(handle) = next_id++;
+	return handle;
+}
 
-		id++;
+int is_matlab_handle(const mxArray *handle)
+{
+	return mxIsUint64(handle) && mxGetM(handle) == 1 && mxGetN(handle) == 1;
+}
+
+// the position of a handle in the table, -1 if it is not valid
+static int find_model_handle(const mxArray *handle, const char **msg)
+{
+	unsigned long long id;
+	int i;
+
+	if(!is_matlab_handle(handle))
+	{
+		*msg = "model handle should be a uint64 scalar";
+		return -1;
 	}
-	mxFree(rhs);
+	id = *(uint64_T *)mxGetData(handle);
+	for(i=0;i<nr_handle;i++)
+		if(handles[i].id == id)
+			return i;
+	*msg = "invalid or destroyed model handle";
+	return -1;
+}
 
-	return model;
+struct svm_model *matlab_handle_to_model(const mxArray *handle, const char **msg)
+{
+	int i = find_model_handle(handle, msg);
+	return i >= 0 ? handles[i].model : NULL;
+}
+
+const char *destroy_matlab_handle(const mxArray *handle)
+{
+	const char *msg;
+	int i = find_model_handle(handle, &msg);
+
+	if(i < 0)
+		return msg;
+	svm_free_and_destroy_model(&handles[i].model);
+	handles[i] = handles[--nr_handle];
+	return NULL;
 }
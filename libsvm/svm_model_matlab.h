@@ -1,2 +1,8 @@
 const char *model_to_matlab_structure(mxArray *plhs[], int num_of_feature, struct svm_model *model);
 struct svm_model *matlab_matrix_to_model(const mxArray *matlab_struct, const char **error_message);
+mxArray *model_to_matlab_handle(struct svm_model *model);
+int is_matlab_handle(const mxArray *handle);
+struct svm_model *matlab_handle_to_model(const mxArray *handle, const char **error_message);
+const char *destroy_matlab_handle(const mxArray *handle);
+struct svm_node *matlab_sparse_to_nodes(const mxArray *matrix, int dense, struct svm_node **x);
+struct svm_node *matlab_sparse_rows_to_nodes(const mxArray *matrix, int dense, size_t begin, size_t end, size_t *cursor, struct svm_node **x);
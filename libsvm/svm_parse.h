@@ -0,0 +1,134 @@
+#ifndef _SVM_PARSE_H
+#define _SVM_PARSE_H
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER) && !defined(__cplusplus)
+#define inline __inline
+#endif
+
+/*
+ * Number parsing over a text buffer [p,end) that need not be
+ * null-terminated, shared by svm_load_model and libsvmread.
+ * exact_pow10 is also used by libsvmwrite to format values.
+ * Numbers are parsed in place without locale or errno; those that are
+ * not exact in double arithmetic fall back to SVM_PARSE_STRTOD, strtod
+ * unless defined before this header is included.
+ */
+#ifndef SVM_PARSE_STRTOD
+#define SVM_PARSE_STRTOD strtod
+#endif
+
+/* powers of ten that are exact in double */
+static const double exact_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline int is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+static inline int is_digit(char c) { return (unsigned char)(c-'0') < 10; }
+
+static inline const char *skip_blank(const char *p, const char *end)
+{
+	while(p < end && is_blank(*p))
+		p++;
+	return p;
+}
+
+/* parse a double in [p,end) up to a blank, newline or ':'; NULL on error */
+static inline const char *parse_double(const char *p, const char *end, double *v)
+{
+	const char *start = p;
+	unsigned long long m = 0;
+	int nr_digit = 0, exp10 = 0, neg = 0, any = 0, exact = 1;
+	size_t len;
+	char buf[64], *s, *endptr;
+
+	if(p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	for(;p < end && is_digit(*p);p++,any=1)
+		if(nr_digit < 19)
+		{
+			m = m*10+(unsigned)(*p-'0');
+			if(m) nr_digit++;
+		}
+		else
+			exact = 0;
+	if(p < end && *p == '.')
+	{
+		for(p++;p < end && is_digit(*p);p++,any=1)
+			if(nr_digit < 19)
+			{
+				m = m*10+(unsigned)(*p-'0');
+				if(m) nr_digit++;
+				exp10--;
+			}
+			else
+				exact = 0;
+	}
+	if(any && p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char *q = p+1;
+		int eneg = 0, e = 0;
+		if(q < end && (*q == '-' || *q == '+'))
+			eneg = *q++ == '-';
+		if(q == end || !is_digit(*q))
+			exact = 0;
+		for(;q < end && is_digit(*q);q++)
+			if(e < 10000)
+				e = e*10+(*q-'0');
+		exp10 += eneg ? -e : e;
+		p = q;
+	}
+	if(any && exact && m <= (1ULL<<53) && exp10 >= -22 && exp10 <= 22 &&
+	   (p == end || is_blank(*p) || *p == '\n' || *p == ':'))
+	{
+		double d = (double)m;
+		d = exp10 < 0 ? d/exact_pow10[-exp10] : d*exact_pow10[exp10];
+		*v = neg ? -d : d;
+		return p;
+	}
+
+	/* nan, inf, long mantissas and large exponents; tokens that do not
+	   fit buf are copied to the heap */
+	p = start;
+	while(p < end && !is_blank(*p) && *p != '\n' && *p != ':')
+		p++;
+	len = (size_t)(p-start);
+	if(len == 0)
+		return NULL;
+	s = len < sizeof(buf) ? buf : (char *)malloc(len+1);
+	if(s == NULL)
+		return NULL;
+	memcpy(s,start,len);
+	s[len] = '\0';
+	*v = SVM_PARSE_STRTOD(s,&endptr);
+	if(endptr != s+len)
+		p = NULL;
+	if(s != buf)
+		free(s);
+	return p;
+}
+
+/* parse an int in [p,end); NULL on error or overflow */
+static inline const char *parse_int(const char *p, const char *end, int *v)
+{
+	int neg = 0;
+	long long n = 0;
+	if(p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	if(p == end || !is_digit(*p))
+		return NULL;
+	for(;p < end && is_digit(*p);p++)
+	{
+		n = n*10+(*p-'0');
+		if(n > INT_MAX)
+			return NULL;
+	}
+	*v = (int)(neg ? -n : n);
+	return p;
+}
+
+#endif /* _SVM_PARSE_H */
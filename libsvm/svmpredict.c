@@ -13,32 +13,12 @@ typedef int mwIndex;
 #endif
 
 #define CMD_LEN 2048
+#define ROW_BLOCK 4096	// rows converted and predicted together, per thread
+#define PREDICT_BLOCK 64	// the rows of a block of svm_predict_batch
 
 int print_null(const char *s,...) {}
 int (*info)(const char *fmt,...) = &mexPrintf;
 
-void read_sparse_instance(const mxArray *prhs, int index, struct svm_node *x)
-{
-	int i, j, low, high;
-	mwIndex *ir, *jc;
-	double *samples;
-
-	ir = mxGetIr(prhs);
-	jc = mxGetJc(prhs);
-	samples = mxGetPr(prhs);
-
-	// each column is one instance
-	j = 0;
-	low = (int)jc[index], high = (int)jc[index+1];
-	for(i=low;i<high;i++)
-	{
-		x[j].index = (int)ir[i] + 1;
-		x[j].value = samples[i];
-		j++;
-	}
-	x[j].index = -1;
-}
-
 static void fake_answer(int nlhs, mxArray *plhs[])
 {
 	int i;
@@ -46,15 +26,17 @@ static void fake_answer(int nlhs, mxArray *plhs[])
 		plhs[i] = mxCreateDoubleMatrix(0, 0, mxREAL);
 }
 
-void predict(int nlhs, mxArray *plhs[], const mxArray *prhs[], struct svm_model *model, const int predict_probability)
+void predict(int nlhs, mxArray *plhs[], const mxArray *prhs[], struct svm_model *model, const int predict_probability, const int predict_dag, const int nr_thread)
 {
 	int label_vector_row_num, label_vector_col_num;
 	int feature_number, testing_instance_number;
-	int instance_index;
+	int instance_index, begin, block, nr_row;
+	int i;
 	double *ptr_instance, *ptr_label, *ptr_predict_label; 
 	double *ptr_prob_estimates, *ptr_dec_values, *ptr;
-	struct svm_node *x;
-	mxArray *pplhs[1]; // transposed instance sparse matrix
+	double *predict_labels, *dec_values = NULL;
+	struct svm_node **x, *x_space = NULL;
+	size_t *cursor = NULL;
 	mxArray *tplhs[3]; // temporary storage for plhs[]
 
 	int correct = 0;
@@ -64,6 +46,10 @@ void predict(int nlhs, mxArray *plhs[], const mxArray *prhs[], struct svm_model
 
 	int svm_type=svm_get_svm_type(model);
 	int nr_class=svm_get_nr_class(model);
+	int nr_decision=svm_get_nr_decision(model);
+	int sparse = mxIsSparse(prhs[1]);
+	// precomputed kernel requires all the columns, as with a dense matrix
+	int precomputed = model->param.kernel_type == PRECOMPUTED;
 	double *prob_estimates=NULL;
 
 	// prhs[1] = testing instance matrix
@@ -88,42 +74,24 @@ void predict(int nlhs, mxArray *plhs[], const mxArray *prhs[], struct svm_model
 	ptr_instance = mxGetPr(prhs[1]);
 	ptr_label    = mxGetPr(prhs[0]);
 
-	// transpose instance matrix
-	if(mxIsSparse(prhs[1]))
-	{
-		if(model->param.kernel_type == PRECOMPUTED)
-		{
-			// precomputed kernel requires dense matrix, so we make one
-			mxArray *rhs[1], *lhs[1];
-			rhs[0] = mxDuplicateArray(prhs[1]);
-			if(mexCallMATLAB(1, lhs, 1, rhs, "full"))
-			{
-				mexPrintf("Error: cannot full testing instance matrix\n");
-				fake_answer(nlhs, plhs);
-				return;
-			}
-			ptr_instance = mxGetPr(lhs[0]);
-			mxDestroyArray(rhs[0]);
-		}
-		else
-		{
-			mxArray *pprhs[1];
-			pprhs[0] = mxDuplicateArray(prhs[1]);
-			if(mexCallMATLAB(1, pplhs, 1, pprhs, "transpose"))
-			{
-				mexPrintf("Error: cannot transpose testing instance matrix\n");
-				fake_answer(nlhs, plhs);
-				return;
-			}
-		}
-	}
+	// instances are converted and predicted ROW_BLOCK rows per thread
+	// at a time, fewer if the rows are dense and long, so that the node
+	// copy of the matrix stays bounded
+	block = ROW_BLOCK;
+	if((!sparse || precomputed) && (1<<19)/(feature_number+1) < block)
+		block = (1<<19)/(feature_number+1);
+	if(block < PREDICT_BLOCK)
+		block = PREDICT_BLOCK;
+	block *= nr_thread;
+	if(block > testing_instance_number)
+		block = testing_instance_number > 0 ? testing_instance_number : 1;
 
 	if(predict_probability)
 	{
 		if(svm_type==NU_SVR || svm_type==EPSILON_SVR)
 			info("Prob. model for test data: target value = predicted value + z,\nz: Laplace distribution e^(-|z|/sigma)/(2sigma),sigma=%g\n",svm_get_svr_probability(model));
 		else
-			prob_estimates = (double *) malloc(nr_class*sizeof(double));
+			prob_estimates = (double *) malloc((size_t)block*nr_class*sizeof(double));
 	}
 
 	tplhs[0] = mxCreateDoubleMatrix(testing_instance_number, 1, mxREAL);
@@ -135,6 +103,8 @@ void predict(int nlhs, mxArray *plhs[], const mxArray *prhs[], struct svm_model
 		else
 			tplhs[2] = mxCreateDoubleMatrix(0, 0, mxREAL);
 	}
+	else if(predict_dag)
+		tplhs[2] = mxCreateDoubleMatrix(0, 0, mxREAL);
 	else
 	{
 		// decision values are in plhs[2]
@@ -144,78 +114,108 @@ void predict(int nlhs, mxArray *plhs[], const mxArray *prhs[], struct svm_model
 		   nr_class == 1) // if only one class in training data, decision values are still returned.
 			tplhs[2] = mxCreateDoubleMatrix(testing_instance_number, 1, mxREAL);
 		else
-			tplhs[2] = mxCreateDoubleMatrix(testing_instance_number, nr_class*(nr_class-1)/2, mxREAL);
+			tplhs[2] = mxCreateDoubleMatrix(testing_instance_number, nr_decision, mxREAL);
+		dec_values = (double *) malloc((size_t)block*nr_decision*sizeof(double));
 	}
 
 	ptr_predict_label = mxGetPr(tplhs[0]);
 	ptr_prob_estimates = mxGetPr(tplhs[2]);
 	ptr_dec_values = mxGetPr(tplhs[2]);
-	x = (struct svm_node*)malloc((feature_number+1)*sizeof(struct svm_node) );
-	for(instance_index=0;instance_index<testing_instance_number;instance_index++)
+
+	x = (struct svm_node **) malloc(block*sizeof(struct svm_node *));
+	predict_labels = (double *) malloc(block*sizeof(double));
+	if(sparse)
 	{
-		int i;
-		double target_label, predict_label;
+		mwIndex *jc = mxGetJc(prhs[1]);
+		cursor = (size_t *) malloc((feature_number > 0 ? feature_number : 1)*sizeof(size_t));
+		for(i=0;i<feature_number;i++)
+			cursor[i] = jc[i];
+	}
+	else
+		x_space = (struct svm_node *) malloc((size_t)block*(feature_number+1)*sizeof(struct svm_node));
 
-		target_label = ptr_label[instance_index];
+	for(begin=0;begin<testing_instance_number;begin+=block)
+	{
+		nr_row = testing_instance_number-begin < block ? testing_instance_number-begin : block;
 
-		if(mxIsSparse(prhs[1]) && model->param.kernel_type != PRECOMPUTED) // prhs[1]^T is still sparse
-			read_sparse_instance(pplhs[0], instance_index, x);
+		// rows begin..begin+nr_row-1, each thread filling its own rows
+		// at fixed offsets
+		if(sparse)
+			x_space = matlab_sparse_rows_to_nodes(prhs[1], precomputed, begin, begin+nr_row, cursor, x);
 		else
 		{
-			for(i=0;i<feature_number;i++)
+#pragma omp parallel for private(i) schedule(static) num_threads(nr_thread) if(nr_thread > 1)
+			for(instance_index=0;instance_index<nr_row;instance_index++)
 			{
-				x[i].index = i+1;
-				x[i].value = ptr_instance[testing_instance_number*i+instance_index];
+				struct svm_node *xi = &x_space[(size_t)instance_index*(feature_number+1)];
+				for(i=0;i<feature_number;i++)
+				{
+					xi[i].index = i+1;
+					xi[i].value = ptr_instance[(size_t)testing_instance_number*i+begin+instance_index];
+				}
+				xi[feature_number].index = -1;
+				x[instance_index] = xi;
 			}
-			x[feature_number].index = -1;
 		}
 
-		if(predict_probability)
+		if(prob_estimates != NULL)
+			svm_predict_batch(model, x, nr_row, nr_thread, predict_labels, NULL, prob_estimates);
+		else if(predict_dag)
 		{
-			if(svm_type==C_SVC || svm_type==NU_SVC)
-			{
-				predict_label = svm_predict_probability(model, x, prob_estimates);
-				ptr_predict_label[instance_index] = predict_label;
-				for(i=0;i<nr_class;i++)
-					ptr_prob_estimates[instance_index + i * testing_instance_number] = prob_estimates[i];
-			} else {
-				predict_label = svm_predict(model,x);
-				ptr_predict_label[instance_index] = predict_label;
-			}
+#pragma omp parallel for schedule(dynamic, 64) num_threads(nr_thread) if(nr_thread > 1)
+			for(instance_index=0;instance_index<nr_row;instance_index++)
+				predict_labels[instance_index] = svm_predict_dag(model, x[instance_index]);
 		}
 		else
+			svm_predict_batch(model, x, nr_row, nr_thread, predict_labels, dec_values, NULL);
+
+		if(sparse)
 		{
-			if(svm_type == ONE_CLASS ||
-			   svm_type == EPSILON_SVR ||
-			   svm_type == NU_SVR)
+			free(x_space);
+			x_space = NULL;
+		}
+
+		// outputs in the order of the instances; the statistics are
+		// summed per thread and combined at the end
+#pragma omp parallel for private(i) schedule(static) num_threads(nr_thread) if(nr_thread > 1) \
+		reduction(+:correct,total,error,sump,sumt,sumpp,sumtt,sumpt)
+		for(instance_index=0;instance_index<nr_row;instance_index++)
+		{
+			double target_label, predict_label;
+			int row = begin+instance_index;
+
+			target_label = ptr_label[row];
+			predict_label = predict_labels[instance_index];
+			ptr_predict_label[row] = predict_label;
+
+			if(prob_estimates != NULL)
 			{
-				double res;
-				predict_label = svm_predict_values(model, x, &res);
-				ptr_dec_values[instance_index] = res;
+				for(i=0;i<nr_class;i++)
+					ptr_prob_estimates[row + i * testing_instance_number] = prob_estimates[(size_t)instance_index*nr_class+i];
 			}
-			else
+			else if(!predict_probability && !predict_dag)
 			{
-				double *dec_values = (double *) malloc(sizeof(double) * nr_class*(nr_class-1)/2);
-				predict_label = svm_predict_values(model, x, dec_values);
-				if(nr_class == 1) 
-					ptr_dec_values[instance_index] = 1;
+				if(svm_type == ONE_CLASS ||
+				   svm_type == EPSILON_SVR ||
+				   svm_type == NU_SVR)
+					ptr_dec_values[row] = dec_values[instance_index];
+				else if(nr_class == 1) 
+					ptr_dec_values[row] = 1;
 				else
-					for(i=0;i<(nr_class*(nr_class-1))/2;i++)
-						ptr_dec_values[instance_index + i * testing_instance_number] = dec_values[i];
-				free(dec_values);
+					for(i=0;i<nr_decision;i++)
+						ptr_dec_values[row + i * testing_instance_number] = dec_values[(size_t)instance_index*nr_decision+i];
 			}
-			ptr_predict_label[instance_index] = predict_label;
-		}
 
-		if(predict_label == target_label)
-			++correct;
-		error += (predict_label-target_label)*(predict_label-target_label);
-		sump += predict_label;
-		sumt += target_label;
-		sumpp += predict_label*predict_label;
-		sumtt += target_label*target_label;
-		sumpt += predict_label*target_label;
-		++total;
+			if(predict_label == target_label)
+				++correct;
+			error += (predict_label-target_label)*(predict_label-target_label);
+			sump += predict_label;
+			sumt += target_label;
+			sumpp += predict_label*predict_label;
+			sumtt += target_label*target_label;
+			sumpt += predict_label*target_label;
+			++total;
+		}
 	}
 	if(svm_type==NU_SVR || svm_type==EPSILON_SVR)
 	{
@@ -238,6 +238,10 @@ void predict(int nlhs, mxArray *plhs[], const mxArray *prhs[], struct svm_model
 				((total*sumpp-sump*sump)*(total*sumtt-sumt*sumt));
 
 	free(x);
+	free(x_space);
+	free(cursor);
+	free(predict_labels);
+	free(dec_values);
 	if(prob_estimates != NULL)
 		free(prob_estimates);
 
@@ -257,10 +261,15 @@ void exit_with_help()
 	mexPrintf(
 		"Usage: [predicted_label, accuracy, decision_values/prob_estimates] = svmpredict(testing_label_vector, testing_instance_matrix, model, 'libsvm_options')\n"
 		"       [predicted_label] = svmpredict(testing_label_vector, testing_instance_matrix, model, 'libsvm_options')\n"
+		"       handle = svmpredict('create', model)\n"
+		"       svmpredict('destroy', handle)\n"
 		"Parameters:\n"
-		"  model: SVM model structure from svmtrain.\n"
+		"  model: SVM model structure from svmtrain, or a model handle.\n"
 		"  libsvm_options:\n"
 		"    -b probability_estimates: whether to predict probability estimates, 0 or 1 (default 0); one-class SVM not supported yet\n"
+		"    -d dag: whether to predict by DAG elimination of classes, 0 or 1 (default 0); for one-vs-one classification without -b, and no decision values are returned\n"
+		"    -j nr_thread : set the number of threads used in prediction (default 1)\n"
+		"    -w linearize: whether to fold the SVs of a linear-kernel model into w, 0 or 1 (default 0)\n"
 		"    -q : quiet mode (no outputs)\n"
 		"Returns:\n"
 		"  predicted_label: SVM prediction output vector.\n"
@@ -269,13 +278,64 @@ void exit_with_help()
 	);
 }
 
+// handle = svmpredict('create', model), svmpredict('destroy', handle)
+static void handle_command(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
+{
+	char cmd[16];
+	const char *error_msg = NULL;
+	struct svm_model *model;
+
+	if(nrhs != 2 || mxGetString(prhs[0], cmd, sizeof(cmd)) != 0)
+	{
+		exit_with_help();
+		fake_answer(nlhs, plhs);
+		return;
+	}
+	if(strcmp(cmd, "create") == 0)
+	{
+		if(!mxIsStruct(prhs[1]))
+			error_msg = "model should be a struct array";
+		else if((model = matlab_matrix_to_model(prhs[1], &error_msg)) != NULL)
+		{
+			plhs[0] = model_to_matlab_handle(model);
+			return;
+		}
+	}
+	else if(strcmp(cmd, "destroy") == 0)
+	{
+		if((error_msg = destroy_matlab_handle(prhs[1])) == NULL)
+		{
+			fake_answer(nlhs, plhs);
+			return;
+		}
+	}
+	else
+	{
+		exit_with_help();
+		fake_answer(nlhs, plhs);
+		return;
+	}
+	mexPrintf("Error: %s\n", error_msg);
+	fake_answer(nlhs, plhs);
+}
+
 void mexFunction( int nlhs, mxArray *plhs[],
 		 int nrhs, const mxArray *prhs[] )
 {
 	int prob_estimate_flag = 0;
+	int dag_flag = 0;
+	int linearize_flag = 0;
+	int nr_thread = 1;
+	int own_model;
 	struct svm_model *model;
 	info = &mexPrintf;
 
+	if(nrhs >= 1 && mxIsChar(prhs[0]))
+	{
+		handle_command(nlhs, plhs, nrhs, prhs);
+		return;
+	}
+
 	if(nlhs == 2 || nlhs > 3 || nrhs > 4 || nrhs < 3)
 	{
 		exit_with_help();
@@ -289,7 +349,8 @@ void mexFunction( int nlhs, mxArray *plhs[],
 		return;
 	}
 
-	if(mxIsStruct(prhs[2]))
+	own_model = mxIsStruct(prhs[2]);
+	if(own_model || is_matlab_handle(prhs[2]))
 	{
 		const char *error_msg;
 
@@ -319,6 +380,22 @@ void mexFunction( int nlhs, mxArray *plhs[],
 					case 'b':
 						prob_estimate_flag = atoi(argv[i]);
 						break;
+					case 'd':
+						dag_flag = atoi(argv[i]);
+						break;
+					case 'w':
+						linearize_flag = atoi(argv[i]);
+						break;
+					case 'j':
+						nr_thread = atoi(argv[i]);
+						if(nr_thread < 1)
+						{
+							mexPrintf("nr_thread < 1\n");
+							exit_with_help();
+							fake_answer(nlhs, plhs);
+							return;
+						}
+						break;
 					case 'q':
 						i--;
 						info = &print_null;
@@ -332,13 +409,21 @@ void mexFunction( int nlhs, mxArray *plhs[],
 			}
 		}
 
-		model = matlab_matrix_to_model(prhs[2], &error_msg);
+		// the model of a handle is kept across calls
+		if(own_model)
+			model = matlab_matrix_to_model(prhs[2], &error_msg);
+		else
+			model = matlab_handle_to_model(prhs[2], &error_msg);
 		if (model == NULL)
 		{
 			mexPrintf("Error: can't read model: %s\n", error_msg);
 			fake_answer(nlhs, plhs);
 			return;
 		}
+		// with -w 1, a linear-kernel model predicts with w; a handle
+		// keeps the folded model
+		if(linearize_flag)
+			svm_linearize_model(model);
 
 		if(prob_estimate_flag)
 		{
@@ -346,7 +431,8 @@ void mexFunction( int nlhs, mxArray *plhs[],
 			{
 				mexPrintf("Model does not support probabiliy estimates\n");
 				fake_answer(nlhs, plhs);
-				svm_free_and_destroy_model(&model);
+				if(own_model)
+					svm_free_and_destroy_model(&model);
 				return;
 			}
 		}
@@ -356,13 +442,23 @@ void mexFunction( int nlhs, mxArray *plhs[],
 				info("Model supports probability estimates, but disabled in predicton.\n");
 		}
 
-		predict(nlhs, plhs, prhs, model, prob_estimate_flag);
+		if(prob_estimate_flag && dag_flag)
+		{
+			mexPrintf("DAG prediction does not give probability estimates\n");
+			fake_answer(nlhs, plhs);
+			if(own_model)
+				svm_free_and_destroy_model(&model);
+			return;
+		}
+
+		predict(nlhs, plhs, prhs, model, prob_estimate_flag, dag_flag, nr_thread);
 		// destroy model
-		svm_free_and_destroy_model(&model);
+		if(own_model)
+			svm_free_and_destroy_model(&model);
 	}
 	else
 	{
-		mexPrintf("model file should be a struct array\n");
+		mexPrintf("model file should be a struct array or a model handle\n");
 		fake_answer(nlhs, plhs);
 	}
 
@@ -14,6 +14,7 @@ typedef int mwIndex;
 #endif
 
 #define CMD_LEN 2048
+#define ROW_TILE 128	// rows gathered together from a dense matrix
 #define Malloc(type,n) (type *)malloc((n)*sizeof(type))
 
 void print_null(const char *s) {}
@@ -23,6 +24,11 @@ void exit_with_help()
 {
 	mexPrintf(
 	"Usage: model = svmtrain(training_label_vector, training_instance_matrix, 'libsvm_options');\n"
+	"       model = svmtrain(training_label_vector, training_instance_matrix, 'libsvm_options', old_model);\n"
+	"       (C-SVC on the SVs of old_model and the new data, starting from its alpha;\n"
+	"       sv_indices refer to [old_model.SVs; training_instance_matrix])\n"
+	"       model = svmtrain([], 'data_file', 'libsvm_options');\n"
+	"       (labels and instances from a binary dataset file of libsvmwrite '-b 1')\n"
 	"libsvm_options:\n"
 	"-s svm_type : set type of SVM (default 0)\n"
 	"	0 -- C-SVC		(multi-class classification)\n"
@@ -36,6 +42,7 @@ void exit_with_help()
 	"	2 -- radial basis function: exp(-gamma*|u-v|^2)\n"
 	"	3 -- sigmoid: tanh(gamma*u'*v + coef0)\n"
 	"	4 -- precomputed kernel (kernel values in training_instance_matrix)\n"
+	"	5 -- histogram intersection: sum(min(u,v))\n"
 	"-d degree : set degree in kernel function (default 3)\n"
 	"-g gamma : set gamma in kernel function (default 1/num_features)\n"
 	"-r coef0 : set coef0 in kernel function (default 0)\n"
@@ -46,8 +53,26 @@ void exit_with_help()
 	"-e epsilon : set tolerance of termination criterion (default 0.001)\n"
 	"-h shrinking : whether to use the shrinking heuristics, 0 or 1 (default 1)\n"
 	"-b probability_estimates : whether to train a SVC or SVR model for probability estimates, 0 or 1 (default 0)\n"
+	"-j nr_thread : set the number of threads used in training (default 1)\n"
+	"-W ws_size : set the working set size of the solver, not used by nu-SVC/nu-SVR (default 2)\n"
+	"-L linear_solver : set the solver of C-SVC with the linear kernel (default 0)\n"
+	"	0 -- automatic: 2 if the kernel matrix does not fit the cache (-m), 1 otherwise\n"
+	"	1 -- SMO, the model keeps its SVs\n"
+	"	2 -- dual coordinate descent, L1 loss, the model keeps w\n"
+	"	3 -- dual coordinate descent, L2 loss, the model keeps w\n"
+	"-a approx : train C-SVC with the RBF or intersection kernel on approximate features (default 0)\n"
+	"	0 -- none\n"
+	"	1 -- Nystrom, uniformly sampled landmarks\n"
+	"	2 -- Nystrom, k-means landmarks\n"
+	"	3 -- random Fourier features (RBF only)\n"
+	"-D approx_dim : set the number of landmarks or random features of -a (default 500)\n"
+	"-S seed : set the seed of the random choices of -a (default 1)\n"
+	"-M multiclass : set the multi-class strategy of C-SVC (default 0)\n"
+	"	0 -- one-vs-one, k*(k-1)/2 decision functions\n"
+	"	1 -- one-vs-rest, k decision functions\n"
 	"-wi weight : set the parameter C of class i to weight*C, for C-SVC (default 1)\n"
 	"-v n : n-fold cross validation mode\n"
+	"-H handle : whether to return a model handle for svmpredict instead of a model structure, 0 or 1 (default 0)\n"
 	"-q : quiet mode (no outputs)\n"
 	);
 }
@@ -57,8 +82,10 @@ struct svm_parameter param;		// set by parse_command_line
 struct svm_problem prob;		// set by read_problem
 struct svm_model *model;
 struct svm_node *x_space;
+void *prob_mapping;			// set by read_problem_binary
 int cross_validation;
 int nr_fold;
+int return_handle;
 
 
 double do_cross_validation()
@@ -125,10 +152,18 @@ int parse_command_line(int nrhs, const mxArray *prhs[], char *model_file_name)
 	param.p = 0.1;
 	param.shrinking = 1;
 	param.probability = 0;
+	param.nr_thread = 1;
+	param.ws_size = 2;
+	param.linear_solver = SOLVER_AUTO;
+	param.approx = NO_APPROX;
+	param.approx_dim = 500;
+	param.seed = 1;
+	param.multiclass = OVO;
 	param.nr_weight = 0;
 	param.weight_label = NULL;
 	param.weight = NULL;
 	cross_validation = 0;
+	return_handle = 0;
 
 	if(nrhs <= 1)
 		return 1;
@@ -187,6 +222,27 @@ int parse_command_line(int nrhs, const mxArray *prhs[], char *model_file_name)
 			case 'b':
 				param.probability = atoi(argv[i]);
 				break;
+			case 'j':
+				param.nr_thread = atoi(argv[i]);
+				break;
+			case 'W':
+				param.ws_size = atoi(argv[i]);
+				break;
+			case 'L':
+				param.linear_solver = atoi(argv[i]);
+				break;
+			case 'a':
+				param.approx = atoi(argv[i]);
+				break;
+			case 'D':
+				param.approx_dim = atoi(argv[i]);
+				break;
+			case 'S':
+				param.seed = atoi(argv[i]);
+				break;
+			case 'M':
+				param.multiclass = atoi(argv[i]);
+				break;
 			case 'q':
 				print_func = &print_null;
 				i--;
@@ -200,6 +256,9 @@ int parse_command_line(int nrhs, const mxArray *prhs[], char *model_file_name)
 					return 1;
 				}
 				break;
+			case 'H':
+				return_handle = atoi(argv[i]);
+				break;
 			case 'w':
 				++param.nr_weight;
 				param.weight_label = (int *)realloc(param.weight_label,sizeof(int)*param.nr_weight);
@@ -222,9 +281,11 @@ int parse_command_line(int nrhs, const mxArray *prhs[], char *model_file_name)
 int read_problem_dense(const mxArray *label_vec, const mxArray *instance_mat)
 {
 	// using size_t due to the output type of matlab functions
-	size_t i, j, k, l;
-	size_t elements, max_index, sc, label_vector_row_num;
+	size_t i, l;
+	size_t elements, max_index, sc, label_vector_row_num, *row_start;
 	double *samples, *labels;
+	int t, nr_tile, precomputed = param.kernel_type == PRECOMPUTED;
+	int nr_thread = param.nr_thread > 1 ? param.nr_thread : 1;
 
 	prob.x = NULL;
 	prob.y = NULL;
@@ -234,7 +295,6 @@ int read_problem_dense(const mxArray *label_vec, const mxArray *instance_mat)
 	samples = mxGetPr(instance_mat);
 	sc = mxGetN(instance_mat);
 
-	elements = 0;
 	// number of instances
 	l = mxGetM(instance_mat);
 	label_vector_row_num = mxGetM(label_vec);
@@ -246,43 +306,63 @@ int read_problem_dense(const mxArray *label_vec, const mxArray *instance_mat)
 		return -1;
 	}
 
-	if(param.kernel_type == PRECOMPUTED)
-		elements = l * (sc + 1);
-	else
+	// the matrix is column-major, so rows are gathered in tiles of
+	// ROW_TILE: each column is read as a short contiguous run per tile
+	// rather than one strided element per row
+	nr_tile = (int)((l+ROW_TILE-1)/ROW_TILE);
+	row_start = Malloc(size_t,l+1);
+#pragma omp parallel for schedule(static) num_threads(nr_thread) if(nr_thread > 1)
+	for(t=0;t<nr_tile;t++)
 	{
-		for(i = 0; i < l; i++)
-		{
-			for(k = 0; k < sc; k++)
-				if(samples[k * l + i] != 0)
-					elements++;
-			// count the '-1' element
-			elements++;
-		}
+		size_t i, k, i0 = (size_t)t*ROW_TILE, i1 = i0+ROW_TILE < l ? i0+ROW_TILE : l;
+		// count the '-1' element
+		for(i=i0;i<i1;i++)
+			row_start[i+1] = precomputed ? sc+1 : 1;
+		if(!precomputed)
+			for(k=0;k<sc;k++)
+			{
+				const double *column = samples+k*l;
+				for(i=i0;i<i1;i++)
+					row_start[i+1] += column[i] != 0;
+			}
 	}
+	row_start[0] = 0;
+	for(i=0;i<l;i++)
+		row_start[i+1] += row_start[i];
+	elements = row_start[l];
 
 	prob.y = Malloc(double,l);
 	prob.x = Malloc(struct svm_node *,l);
 	x_space = Malloc(struct svm_node, elements);
 
-	max_index = sc;
-	j = 0;
-	for(i = 0; i < l; i++)
+#pragma omp parallel for schedule(static) num_threads(nr_thread) if(nr_thread > 1)
+	for(t=0;t<nr_tile;t++)
 	{
-		prob.x[i] = &x_space[j];
-		prob.y[i] = labels[i];
-
-		for(k = 0; k < sc; k++)
+		size_t i, k, i0 = (size_t)t*ROW_TILE, i1 = i0+ROW_TILE < l ? i0+ROW_TILE : l;
+		size_t pos[ROW_TILE];
+		for(i=i0;i<i1;i++)
 		{
-			if(param.kernel_type == PRECOMPUTED || samples[k * l + i] != 0)
-			{
-				x_space[j].index = (int)k + 1;
-				x_space[j].value = samples[k * l + i];
-				j++;
-			}
+			prob.x[i] = &x_space[row_start[i]];
+			prob.y[i] = labels[i];
+			pos[i-i0] = row_start[i];
+		}
+		for(k=0;k<sc;k++)
+		{
+			const double *column = samples+k*l;
+			for(i=i0;i<i1;i++)
+				if(precomputed || column[i] != 0)
+				{
+					struct svm_node *x = &x_space[pos[i-i0]++];
+					x->index = (int)k + 1;
+					x->value = column[i];
+				}
 		}
-		x_space[j++].index = -1;
+		for(i=i0;i<i1;i++)
+			x_space[pos[i-i0]].index = -1;
 	}
+	free(row_start);
 
+	max_index = sc;
 	if(param.gamma == 0 && max_index > 0)
 		param.gamma = (double)(1.0/max_index);
 
@@ -301,40 +381,18 @@ int read_problem_dense(const mxArray *label_vec, const mxArray *instance_mat)
 
 int read_problem_sparse(const mxArray *label_vec, const mxArray *instance_mat)
 {
-	mwIndex *ir, *jc, low, high, k;
 	// using size_t due to the output type of matlab functions
-	size_t i, j, l, elements, max_index, label_vector_row_num;
-	mwSize num_samples;
-	double *samples, *labels;
-	mxArray *instance_mat_col; // transposed instance sparse matrix
+	size_t i, l, max_index, label_vector_row_num;
+	double *labels;
 
 	prob.x = NULL;
 	prob.y = NULL;
 	x_space = NULL;
 
-	// transpose instance matrix
-	{
-		mxArray *prhs[1], *plhs[1];
-		prhs[0] = mxDuplicateArray(instance_mat);
-		if(mexCallMATLAB(1, plhs, 1, prhs, "transpose"))
-		{
-			mexPrintf("Error: cannot transpose training instance matrix\n");
-			return -1;
-		}
-		instance_mat_col = plhs[0];
-		mxDestroyArray(prhs[0]);
-	}
-
-	// each column is one instance
 	labels = mxGetPr(label_vec);
-	samples = mxGetPr(instance_mat_col);
-	ir = mxGetIr(instance_mat_col);
-	jc = mxGetJc(instance_mat_col);
-
-	num_samples = mxGetNzmax(instance_mat_col);
 
 	// number of instances
-	l = mxGetN(instance_mat_col);
+	l = mxGetM(instance_mat);
 	label_vector_row_num = mxGetM(label_vec);
 	prob.l = (int) l;
 
@@ -344,34 +402,100 @@ int read_problem_sparse(const mxArray *label_vec, const mxArray *instance_mat)
 		return -1;
 	}
 
-	elements = num_samples + l;
-	max_index = mxGetM(instance_mat_col);
+	max_index = mxGetN(instance_mat);
 
 	prob.y = Malloc(double,l);
 	prob.x = Malloc(struct svm_node *,l);
-	x_space = Malloc(struct svm_node, elements);
-
-	j = 0;
 	for(i=0;i<l;i++)
-	{
-		prob.x[i] = &x_space[j];
 		prob.y[i] = labels[i];
-		low = jc[i], high = jc[i+1];
-		for(k=low;k<high;k++)
-		{
-			x_space[j].index = (int)ir[k] + 1;
-			x_space[j].value = samples[k];
-			j++;
-	 	}
-		x_space[j++].index = -1;
-	}
+	// precomputed kernel requires all the columns, as with a dense matrix
+	x_space = matlab_sparse_to_nodes(instance_mat, param.kernel_type == PRECOMPUTED, prob.x);
 
 	if(param.gamma == 0 && max_index > 0)
 		param.gamma = (double)(1.0/max_index);
 
+	if(param.kernel_type == PRECOMPUTED)
+		for(i=0;i<l;i++)
+		{
+			if((int)prob.x[i][0].value <= 0 || (int)prob.x[i][0].value > (int)max_index)
+			{
+				mexPrintf("Wrong input format: sample_serial_number out of range\n");
+				return -1;
+			}
+		}
+
+	return 0;
+}
+
+// read in a problem from a binary dataset file, mapped in place if it
+// holds svm_node rows
+int read_problem_binary(const mxArray *file_name, int *max_index)
+{
+	char *filename;
+	int i;
+	struct svm_node *p;
+
+	x_space = NULL;
+	filename = mxArrayToString(file_name);
+	if(filename == NULL)
+	{
+		mexPrintf("Error: filename is not a string\n");
+		return -1;
+	}
+	// the indices are checked below, in the pass for max_index
+	prob_mapping = svm_load_problem_mmap(filename, &prob, 0);
+	if(prob_mapping == NULL)
+	{
+		mexPrintf("can't read binary dataset file %s\n", filename);
+		mxFree(filename);
+		return -1;
+	}
+	mxFree(filename);
+
+	*max_index = 0;
+	for(i=0;i<prob.l;i++)
+		for(p=prob.x[i];p->index!=-1;p++)
+		{
+			if(p->index < 0)
+			{
+				mexPrintf("Wrong binary dataset format: negative feature index\n");
+				return -1;
+			}
+			if(p->index > *max_index)
+				*max_index = p->index;
+		}
+
+	if(param.gamma == 0 && *max_index > 0)
+		param.gamma = (double)(1.0/(*max_index));
+
+	if(param.kernel_type == PRECOMPUTED)
+		for(i=0;i<prob.l;i++)
+		{
+			if(prob.x[i][0].index != 0 || (int)prob.x[i][0].value <= 0 || (int)prob.x[i][0].value > *max_index)
+			{
+				mexPrintf("Wrong input format: sample_serial_number out of range\n");
+				return -1;
+			}
+		}
+
 	return 0;
 }
 
+static void free_problem()
+{
+	if(prob_mapping)
+	{
+		svm_unmap_problem(&prob, prob_mapping);
+		prob_mapping = NULL;
+	}
+	else
+	{
+		free(prob.y);
+		free(prob.x);
+		free(x_space);
+	}
+}
+
 static void fake_answer(int nlhs, mxArray *plhs[])
 {
 	int i;
@@ -398,11 +522,11 @@ void mexFunction( int nlhs, mxArray *plhs[],
 	}
 
 	// Transform the input Matrix to libsvm format
-	if(nrhs > 1 && nrhs < 4)
+	if(nrhs > 1 && nrhs < 5)
 	{
-		int err;
+		int err, file_nr_feat = 0;
 
-		if(!mxIsDouble(prhs[0]) || !mxIsDouble(prhs[1]))
+		if(!mxIsDouble(prhs[0]) || !(mxIsDouble(prhs[1]) || mxIsChar(prhs[1])))
 		{
 			mexPrintf("Error: label vector and instance matrix must be double\n");
 			fake_answer(nlhs, plhs);
@@ -424,28 +548,18 @@ void mexFunction( int nlhs, mxArray *plhs[],
 			return;
 		}
 
-		if(mxIsSparse(prhs[1]))
+		if(cross_validation && nrhs > 3)
 		{
-			if(param.kernel_type == PRECOMPUTED)
-			{
-				// precomputed kernel requires dense matrix, so we make one
-				mxArray *rhs[1], *lhs[1];
-
-				rhs[0] = mxDuplicateArray(prhs[1]);
-				if(mexCallMATLAB(1, lhs, 1, rhs, "full"))
-				{
-					mexPrintf("Error: cannot generate a full training instance matrix\n");
-					svm_destroy_param(&param);
-					fake_answer(nlhs, plhs);
-					return;
-				}
-				err = read_problem_dense(prhs[0], lhs[0]);
-				mxDestroyArray(lhs[0]);
-				mxDestroyArray(rhs[0]);
-			}
-			else
-				err = read_problem_sparse(prhs[0], prhs[1]);
+			mexPrintf("Error: cross validation does not take old_model\n");
+			svm_destroy_param(&param);
+			fake_answer(nlhs, plhs);
+			return;
 		}
+
+		if(mxIsChar(prhs[1]))
+			err = read_problem_binary(prhs[1], &file_nr_feat);
+		else if(mxIsSparse(prhs[1]))
+			err = read_problem_sparse(prhs[0], prhs[1]);
 		else
 			err = read_problem_dense(prhs[0], prhs[1]);
 
@@ -457,9 +571,7 @@ void mexFunction( int nlhs, mxArray *plhs[],
 			if (error_msg != NULL)
 				mexPrintf("Error: %s\n", error_msg);
 			svm_destroy_param(&param);
-			free(prob.y);
-			free(prob.x);
-			free(x_space);
+			free_problem();
 			fake_answer(nlhs, plhs);
 			return;
 		}
@@ -473,18 +585,64 @@ void mexFunction( int nlhs, mxArray *plhs[],
 		}
 		else
 		{
-			int nr_feat = (int)mxGetN(prhs[1]);
+			int nr_feat = mxIsChar(prhs[1]) ? file_nr_feat : (int)mxGetN(prhs[1]);
 			const char *error_msg;
-			model = svm_train(&prob, &param);
+			struct svm_model *old_model = NULL;
+			if(nrhs > 3)
+			{
+				if(!mxIsStruct(prhs[3]))
+					error_msg = "old_model should be a struct array";
+				else if((old_model = matlab_matrix_to_model(prhs[3], &error_msg)) != NULL)
+					error_msg = svm_check_incremental_parameter(old_model, NULL, &param);
+				if(error_msg)
+				{
+					mexPrintf("Error: %s\n", error_msg);
+					if(old_model)
+						svm_free_and_destroy_model(&old_model);
+					svm_destroy_param(&param);
+					free_problem();
+					fake_answer(nlhs, plhs);
+					return;
+				}
+				// old SVs may have more features than the new data
+				{
+					int i;
+					struct svm_node *p;
+					for(i=0;i<old_model->l;i++)
+						for(p=old_model->SV[i];p->index!=-1;p++)
+							if(p->index > nr_feat)
+								nr_feat = p->index;
+				}
+				model = svm_train_incremental(old_model, &prob, NULL, &param);
+			}
+			else
+				model = svm_train(&prob, &param);
 			error_msg = model_to_matlab_structure(plhs, nr_feat, model);
 			if(error_msg)
 				mexPrintf("Error: can't convert libsvm model to matrix structure: %s\n", error_msg);
 			svm_free_and_destroy_model(&model);
+			if(return_handle && !error_msg)
+			{
+				// handles live in svmpredict, which builds the model
+				// from the structure as it would to predict with it
+				mxArray *model_struct = plhs[0], *handle, *rhs[2];
+				rhs[0] = mxCreateString("create");
+				rhs[1] = model_struct;
+				if(mexCallMATLAB(1, &handle, 2, rhs, "svmpredict") == 0)
+					plhs[0] = handle;
+				else
+				{
+					mexPrintf("Error: can't create model handle\n");
+					fake_answer(nlhs, plhs);
+				}
+				mxDestroyArray(rhs[0]);
+				mxDestroyArray(model_struct);
+			}
+			if(old_model)
+				svm_free_and_destroy_model(&old_model);
 		}
 		svm_destroy_param(&param);
-		free(prob.y);
-		free(prob.x);
-		free(x_space);
+		free_problem();
 	}
 	else
 	{